@@ -1,3 +1,78 @@
 #include "s3.h"
 
-int main() {}
+static void run(ctx_t *ctx, port_t *in, int print) {
+    for (;;) {
+        ptr x = ctx_read(ctx, in);
+        if (eq_p(x, make_eof())) break;
+        ptr v = eval(ctx, x);
+        if (print && !eq_p(v, make_void())) {
+            ctx_write(ctx, &ctx->out, v, 0);
+            port_putc(&ctx->out, '\n');
+        }
+        if (print) port_flush(&ctx->out);
+    }
+}
+
+// the expressions of the files, or of standard input if there are none, as
+// a list
+static ptr read_files(ctx_t *ctx, char **paths, int n) {
+    GC_LOCALS(l, 3);  // the list, its last pair and the expression read
+    l[0] = make_nil();
+    for (int i = 0; i < n || (n == 0 && i == 0); i++) {
+        FILE *f = n ? fopen(paths[i], "r") : stdin;
+        if (!f) FATAL("can't open %s", paths[i]);
+        port_t in;
+        port_open(&in, f, 0);
+        while (!eq_p(l[2] = ctx_read(ctx, &in), make_eof())) {
+            ptr p = make_pair(&ctx->memory, l[2], make_nil());
+            if (eq_p(l[0], make_nil()))
+                l[0] = p;
+            else
+                GC_STORE(&ctx->memory, ptr_pointer(l[1]), cdr, p);
+            l[1] = p;
+        }
+        port_close(&in);
+        if (n) fclose(f);
+    }
+    ptr forms = l[0];
+    GC_UNLOCALS(l);
+    return forms;
+}
+
+// evaluates the files named on the command line in order, or else standard
+// input, writing the value of each expression read from it. with --image
+// file first, the globals start out as dumped there by dump-heap. with --aot
+// file first, the program the files make up is compiled to C in file
+// instead.
+int main(int argc, char **argv) {
+    static ctx_t ctx;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "--aot") == 0) {
+        ctx_init(&ctx);
+        FILE *out = fopen(argv[2], "w");
+        if (!out) FATAL("can't open %s", argv[2]);
+        aot_compile(&ctx, read_files(&ctx, argv + 3, argc - 3), out);
+        fclose(out);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "--image") == 0) {
+        ctx_init_image(&ctx, argv[2]);
+        first = 3;
+    } else {
+        ctx_init(&ctx);
+    }
+    if (argc == first) run(&ctx, &ctx.in, 1);
+    for (int i = first; i < argc; i++) {
+        FILE *f = fopen(argv[i], "r");
+        if (!f) FATAL("can't open %s", argv[i]);
+        port_t in;
+        port_open(&in, f, 0);
+        run(&ctx, &in, 0);
+        port_close(&in);
+        fclose(f);
+    }
+    port_flush(&ctx.out);
+    vm_profile_report(&ctx, stderr);
+    gc_stats_report(&ctx.memory, stderr);
+    alloc_profile_report(&ctx, stderr);
+}
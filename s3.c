@@ -1,11 +1,24 @@
 #include "s3.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 int lstrcmp(const char_t *s, const char_t *t) {
     long i;
-    for (i = 0; s[i] == t[i]; i++)
+    for (i = 0; s[i] && s[i] == t[i]; i++)
         ;
     if (s[i] > t[i]) return 1;
     if (s[i] < t[i]) return -1;
@@ -75,480 +88,6945 @@ void utf8_putc(FILE *f, char_t c) {
     }
 }
 
-ptr make_fixnum(int64_t x) {
-    ptr p;
-    p.type = T_FIXNUM;
-    p.fixnum = x;
-    return p;
+void port_open(port_t *port, FILE *f, int output) {
+    port->f = f;
+    port->buf = malloc(PORT_BUFFER_SIZE);
+    port->pos = port->end = 0;
+    port->output = output;
 }
 
-ptr make_flonum(long double x) {
-    ptr p;
-    p.type = T_FLONUM;
-    p.flonum = x;
-    return p;
+void port_flush(port_t *port) {
+    if (!port->output) return;
+    fwrite(port->buf, 1, port->pos, port->f);
+    port->pos = 0;
+    fflush(port->f);
 }
 
-ptr make_char(char_t x) {
-    ptr p;
-    p.type = T_CHARACTER;
-    p.character = x;
-    return p;
+void port_close(port_t *port) {
+    port_flush(port);
+    free(port->buf);
+    port->buf = NULL;
+}
+
+// keeps the unread bytes and reads whatever the stream has ready into the
+// rest of the buffer, so that a terminal gives up a line at a time; returns
+// the number of bytes available
+static long port_fill(port_t *port) {
+    long left = port->end - port->pos;
+    memmove(port->buf, port->buf + port->pos, left);
+    port->pos = 0;
+    port->end = left;
+    ssize_t k;
+    do
+        k = read(fileno(port->f), port->buf + left, PORT_BUFFER_SIZE - left);
+    while (k < 0 && errno == EINTR);
+    if (k > 0) port->end += k;
+    return port->end;
+}
+
+// decodes the code point at the read position into *c and returns its length
+// in bytes, or 0 at the end of the stream. a malformed sequence decodes to its
+// first byte. the stream is only read when the buffer is empty or ends in the
+// middle of a sequence.
+static int port_decode(port_t *port, char_t *c) {
+    if (port->pos == port->end && port_fill(port) == 0) return 0;
+    unsigned char *b = port->buf + port->pos;
+    long avail = port->end - port->pos;
+    int n;
+    if (b[0] < 0x80) {
+        *c = b[0];
+        return 1;
+    } else if ((b[0] >> 5) == 0b110) {
+        n = 2;
+        *c = b[0] & 31;
+    } else if ((b[0] >> 4) == 0b1110) {
+        n = 3;
+        *c = b[0] & 15;
+    } else if ((b[0] >> 3) == 0b11110) {
+        n = 4;
+        *c = b[0] & 7;
+    } else {
+        *c = b[0];
+        return 1;
+    }
+    while (n > avail && port_fill(port) > avail) {
+        b = port->buf;
+        avail = port->end;
+    }
+    if (n > avail) {
+        *c = b[0];
+        return 1;
+    }
+    for (int i = 1; i < n; i++) {
+        if ((b[i] >> 6) != 0b10) {
+            *c = b[0];
+            return 1;
+        }
+        *c = *c << 6 | (b[i] & 63);
+    }
+    return n;
+}
+
+char_t port_getc_slow(port_t *port) {
+    char_t c;
+    int n = port_decode(port, &c);
+    if (!n) return EOF;
+    port->pos += n;
+    return c;
+}
+
+char_t port_peekc(port_t *port) {
+    char_t c;
+    return port_decode(port, &c) ? c : EOF;
+}
+
+void port_putc_slow(port_t *port, char_t c) {
+    if (c == EOF) return;
+    if (port->pos + 4 > PORT_BUFFER_SIZE) {
+        fwrite(port->buf, 1, port->pos, port->f);
+        port->pos = 0;
+    }
+    unsigned char *b = port->buf + port->pos;
+    if (c >= 0 && c < 0x80) {
+        b[0] = c;
+        port->pos += 1;
+    } else if (c >= 0 && c < 0x800) {
+        b[0] = 0b11000000 | c >> 6;
+        b[1] = 0b10000000 | (c & 63);
+        port->pos += 2;
+    } else if (c >= 0 && c < 0x10000) {
+        b[0] = 0b11100000 | c >> 12;
+        b[1] = 0b10000000 | (c >> 6 & 63);
+        b[2] = 0b10000000 | (c & 63);
+        port->pos += 3;
+    } else if (c >= 0 && c < 0x110000) {
+        b[0] = 0b11110000 | c >> 18;
+        b[1] = 0b10000000 | (c >> 12 & 63);
+        b[2] = 0b10000000 | (c >> 6 & 63);
+        b[3] = 0b10000000 | (c & 63);
+        port->pos += 4;
+    } else {
+        b[0] = c;
+        port->pos += 1;
+    }
+}
+
+// widens a run of ascii bytes into code points; returns how many it did
+static long ascii_widen(const unsigned char *b, char_t *s, long n) {
+    long i = 0;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(b + i));
+        if (_mm_movemask_epi8(v)) break;
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128((__m128i *)(s + i), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(s + i + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(s + i + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i *)(s + i + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+#endif
+    for (; i < n && b[i] < 0x80; i++) s[i] = b[i];
+    return i;
+}
+
+// narrows a run of ascii code points into bytes; returns how many it did
+static long ascii_narrow(const char_t *s, unsigned char *b, long n) {
+    long i = 0;
+#ifdef __SSE2__
+    __m128i high = _mm_set1_epi32(~0x7f), zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + i + 4));
+        __m128i d = _mm_loadu_si128((const __m128i *)(s + i + 8));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + i + 12));
+        __m128i any = _mm_or_si128(_mm_or_si128(a, c), _mm_or_si128(d, e));
+        any = _mm_cmpeq_epi32(_mm_and_si128(any, high), zero);
+        if (_mm_movemask_epi8(any) != 0xffff) break;
+        __m128i w = _mm_packus_epi16(_mm_packs_epi32(a, c),
+                                     _mm_packs_epi32(d, e));
+        _mm_storeu_si128((__m128i *)(b + i), w);
+    }
+#endif
+    for (; i < n && s[i] >= 0 && s[i] < 0x80; i++) b[i] = s[i];
+    return i;
+}
+
+long port_read_string(port_t *port, char_t *s, long n) {
+    long i = 0;
+    while (i < n) {
+        if (port->pos == port->end && port_fill(port) == 0) break;
+        long run = port->end - port->pos;
+        if (run > n - i) run = n - i;
+        long k = ascii_widen(port->buf + port->pos, s + i, run);
+        port->pos += k;
+        i += k;
+        if (k == run) continue;
+        char_t c = port_getc_slow(port);
+        if (c == EOF) break;
+        s[i++] = c;
+    }
+    return i;
+}
+
+void port_write_string(port_t *port, const char_t *s, long n) {
+    long i = 0;
+    while (i < n) {
+        if (port->pos == PORT_BUFFER_SIZE) {
+            fwrite(port->buf, 1, port->pos, port->f);
+            port->pos = 0;
+        }
+        long run = PORT_BUFFER_SIZE - port->pos;
+        if (run > n - i) run = n - i;
+        long k = ascii_narrow(s + i, port->buf + port->pos, run);
+        port->pos += k;
+        i += k;
+        if (k < run) port_putc_slow(port, s[i++]);
+    }
 }
 
-ptr make_bool(int x) {
-    ptr p;
-    p.type = T_BOOLEAN;
-    p.boolean = x;
+ptr make_flonum(gc_t *gc, double x) {
+    ptr p = gc_alloc(gc, H_FLONUM, sizeof(double));
+    ptr_pointer(p)->flonum = x;
     return p;
 }
 
-ptr make_primitive(int x) {
-    ptr p;
-    p.type = T_PRIMITIVE;
-    p.primitive = x;
+ptr make_pair(gc_t *gc, ptr car, ptr cdr) {
+    GC_LOCALS(l, 2);
+    l[0] = car;
+    l[1] = cdr;
+    ptr p = gc_alloc(gc, H_PAIR, 2 * sizeof(ptr));
+    ptr_pointer(p)->car = l[0];
+    ptr_pointer(p)->cdr = l[1];
+    GC_UNLOCALS(l);
     return p;
 }
 
-ptr make_pointer(obj *p) {
-    ptr pt;
-    pt.type = T_PTR;
-    pt.pointer = p;
-    return pt;
+ptr make_vector(gc_t *gc, long n, ptr fill) {
+    if (n < 0) FATAL("make-vector: negative length");
+    GC_LOCALS(l, 1);
+    l[0] = fill;
+    ptr p = gc_alloc(gc, H_VECTOR,
+                     offsetof(obj, vector) - OBJ_HEADER_SIZE + n * sizeof(ptr));
+    obj *o = ptr_pointer(p);
+    o->vector_size = n;
+    for (long i = 0; i < n; i++) o->vector[i] = l[0];
+    GC_UNLOCALS(l);
+    return p;
 }
 
-ptr make_eof() {
-    ptr p;
-    p.type = T_EOF;
+// allocates a string of n uninitialized characters
+static ptr string_alloc(gc_t *gc, long n, int wide) {
+    long size = offsetof(obj, string_narrow) - OBJ_HEADER_SIZE +
+                n * (wide ? sizeof(char_t) : 1);
+    // leave room for string_target
+    long min = offsetof(obj, string_target) - OBJ_HEADER_SIZE + sizeof(ptr);
+    ptr p = gc_alloc(gc, H_STRING, size > min ? size : min);
+    obj *o = ptr_pointer(p);
+    o->string_size = n;
+    if (wide) o->header |= HDR_STRING_WIDE;
     return p;
 }
 
-ptr make_nil() {
-    ptr p;
-    p.type = T_NIL;
+ptr make_string(gc_t *gc, const char_t *s, long n) {
+    uint32_t all = 0;
+    for (long i = 0; i < n; i++) all |= (uint32_t)s[i];
+    ptr p = string_alloc(gc, n, all > 0xff);
+    obj *o = ptr_pointer(p);
+    if (all > 0xff)
+        memcpy(o->string, s, n * sizeof(char_t));
+    else
+        for (long i = 0; i < n; i++) o->string_narrow[i] = s[i];
     return p;
 }
 
-ptr make_unbound() {
-    ptr p;
-    p.type = T_UNBOUND;
+ptr make_string_fill(gc_t *gc, long n, char_t c) {
+    ptr p = string_alloc(gc, n, (uint32_t)c > 0xff);
+    obj *o = ptr_pointer(p);
+    if ((uint32_t)c > 0xff)
+        for (long i = 0; i < n; i++) o->string[i] = c;
+    else
+        memset(o->string_narrow, c, n);
     return p;
 }
 
-void obarray_init(obarray_t *obarray) {
-    for (int i = 0; i < OBARRAY_HASH_P; i++) obarray->heads[i] = NULL;
-    obarray->count = 0;
+void string_set(gc_t *gc, ptr s, long i, char_t c) {
+    obj *o = string_chars(s);
+    if (o->header & HDR_STRING_WIDE) {
+        o->string[i] = c;
+        return;
+    }
+    if ((uint32_t)c <= 0xff) {
+        o->string_narrow[i] = c;
+        return;
+    }
+    GC_LOCALS(l, 1);
+    l[0] = s;
+    ptr w = string_alloc(gc, string_length(s), 1);
+    obj *wo = ptr_pointer(w);
+    o = ptr_pointer(l[0]);
+    for (long k = 0; k < o->string_size; k++)
+        wo->string[k] = o->string_narrow[k];
+    wo->string[i] = c;
+    GC_STORE(gc, o, string_target, w);
+    o->header |= HDR_STRING_INDIRECT;
+    GC_UNLOCALS(l);
 }
 
-ptr obarray_intern(obarray_t *obarray, const char_t *s) {
-    long long hash = 0;
-    long n = lstrlen(s);
-    for (long i = 0; i < n; i++)
-        for (int j = 0; j < 4; j++)
-            hash = (hash * OBARRAY_HASH_E % OBARRAY_HASH_P +
-                    (s[i] >> (j * 8) & 255) + 1) %
-                   OBARRAY_HASH_P;
-    for (obarray_node_t *u = obarray->heads[hash]; u; u = u->next) {
-        if (lstrcmp(s, u->s) == 0) {
-            ptr p;
-            p.type = T_SYMBOL;
-            p.symbol = u->index;
-            return p;
+#define CHARS_REF(o, i) \
+    ((o)->header & HDR_STRING_WIDE ? (o)->string[i] : (o)->string_narrow[i])
+
+int string_compare(ptr a, ptr b) {
+    obj *x = string_chars(a), *y = string_chars(b);
+    long m = x->string_size, n = y->string_size, k = m < n ? m : n;
+    if (!((x->header | y->header) & HDR_STRING_WIDE)) {
+        // latin-1 bytes compare like their code points
+        int r = memcmp(x->string_narrow, y->string_narrow, k);
+        if (r) return r < 0 ? -1 : 1;
+    } else {
+        for (long i = 0; i < k; i++) {
+            char_t c = CHARS_REF(x, i), d = CHARS_REF(y, i);
+            if (c != d) return c < d ? -1 : 1;
         }
     }
-    obarray->count++;
-    ptr p;
-    p.type = T_SYMBOL;
-    p.symbol = obarray->count;
-    obarray_node_t *v = malloc(sizeof(obarray_node_t));
-    v->index = obarray->count;
-    v->s = malloc((n + 1) * sizeof(char_t));
-    memcpy(v->s, s, (n + 1) * sizeof(char_t));
-    v->next = obarray->heads[hash];
-    obarray->heads[hash] = v;
-    return p;
+    return (m > n) - (m < n);
 }
 
-ptr_move_transform_t make_transform(uint8_t *from, uint8_t *to, size_t size) {
-    ptr_move_transform_t t;
-    t.from = from;
-    t.to = to;
-    t.size = size;
-    return t;
+int string_equal_p(ptr a, ptr b) {
+    obj *x = string_chars(a), *y = string_chars(b);
+    long n = x->string_size;
+    if (n != y->string_size) return 0;
+    if (!((x->header ^ y->header) & HDR_STRING_WIDE)) {
+        if (x->header & HDR_STRING_WIDE)
+            return memcmp(x->string, y->string, n * sizeof(char_t)) == 0;
+        return memcmp(x->string_narrow, y->string_narrow, n) == 0;
+    }
+    for (long i = 0; i < n; i++)
+        if (CHARS_REF(x, i) != CHARS_REF(y, i)) return 0;
+    return 1;
 }
 
-uint8_t *apply_transform(ptr_move_transform_t t, uint8_t *p) {
-    ptrdiff_t offset = p - t.from;
-    if (offset < 0 || offset >= t.size) return p;
-    return p - t.from + t.to;
+// bignums are sign and magnitude, the magnitude being little-endian 64-bit
+// limbs without leading zeros. the limbs_* functions work on raw limb arrays;
+// sizes are in limbs, and results may alias the first operand unless noted.
+typedef uint64_t limb_t;
+typedef unsigned __int128 dlimb_t;
+
+static int limbs_cmp(const limb_t *a, const limb_t *b, long n) {
+    while (n--)
+        if (a[n] != b[n]) return a[n] < b[n] ? -1 : 1;
+    return 0;
 }
 
-obj *apply_transform_obj(ptr_move_transform_t t, obj *p) {
-    return (obj *)apply_transform(t, (uint8_t *)p);
+static long limbs_normalize(const limb_t *a, long n) {
+    while (n && !a[n - 1]) n--;
+    return n;
 }
 
-void gc_init(gc_t *gc) {
-    gc->stack = malloc(GC_INITIAL_SIZE * sizeof(ptr *));
-    gc->stack_size = GC_INITIAL_SIZE;
-    gc->sp = 0;
+static limb_t limbs_add_n(limb_t *r, const limb_t *a, const limb_t *b,
+                          long n) {
+    limb_t c = 0;
+    for (long i = 0; i < n; i++) {
+        dlimb_t s = (dlimb_t)a[i] + b[i] + c;
+        r[i] = s;
+        c = s >> 64;
+    }
+    return c;
+}
 
-    gc->young_from = malloc(GC_INITIAL_SIZE);
-    gc->young_size = GC_INITIAL_SIZE;
-    gc->young_alloc = 0;
+static limb_t limbs_sub_n(limb_t *r, const limb_t *a, const limb_t *b,
+                          long n) {
+    limb_t c = 0;
+    for (long i = 0; i < n; i++) {
+        limb_t x = a[i], y = b[i];
+        r[i] = x - y - c;
+        c = (x < y) | ((x == y) & c);
+    }
+    return c;
+}
 
-    gc->old = malloc(GC_INITIAL_SIZE * GC_OLD_TO_YOUNG_RATIO);
-    gc->old_alloc = 0;
-    gc->old_size = GC_INITIAL_SIZE * GC_OLD_TO_YOUNG_RATIO;
+// an >= bn
+static limb_t limbs_add(limb_t *r, const limb_t *a, long an, const limb_t *b,
+                        long bn) {
+    limb_t c = limbs_add_n(r, a, b, bn);
+    for (long i = bn; i < an; i++) {
+        r[i] = a[i] + c;
+        c = r[i] < c;
+    }
+    return c;
+}
 
-    remset_init(&gc->remset);
+// an >= bn
+static limb_t limbs_sub(limb_t *r, const limb_t *a, long an, const limb_t *b,
+                        long bn) {
+    limb_t c = limbs_sub_n(r, a, b, bn);
+    for (long i = bn; i < an; i++) {
+        limb_t x = a[i];
+        r[i] = x - c;
+        c = x < c;
+    }
+    return c;
 }
 
-void fill_header(obj *o, enum heapvar_type_t type, long size) {
-    o->type = type;
-    o->size = size;
-    o->age = 0;
-    o->moved = 0;
+static limb_t limbs_mul_1(limb_t *r, const limb_t *a, long n, limb_t m) {
+    limb_t c = 0;
+    for (long i = 0; i < n; i++) {
+        dlimb_t p = (dlimb_t)a[i] * m + c;
+        r[i] = p;
+        c = p >> 64;
+    }
+    return c;
 }
 
-int gc_minor(gc_t *gc) {
-    gc->young_to = malloc(gc->young_size);
-    gc->young_alloc = gc->young_to;
-    for (long i = 0; i < gc->sp; i++)
-        *gc->stack[i] = gc_copy(gc, *gc->stack[i]);
-    for (int i = 0; i < HASH_SIZE; i++) {
-        for (remset_hashtable_node **u = gc->remset.heads + i; *u;
-             u = &(*u)->next) {
-            int del = !check_young_refs(gc, (*u)->k);
-            if (del) {
-                remset_hashtable_node *v = *u;
-                *u = (*u)->next;
-                free(v);
-            } else {
-                copy_refs(gc, (*u)->k);
-            }
-        }
+// r += a * m
+static limb_t limbs_addmul_1(limb_t *r, const limb_t *a, long n, limb_t m) {
+    limb_t c = 0;
+    for (long i = 0; i < n; i++) {
+        dlimb_t p = (dlimb_t)a[i] * m + r[i] + c;
+        r[i] = p;
+        c = p >> 64;
     }
+    return c;
+}
 
-    int flag = 0;
-    gc->young_scan = gc->young_to;
-    for (obj *p; gc->young_scan < gc->young_alloc; gc->young_scan += p->size) {
-        p = (obj *)gc->young_scan;
-        p->age++;
-        copy_refs(gc, p);
+// r -= a * m
+static limb_t limbs_submul_1(limb_t *r, const limb_t *a, long n, limb_t m) {
+    limb_t c = 0;
+    for (long i = 0; i < n; i++) {
+        dlimb_t p = (dlimb_t)a[i] * m + c;
+        limb_t lo = p;
+        c = (p >> 64) + (r[i] < lo);
+        r[i] -= lo;
     }
+    return c;
+}
 
-    free(gc->young_from);
-    gc->young_from = gc->young_to;
-    gc->young_to = NULL;
-
-    // we scan objects to tenure after copying, to avoid growing while the to-
-    // semispace is active
-    gc->young_scan = gc->young_from;
-    for (obj *p; gc->young_scan < gc->young_alloc; gc->young_scan += p->size) {
-        p = (obj *)gc->young_scan;
-        if (p->age >= GC_THRESHOLD_AGE) {
-            while (gc->old_alloc + p->size > gc->old + gc->old_size) {
-                flag = 1;
-                gc_grow(gc);
-                p = (obj *)gc->young_scan;
-            }
-            memcpy(gc->old_alloc, p, p->size);
-            p->moved = 1;
-            p->forward = (obj *)gc->old_alloc;
-            gc->old_alloc += p->size;
-        }
+static limb_t limbs_lshift(limb_t *r, const limb_t *a, long n, int s) {
+    if (!s) {
+        memmove(r, a, n * sizeof(limb_t));
+        return 0;
     }
+    limb_t out = a[n - 1] >> (64 - s);
+    for (long i = n - 1; i > 0; i--) r[i] = a[i] << s | a[i - 1] >> (64 - s);
+    r[0] = a[0] << s;
+    return out;
+}
 
-    // resolve pointers to tenured objects
-    for (long i = 0; i < gc->sp; i++) {
-        ptr p = *gc->stack[i];
-        if (p.type != T_PTR) continue;
-        if (p.pointer->moved) p.pointer = p.pointer->forward;
+static void limbs_rshift(limb_t *r, const limb_t *a, long n, int s) {
+    if (!s) {
+        memmove(r, a, n * sizeof(limb_t));
+        return;
     }
-    for (int i = 0; i < HASH_SIZE; i++) {
-        for (remset_hashtable_node *u = gc->remset.heads[i]; u; u = u->next) {
-            resolve_pointers(gc, u->k);
+    for (long i = 0; i < n - 1; i++) r[i] = a[i] >> s | a[i + 1] << (64 - s);
+    r[n - 1] = a[n - 1] >> s;
+}
+
+// multiplication: schoolbook below LIMBS_KARATSUBA limbs, karatsuba below
+// LIMBS_TOOM3, toom-3 above. r must not overlap the operands.
+#define LIMBS_KARATSUBA 32
+#define LIMBS_TOOM3 160
+
+static void limbs_mul_basecase(limb_t *r, const limb_t *a, long an,
+                               const limb_t *b, long bn) {
+    r[an] = limbs_mul_1(r, a, an, b[0]);
+    for (long j = 1; j < bn; j++)
+        r[an + j] = limbs_addmul_1(r + j, a, an, b[j]);
+}
+
+static void limbs_mul(limb_t *r, const limb_t *a, long an, const limb_t *b,
+                      long bn);
+
+// d = |x - y| with x of xn <= n limbs and y of n limbs; returns whether x < y
+static int limbs_absdiff(limb_t *d, const limb_t *x, long xn, const limb_t *y,
+                         long n) {
+    int less = 0;
+    for (long i = n - 1; i >= xn; i--)
+        if (y[i]) {
+            less = 1;
+            break;
         }
+    if (!less) less = limbs_cmp(x, y, xn) < 0;
+    if (less) {
+        limbs_sub(d, y, n, x, xn);
+    } else {
+        limbs_sub_n(d, x, y, xn);
+        // the high limbs of y are zero
+        memset(d + xn, 0, (n - xn) * sizeof(limb_t));
     }
-
-    return flag;
+    return less;
 }
 
-ptr gc_copy(gc_t *gc, ptr p) {
-    if (p.type != T_PTR) return p;
-    ptrdiff_t offset = (uint8_t *)p.pointer - gc->young_from;
-    if (offset < 0 || offset >= gc->young_size) return p;
-    if (p.pointer->moved) {
-        p.pointer = p.pointer->forward;
-        return p;
-    }
-    obj *to = (obj *)gc->young_alloc;
-    gc->young_alloc += p.pointer->size;
-    memcpy(to, p.pointer, p.pointer->size);
-    p.pointer = to;
-    return p;
+// r (2n limbs) = a * b (n limbs each), with scratch s of 4n + 64 limbs
+static void limbs_karatsuba(limb_t *r, const limb_t *a, const limb_t *b,
+                            long n, limb_t *s) {
+    if (n < LIMBS_KARATSUBA) {
+        limbs_mul_basecase(r, a, n, b, n);
+        return;
+    }
+    // a = a1 B^h + a0, with a1 of l >= h limbs
+    long h = n / 2, l = n - h;
+    limb_t *da = s, *db = s + l, *m = s + 2 * l, *next = s + 4 * l;
+    int neg = limbs_absdiff(da, a, h, a + h, l) ^
+              limbs_absdiff(db, b, h, b + h, l);
+    limbs_karatsuba(m, da, db, l, next);
+    limbs_karatsuba(r, a, b, h, next);
+    limbs_karatsuba(r + 2 * h, a + h, b + h, l, next);
+    // a0 b1 + a1 b0 = a0 b0 + a1 b1 - (a0 - a1)(b0 - b1)
+    limb_t *t = next;
+    t[2 * l] = limbs_add(t, r + 2 * h, 2 * l, r, 2 * h);
+    if (neg)
+        t[2 * l] += limbs_add_n(t, t, m, 2 * l);
+    else
+        t[2 * l] -= limbs_sub_n(t, t, m, 2 * l);
+    limbs_add(r + h, r + h, 2 * n - h, t, 2 * l + 1);
 }
 
-#define MAKE_WALKER(op, p)                                               \
-    do {                                                                 \
-        switch (p->type) {                                               \
-            case H_BIGINT:                                               \
-            case H_BYTEVECTOR:                                           \
-            case H_STRING:                                               \
-            case H_CODE:                                                 \
-                break;                                                   \
-            case H_RATIONAL:                                             \
-                op(numerator);                                           \
-                op(denominator);                                         \
-                break;                                                   \
-            case H_COMPLEX:                                              \
-                op(real);                                                \
-                op(imaginary);                                           \
-                break;                                                   \
-            case H_PAIR:                                                 \
-                op(car);                                                 \
-                op(cdr);                                                 \
-                break;                                                   \
-            case H_VECTOR:                                               \
-                for (long i = 0; i < p->vector_size; i++) op(vector[i]); \
-                break;                                                   \
-            case H_ENVIRONMENT:                                          \
-                for (int i = 0; i < BATCH_FATHER_SIZE; i++)              \
-                    op(batch_env_father[i]);                             \
-                for (long i = 0; i < p->env_size; i++) op(entry[i]);     \
-                break;                                                   \
-            case H_ACTIVATION_RECORD:                                    \
-                for (int i = 0; i < BATCH_FATHER_SIZE; i++)              \
-                    op(batch_ar_father[i]);                              \
-                for (long i = 0; i < p->ar_size; i++) op(value[i]);      \
-                break;                                                   \
-            case H_PROCEDURE:                                            \
-                op(formals);                                             \
-                op(p_env);                                               \
-                op(body);                                                \
-                op(code);                                                \
-                break;                                                   \
-            case H_MACRO:                                                \
-                for (long i = 0; i < p->macro_transformers_count; i++)   \
-                    op(transformers[i]);                                 \
-                break;                                                   \
-            case H_TRANSFORMER:                                          \
-                op(t_env);                                               \
-                op(pattern);                                             \
-                op(template);                                            \
-                break;                                                   \
-            case H_STRUCT:                                               \
-                for (long i = 0; i < p->struct_size; i++) op(field[i]);  \
-                break;                                                   \
-            default:                                                     \
-                FATAL("object walker: unknown object type");             \
-        }                                                                \
-    } while (0)
+// signed numbers for the toom-3 interpolation
+typedef struct {
+    limb_t *d;
+    long n;
+    int neg;
+} slimbs_t;
 
-void gc_mark(obj *p) {
-    if (p->mark) return;
-    p->mark = 1;
-#define MARK_OBJECT(member)                                      \
-    do {                                                         \
-        if (p->member.type == T_PTR) gc_mark(p->member.pointer); \
-    } while (0)
-    MAKE_WALKER(MARK_OBJECT, p);
-#undef MARK_OBJECT
+// r = x + y, or x - y if sub; r may alias x or y and has room for one more
+// limb than the longer operand
+static void slimbs_add(slimbs_t *r, const slimbs_t *x, const slimbs_t *y,
+                       int sub) {
+    int yneg = y->neg ^ sub;
+    const slimbs_t *p = x, *q = y;
+    int pneg = x->neg, qneg = yneg;
+    if (x->n < y->n || (x->n == y->n && limbs_cmp(x->d, y->d, x->n) < 0)) {
+        p = y;
+        q = x;
+        pneg = yneg;
+        qneg = x->neg;
+    }
+    long n = p->n;
+    if (pneg == qneg) {
+        r->d[n] = limbs_add(r->d, p->d, n, q->d, q->n);
+        r->n = limbs_normalize(r->d, n + 1);
+    } else {
+        limbs_sub(r->d, p->d, n, q->d, q->n);
+        r->n = limbs_normalize(r->d, n);
+    }
+    r->neg = r->n ? pneg : 0;
 }
 
-void gc_major(gc_t *gc) {
-#define CLEAR_MARK(st, s, stmt)              \
-    do {                                     \
-        for (uint8_t *p = st; p < st + s;) { \
-            obj *o = (obj *)p;               \
-            stmt;                            \
-            p += o->size;                    \
-        }                                    \
-    } while (0)
-    CLEAR_MARK(gc->young_from, gc->young_size, o->mark = 0);
-    CLEAR_MARK(gc->old, gc->old_size, o->mark = 0);
-#undef CLEAR_MARK
+static void slimbs_rshift1(slimbs_t *x) {
+    if (!x->n) return;
+    limbs_rshift(x->d, x->d, x->n, 1);
+    x->n = limbs_normalize(x->d, x->n);
+}
+
+static limb_t limbs_divrem_1(limb_t *q, const limb_t *a, long n, limb_t d);
 
-    for (long i = 0; i < gc->sp; i++) {
-        if (gc->stack[i]->type == T_PTR) {
-            gc_mark(gc->stack[i]->pointer);
+// r = a0 + a1 x + a2 x^2 evaluated at 0, 1, -1, -2 and infinity
+static void toom3_evaluate(slimbs_t *r, const limb_t *a, long k, long n) {
+    slimbs_t a0 = {(limb_t *)a, limbs_normalize(a, k), 0};
+    slimbs_t a1 = {(limb_t *)a + k, limbs_normalize(a + k, k), 0};
+    slimbs_t a2 = {(limb_t *)a + 2 * k, limbs_normalize(a + 2 * k, n - 2 * k),
+                   0};
+    r[0] = a0;
+    r[4] = a2;
+    // t = a0 + a2 in r[1]; r[2] = t - a1; r[1] = t + a1
+    slimbs_add(&r[1], &a0, &a2, 0);
+    slimbs_add(&r[2], &r[1], &a1, 1);
+    slimbs_add(&r[1], &r[1], &a1, 0);
+    // r[3] = 2 (r[2] + a2) - a0
+    slimbs_add(&r[3], &r[2], &a2, 0);
+    slimbs_add(&r[3], &r[3], &r[3], 0);
+    slimbs_add(&r[3], &r[3], &a0, 1);
+}
+
+// r (2n limbs) = a * b (n limbs each)
+static void limbs_toom3(limb_t *r, const limb_t *a, const limb_t *b, long n) {
+    long k = (n + 2) / 3, cap = k + 2;
+    limb_t *buf = calloc(6 * cap + 5 * (2 * cap + 1), sizeof(limb_t));
+    slimbs_t pa[5], pb[5], w[5];
+    for (int i = 1; i < 4; i++) {
+        pa[i].d = buf + (i - 1) * cap;
+        pb[i].d = buf + (i + 2) * cap;
+    }
+    toom3_evaluate(pa, a, k, n);
+    toom3_evaluate(pb, b, k, n);
+    limb_t *wbuf = buf + 6 * cap;
+    for (int i = 0; i < 5; i++) {
+        w[i].d = wbuf + i * (2 * cap + 1);
+        w[i].neg = pa[i].neg ^ pb[i].neg;
+        if (!pa[i].n || !pb[i].n) {
+            w[i].n = 0;
+            w[i].neg = 0;
+            continue;
         }
+        if (pa[i].n >= pb[i].n)
+            limbs_mul(w[i].d, pa[i].d, pa[i].n, pb[i].d, pb[i].n);
+        else
+            limbs_mul(w[i].d, pb[i].d, pb[i].n, pa[i].d, pa[i].n);
+        w[i].n = limbs_normalize(w[i].d, pa[i].n + pb[i].n);
+    }
+    // interpolation (bodrato): w[0..4] hold the values at 0, 1, -1, -2, inf
+    // and become the coefficients r0, r1, r2, r3, r4
+    slimbs_add(&w[3], &w[3], &w[1], 1);
+    if (w[3].n) {
+        limbs_divrem_1(w[3].d, w[3].d, w[3].n, 3);
+        w[3].n = limbs_normalize(w[3].d, w[3].n);
     }
+    slimbs_add(&w[1], &w[1], &w[2], 1);
+    slimbs_rshift1(&w[1]);
+    slimbs_add(&w[2], &w[2], &w[0], 1);
+    slimbs_add(&w[3], &w[2], &w[3], 1);
+    slimbs_rshift1(&w[3]);
+    slimbs_add(&w[3], &w[3], &w[4], 0);
+    slimbs_add(&w[3], &w[3], &w[4], 0);
+    slimbs_add(&w[2], &w[2], &w[1], 0);
+    slimbs_add(&w[2], &w[2], &w[4], 1);
+    slimbs_add(&w[1], &w[1], &w[3], 1);
+    // recompose; every coefficient is non-negative
+    memset(r, 0, 2 * n * sizeof(limb_t));
+    for (int i = 0; i < 5; i++) {
+        long at = i * k, len = 2 * n - at;
+        if (w[i].n) limbs_add(r + at, r + at, len, w[i].d, w[i].n);
+    }
+    free(buf);
+}
 
-    // TODO: compact
-    uint8_t *live, *free;
-    // stage 1: compute forwarding pointers
-    for (live = gc->young_from, free = gc->young_from;
-         live < gc->young_from + gc->young_size;) {
-        obj *o = (obj *)live;
-        if (o->mark) {
-            o->forward = (obj *)free;
-            free += o->size;
-        }
-        live += o->size;
+// r (an + bn limbs) = a * b, an >= bn > 0
+static void limbs_mul(limb_t *r, const limb_t *a, long an, const limb_t *b,
+                      long bn) {
+    if (bn < LIMBS_KARATSUBA) {
+        limbs_mul_basecase(r, a, an, b, bn);
+        return;
     }
-    for (live = gc->old, free = gc->old; live < gc->old + gc->old_size;) {
-        obj *o = (obj *)live;
-        if (o->mark) {
-            o->forward = (obj *)free;
-            free += o->size;
+    if (an == bn) {
+        if (bn >= LIMBS_TOOM3) {
+            limbs_toom3(r, a, b, bn);
+        } else {
+            limb_t *s = malloc((4 * bn + 64) * sizeof(limb_t));
+            limbs_karatsuba(r, a, b, bn, s);
+            free(s);
         }
-        live += o->size;
+        return;
+    }
+    // unbalanced: multiply b by bn-limb pieces of a
+    limb_t *t = malloc(2 * bn * sizeof(limb_t));
+    memset(r, 0, (an + bn) * sizeof(limb_t));
+    for (long i = 0; i < an; i += bn) {
+        long n = an - i < bn ? an - i : bn;
+        if (n == bn)
+            limbs_mul(t, a + i, bn, b, bn);
+        else
+            limbs_mul(t, b, bn, a + i, n);
+        limbs_add(r + i, r + i, an + bn - i, t, n + bn);
     }
+    free(t);
+}
 
-#define UPDATE_MEMBER(member)                               \
-    do {                                                    \
-        if (o->member.type == T_PTR)                        \
-            o->member.pointer = o->member.pointer->forward; \
-    } while (0)
+// division of two limbs by a normalized one (top bit set), with a
+// precomputed reciprocal v = floor((B^2 - 1) / d) - B (moller-granlund)
+static limb_t limbs_reciprocal(limb_t d) {
+    return (limb_t)(~(dlimb_t)0 / d);
+}
 
-    for (live = gc->young_from; live < gc->young_from + gc->young_size;) {
-        obj *o = (obj *)live;
-        if (o->mark) {
-            MAKE_WALKER(UPDATE_MEMBER, o);
-        }
-        live += o->size;
+static inline limb_t limbs_div_2by1(limb_t *r, limb_t u1, limb_t u0, limb_t d,
+                                    limb_t v) {
+    dlimb_t q = (dlimb_t)v * u1 + ((dlimb_t)u1 << 64 | u0);
+    limb_t q1 = (limb_t)(q >> 64) + 1, q0 = q;
+    limb_t rem = u0 - q1 * d;
+    if (rem > q0) {
+        q1--;
+        rem += d;
     }
-    for (live = gc->old; live < gc->old + gc->old_size;) {
-        obj *o = (obj *)live;
-        if (o->mark) {
-            MAKE_WALKER(UPDATE_MEMBER, o);
-        }
-        live += o->size;
+    if (rem >= d) {
+        q1++;
+        rem -= d;
     }
-    for (long i = 0; i < gc->sp; i++) {
-        if (gc->stack[i]->type == T_PTR)
-            gc->stack[i]->pointer = gc->stack[i]->pointer->forward;
+    *r = rem;
+    return q1;
+}
+
+// q = a / d, returning the remainder; d > 0
+static limb_t limbs_divrem_1(limb_t *q, const limb_t *a, long n, limb_t d) {
+    int s = __builtin_clzll(d);
+    d <<= s;
+    limb_t v = limbs_reciprocal(d);
+    // divide a << s by d << s
+    limb_t r = s ? a[n - 1] >> (64 - s) : 0;
+    for (long i = n - 1; i >= 0; i--) {
+        limb_t u = a[i] << s;
+        if (s && i) u |= a[i - 1] >> (64 - s);
+        q[i] = limbs_div_2by1(&r, r, u, d, v);
     }
-#undef UPDATE_MEMBER
-    for (live = gc->young_from; live < gc->young_from + gc->young_size;) {
-        obj *o = (obj *)live;
-        size_t size = o->size;
-        if (o->mark) {
-            memcpy(o->forward, o, size);  // TODO: bug?
+    return r >> s;
+}
+
+// schoolbook division (knuth's algorithm d) of a (an limbs) by a normalized b
+// (bn >= 2 limbs): q gets an - bn limbs and a the remainder in its low bn
+// limbs. returns the top quotient limb, 0 or 1.
+static limb_t limbs_div_basecase(limb_t *q, limb_t *a, long an,
+                                 const limb_t *b, long bn) {
+    limb_t top = limbs_cmp(a + an - bn, b, bn) >= 0;
+    if (top) limbs_sub_n(a + an - bn, a + an - bn, b, bn);
+    limb_t d1 = b[bn - 1], d0 = b[bn - 2], v = limbs_reciprocal(d1);
+    for (long j = an - bn - 1; j >= 0; j--) {
+        limb_t u2 = a[j + bn], u1 = a[j + bn - 1], u0 = a[j + bn - 2];
+        limb_t qhat, rhat;
+        int rhat_big = 0;
+        if (u2 >= d1) {
+            // u2 == d1, as the partial remainder is less than b
+            qhat = ~(limb_t)0;
+            rhat = u1 + d1;
+            rhat_big = rhat < u1;
+        } else {
+            qhat = limbs_div_2by1(&rhat, u2, u1, d1, v);
         }
-        live += size;
+        // at most two corrections with the second divisor limb
+        while (!rhat_big &&
+               (dlimb_t)qhat * d0 > ((dlimb_t)rhat << 64 | u0)) {
+            qhat--;
+            rhat += d1;
+            rhat_big = rhat < d1;
+        }
+        limb_t borrow = limbs_submul_1(a + j, b, bn, qhat);
+        if (u2 < borrow) {
+            qhat--;
+            limbs_add_n(a + j, a + j, b, bn);
+        }
+        a[j + bn] = 0;
+        q[j] = qhat;
+    }
+    return top;
+}
+
+// divide-and-conquer division (burnikel-ziegler) above LIMBS_DIV_DC limbs
+#define LIMBS_DIV_DC 60
+
+static void limbs_div_3h2h(limb_t *q, limb_t *a, const limb_t *b, long h,
+                           limb_t *s);
+
+// q (n limbs) = a (2n limbs) / b (n limbs, normalized), leaving the remainder
+// in the low n limbs of a; requires the high n limbs of a to be less than b.
+// s is scratch of n limbs.
+static void limbs_div_2n1n(limb_t *q, limb_t *a, const limb_t *b, long n,
+                           limb_t *s) {
+    if (n % 2 || n < LIMBS_DIV_DC) {
+        limbs_div_basecase(q, a, 2 * n, b, n);
+        return;
+    }
+    long h = n / 2;
+    limbs_div_3h2h(q + h, a + h, b, h, s);
+    limbs_div_3h2h(q, a, b, h, s);
+}
+
+// q (h limbs) = a (3h limbs) / b (2h limbs), remainder in the low 2h limbs of
+// a; requires the high 2h limbs of a to be less than b
+static void limbs_div_3h2h(limb_t *q, limb_t *a, const limb_t *b, long h,
+                           limb_t *s) {
+    const limb_t *b1 = b + h, *b0 = b;
+    limb_t *a1 = a + 2 * h;
+    if (limbs_cmp(a1, b1, h) < 0) {
+        limbs_div_2n1n(q, a + h, b1, h, s);
+    } else {
+        // a1 == b1: the quotient is B^h - 1 and the remainder a2 + b1
+        for (long i = 0; i < h; i++) q[i] = ~(limb_t)0;
+        memset(a1, 0, h * sizeof(limb_t));
+        a1[0] = limbs_add(a + h, a + h, h, b1, h);
+    }
+    // subtract q b0 from the 3h-limb partial remainder, adding b back while
+    // it is negative
+    limbs_mul(s, q, h, b0, h);
+    limb_t neg = limbs_sub(a, a, 3 * h, s, 2 * h);
+    while (neg) {
+        limbs_sub(q, q, h, (limb_t[]){1}, 1);
+        neg -= limbs_add(a, a, 3 * h, b, 2 * h);
     }
-    for (live = gc->old; live < gc->old + gc->old_size;) {
-        obj *o = (obj *)live;
-        size_t size = o->size;
-        if (o->mark) {
-            memcpy(o->forward, o, size);  // TODO: bug?
+}
+
+// q (an - bn + 1 limbs) = a / b, r (bn limbs) = a % b; an >= bn > 0 and the
+// top limb of b is non-zero
+static void limbs_divrem(limb_t *q, limb_t *r, const limb_t *a, long an,
+                         const limb_t *b, long bn) {
+    if (bn == 1) {
+        r[0] = limbs_divrem_1(q, a, an, b[0]);
+        return;
+    }
+    // normalize b. for the divide-and-conquer division, also pad b with low
+    // zero limbs up to n = j 2^k with j < LIMBS_DIV_DC, so that halving
+    // stays even down to the basecase
+    int shift = __builtin_clzll(b[bn - 1]);
+    long n = bn;
+    if (bn >= LIMBS_DIV_DC) {
+        long j = bn, k = 0;
+        while (j >= LIMBS_DIV_DC) {
+            j = (j + 1) / 2;
+            k++;
         }
-        live += size;
+        n = j << k;
+    }
+    long pad = n - bn;
+    // the padded dividend, with a zero limb on top and rounded up to whole
+    // n-limb blocks when dividing by blocks
+    long un = an + pad + 1;
+    long blocks = (un + n - 1) / n;
+    if (n != bn) un = blocks * n;
+    limb_t *bs = calloc(n, sizeof(limb_t));
+    limb_t *u = calloc(un + 1, sizeof(limb_t));
+    limbs_lshift(bs + pad, b, bn, shift);
+    u[an + pad] = limbs_lshift(u + pad, a, an, shift);
+    limb_t *qs = calloc(un, sizeof(limb_t));
+    if (n == bn) {
+        limbs_div_basecase(qs, u, an + 1, bs, n);
+    } else {
+        // the top block is less than b, as its top limb is zero
+        limb_t *s = malloc(n * sizeof(limb_t));
+        for (long i = blocks - 2; i >= 0; i--)
+            limbs_div_2n1n(qs + i * n, u + i * n, bs, n, s);
+        free(s);
     }
+    memcpy(q, qs, (an - bn + 1) * sizeof(limb_t));
+    limbs_rshift(r, u + pad, bn, shift);
+    free(bs);
+    free(u);
+    free(qs);
 }
 
-ptr gc_alloc(gc_t *gc, enum heapvar_type_t type, long size) {
-    size = ((size - 1) / GC_ALIGNMENT + 1) * GC_ALIGNMENT;
-    size += offsetof(obj, bigint_size);
-    size = ((size - 1) / GC_ALIGNMENT + 1) * GC_ALIGNMENT;
+// radix conversion goes through chunks of k digits, big = radix^k being the
+// largest such power that fits in a limb, and divides and conquers with the
+// powers big^(2^i) above LIMBS_RADIX_DC limbs
+#define LIMBS_RADIX_DC 30
 
-    // try allocating in the young generation
-    if (gc->young_alloc + size <= gc->young_from + gc->young_size) {
-        gc->young_alloc += size;
-        ptr p = make_pointer((obj *)(gc->young_alloc));
-        fill_header(p.pointer, type, size);
-        return p;
+typedef struct {
+    int radix, k;
+    limb_t big;
+    limb_t *power[64];
+    long power_size[64];
+    int powers;
+} radix_t;
+
+static void radix_init(radix_t *rx, int radix) {
+    rx->radix = radix;
+    rx->k = 0;
+    rx->big = 1;
+    while (rx->big <= UINT64_MAX / radix) {
+        rx->big *= radix;
+        rx->k++;
     }
+    rx->power[0] = malloc(sizeof(limb_t));
+    rx->power[0][0] = rx->big;
+    rx->power_size[0] = 1;
+    rx->powers = 1;
+}
 
-    // trigger a minor collection
-    int flag = gc_minor(gc);
+// makes power[i] available
+static void radix_power(radix_t *rx, int i) {
+    for (; rx->powers <= i; rx->powers++) {
+        long n = rx->power_size[rx->powers - 1];
+        limb_t *p = rx->power[rx->powers - 1];
+        limb_t *r = malloc(2 * n * sizeof(limb_t));
+        limbs_mul(r, p, n, p, n);
+        rx->power[rx->powers] = r;
+        rx->power_size[rx->powers] = limbs_normalize(r, 2 * n);
+    }
+}
+
+static void radix_free(radix_t *rx) {
+    for (int i = 0; i < rx->powers; i++) free(rx->power[i]);
+}
 
-    // if needed, trigger a major collection
-    if (flag) gc_major(gc);
+static const char radix_digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
 
-    while (gc->young_alloc + size <= gc->young_from + gc->young_size) {
-        gc_grow(gc);
+// writes the len low digits of a (n limbs, destroyed) to s, zero-padded
+static void limbs_to_radix(char *s, long len, limb_t *a, long n, radix_t *rx) {
+    n = limbs_normalize(a, n);
+    if (n >= LIMBS_RADIX_DC) {
+        // split a = q big^(2^i) + r with the power about half the size of a
+        int i = 0;
+        while (rx->power_size[i] * 2 < n) radix_power(rx, ++i);
+        limb_t *p = rx->power[i];
+        long pn = rx->power_size[i], low = (long)rx->k << i;
+        if (n >= pn && low < len) {
+            limb_t *q = malloc((n - pn + 1) * sizeof(limb_t));
+            limb_t *r = malloc(pn * sizeof(limb_t));
+            limbs_divrem(q, r, a, n, p, pn);
+            limbs_to_radix(s + len - low, low, r, pn, rx);
+            limbs_to_radix(s, len - low, q, n - pn + 1, rx);
+            free(q);
+            free(r);
+            return;
+        }
+    }
+    char *d = s + len;
+    while (d > s) {
+        limb_t c = n ? limbs_divrem_1(a, a, n, rx->big) : 0;
+        n = limbs_normalize(a, n);
+        for (int j = 0; j < rx->k && d > s; j++) {
+            *--d = radix_digits[c % rx->radix];
+            c /= rx->radix;
+        }
+    }
+}
+
+// parses len digit values into a (len / k + 1 limbs), returning the size
+static long limbs_from_radix(limb_t *a, const uint8_t *s, long len,
+                             radix_t *rx) {
+    if (len > (long)rx->k * LIMBS_RADIX_DC) {
+        int i = 0;
+        while (((long)rx->k << (i + 1)) < len) radix_power(rx, ++i);
+        radix_power(rx, i);
+        long low = (long)rx->k << i, hn = (len - low) / rx->k + 1;
+        limb_t *hi = malloc(hn * sizeof(limb_t));
+        hn = limbs_from_radix(hi, s, len - low, rx);
+        long n = limbs_from_radix(a, s + len - low, low, rx);
+        long pn = rx->power_size[i], tn = hn + pn;
+        memset(a + n, 0, (len / rx->k + 1 - n) * sizeof(limb_t));
+        if (hn) {
+            limb_t *t = malloc(tn * sizeof(limb_t));
+            if (hn >= pn)
+                limbs_mul(t, hi, hn, rx->power[i], pn);
+            else
+                limbs_mul(t, rx->power[i], pn, hi, hn);
+            limbs_add(a, t, tn, a, n);
+            free(t);
+            n = tn;
+        }
+        free(hi);
+        return limbs_normalize(a, n);
+    }
+    long n = 0;
+    for (long i = 0; i < len;) {
+        long m = i ? rx->k : (len - 1) % rx->k + 1;
+        limb_t c = 0, scale = 1;
+        for (long j = 0; j < m; j++, i++) {
+            c = c * rx->radix + s[i];
+            scale *= rx->radix;
+        }
+        limb_t carry = limbs_mul_1(a, a, n, scale);
+        if (carry) a[n++] = carry;
+        if (!n)
+            a[n++] = c;
+        else if (limbs_add(a, a, n, &c, 1))
+            a[n++] = 1;
     }
-    ptr p = make_pointer((obj *)(gc->young_alloc));
-    gc->young_alloc += size;
-    fill_header(p.pointer, type, size);
+    return limbs_normalize(a, n);
+}
+
+// allocates a bigint with room for n limbs
+static ptr bigint_alloc(gc_t *gc, long n) {
+    long size = offsetof(obj, digits) - OBJ_HEADER_SIZE + n * sizeof(limb_t);
+    ptr p = gc_alloc(gc, H_BIGINT, size);
+    obj *o = ptr_pointer(p);
+    o->bigint_size = n;
+    o->sign = 1;
     return p;
 }
 
-// grows the heap by GC_GROW_RATIO, preserving pointers on the stack and GC
-// variables
-// caution: can be called only when to-semispace is not active, i.e. not during
-// copying
-void gc_grow(gc_t *gc) {
-    if (gc->young_to) FATAL("Gc-grow when the to subspace is active");
-    ptr_move_transform_t t_y_f = make_transform(
-        gc->young_from, malloc(gc->young_size * GC_GROW_RATIO), gc->young_size);
-    ptr_move_transform_t t_o = make_transform(
-        gc->old, malloc(gc->old_size * GC_GROW_RATIO), gc->old_size);
-    memcpy(t_y_f.to, t_y_f.from, t_y_f.size);
-    memcpy(t_o.to, t_o.from, t_o.size);
-#define COMPOSED_OBJ(p) apply_transform_obj(t_o, apply_transform_obj(t_y_f, p))
-#define COMPOSED(p) apply_transform(t_o, apply_transform(t_y_f, p))
-#define TRANSFORM_OBJ(o) o = COMPOSED_OBJ(o)
-#define TRANSFORM(o) o = COMPOSED(o)
-    TRANSFORM(gc->young_from);
-    TRANSFORM(gc->young_to);
-    TRANSFORM(gc->young_alloc);
-    TRANSFORM(gc->young_scan);
-    TRANSFORM(gc->old);
-    TRANSFORM(gc->old_alloc);
-    for (long i = 0; i < gc->sp; i++) {
-        if (gc->stack[i]->type == T_PTR) {
-            TRANSFORM_OBJ(gc->stack[i]->pointer);
-        }
-    }
-
-#define TRANSFORM_MEMBER(member)                                       \
-    do {                                                               \
-        if (o->member.type == T_PTR) TRANSFORM_OBJ(o->member.pointer); \
-    } while (0)
-#define TRANSFORM_HEAP(start, s)                   \
-    do {                                           \
-        for (uint8_t *p = start; p < start + s;) { \
-            obj *o = (obj *)p;                     \
-            MAKE_WALKER(TRANSFORM_MEMBER, o);      \
-            p += o->size;                          \
-        }                                          \
-    } while (0)
-    TRANSFORM_HEAP(gc->young_from, gc->young_size);
-    TRANSFORM_HEAP(gc->old, gc->old_size);
-#undef COMPOSED_OBJ
-#undef TRANSFORM_OBJ
-#undef COMPOSED
-#undef TRANSFORM
+static ptr bigint_make(gc_t *gc, const limb_t *d, long n, int neg) {
+    n = limbs_normalize(d, n);
+    ptr p = bigint_alloc(gc, n);
+    obj *o = ptr_pointer(p);
+    if (n) memcpy(o->digits, d, n * sizeof(limb_t));
+    o->sign = neg && n ? -1 : 1;
+    return p;
 }
 
-void gc_preserve(gc_t *gc, ptr *p) {
-    if (gc->sp >= gc->stack_size) {
-        gc->stack_size *= 2;
-        gc->stack = realloc(gc->stack, gc->stack_size * sizeof(ptr *));
+ptr make_bigint(gc_t *gc, int64_t x) {
+    limb_t d = x < 0 ? -(limb_t)x : (limb_t)x;
+    return bigint_make(gc, &d, 1, x < 0);
+}
+
+// a + b, or a - b if sub
+static ptr bigint_add_signed(gc_t *gc, ptr a, ptr b, int sub) {
+    GC_LOCALS(l, 2);
+    l[0] = a;
+    l[1] = b;
+    long an = ptr_pointer(a)->bigint_size, bn = ptr_pointer(b)->bigint_size;
+    ptr r = bigint_alloc(gc, (an > bn ? an : bn) + 1);
+    obj *x = ptr_pointer(l[0]), *y = ptr_pointer(l[1]), *z = ptr_pointer(r);
+    int xneg = x->sign < 0, yneg = (y->sign < 0) ^ sub;
+    if (an < bn || (an == bn && limbs_cmp(x->digits, y->digits, an) < 0)) {
+        obj *t = x;
+        x = y;
+        y = t;
+        long tn = an;
+        an = bn;
+        bn = tn;
+        int tneg = xneg;
+        xneg = yneg;
+        yneg = tneg;
     }
-    gc->stack[gc->sp++] = p;
+    if (xneg == yneg) {
+        z->digits[an] = limbs_add(z->digits, x->digits, an, y->digits, bn);
+        z->bigint_size = limbs_normalize(z->digits, an + 1);
+    } else {
+        limbs_sub(z->digits, x->digits, an, y->digits, bn);
+        z->bigint_size = limbs_normalize(z->digits, an);
+    }
+    z->sign = xneg && z->bigint_size ? -1 : 1;
+    GC_UNLOCALS(l);
+    return r;
 }
 
-void gc_release(gc_t *gc, long count) { gc->sp -= count; }
+ptr bigint_add(gc_t *gc, ptr a, ptr b) {
+    return bigint_add_signed(gc, a, b, 0);
+}
 
-#define CHECK_MEMBER(member)                          \
-    do {                                              \
-        if (young_pointer_p(gc, p->member)) return 1; \
-    } while (0)
+ptr bigint_sub(gc_t *gc, ptr a, ptr b) {
+    return bigint_add_signed(gc, a, b, 1);
+}
 
-#define COPY_MEMBER(member)                 \
-    do {                                    \
-        p->member = gc_copy(gc, p->member); \
-    } while (0)
+ptr bigint_mul(gc_t *gc, ptr a, ptr b) {
+    long an = ptr_pointer(a)->bigint_size, bn = ptr_pointer(b)->bigint_size;
+    if (!an || !bn) return bigint_make(gc, NULL, 0, 0);
+    GC_LOCALS(l, 2);
+    l[0] = a;
+    l[1] = b;
+    ptr r = bigint_alloc(gc, an + bn);
+    obj *x = ptr_pointer(l[0]), *y = ptr_pointer(l[1]), *z = ptr_pointer(r);
+    if (an >= bn)
+        limbs_mul(z->digits, x->digits, an, y->digits, bn);
+    else
+        limbs_mul(z->digits, y->digits, bn, x->digits, an);
+    z->bigint_size = limbs_normalize(z->digits, an + bn);
+    z->sign = x->sign * y->sign;
+    GC_UNLOCALS(l);
+    return r;
+}
 
-#define RESOLVE_MEMBER(member)                   \
-    do {                                         \
-        ptr o = p->member;                       \
-        if (o.type == T_PTR && o.pointer->moved) \
-            o.pointer = o.pointer->forward;      \
-    } while (0)
+ptr bigint_div(gc_t *gc, ptr a, ptr b, ptr *rem) {
+    obj *x = ptr_pointer(a), *y = ptr_pointer(b);
+    long an = x->bigint_size, bn = y->bigint_size;
+    if (!bn) FATAL("bigint: division by zero");
+    int qneg = x->sign != y->sign, rneg = x->sign < 0;
+    if (an < bn) {
+        GC_LOCALS(l, 1);
+        l[0] = a;
+        ptr q = bigint_make(gc, NULL, 0, 0);
+        if (rem) *rem = l[0];
+        GC_UNLOCALS(l);
+        return q;
+    }
+    limb_t *q = malloc((an - bn + 1) * sizeof(limb_t));
+    limb_t *r = malloc(bn * sizeof(limb_t));
+    limbs_divrem(q, r, x->digits, an, y->digits, bn);
+    GC_LOCALS(l, 1);
+    l[0] = bigint_make(gc, q, an - bn + 1, qneg);
+    if (rem) *rem = bigint_make(gc, r, bn, rneg);
+    GC_UNLOCALS(l);
+    free(q);
+    free(r);
+    return l[0];
+}
 
-int check_young_refs(gc_t *gc, obj *p) { MAKE_WALKER(CHECK_MEMBER, p); }
-void copy_refs(gc_t *gc, obj *p) { MAKE_WALKER(COPY_MEMBER, p); }
-void resolve_pointers(gc_t *gc, obj *p) { MAKE_WALKER(RESOLVE_MEMBER, p); }
+ptr bigint_negate(gc_t *gc, ptr a) {
+    GC_LOCALS(l, 1);
+    l[0] = a;
+    long n = ptr_pointer(a)->bigint_size;
+    ptr r = bigint_alloc(gc, n);
+    obj *x = ptr_pointer(l[0]), *z = ptr_pointer(r);
+    memcpy(z->digits, x->digits, n * sizeof(limb_t));
+    z->sign = n ? -x->sign : 1;
+    GC_UNLOCALS(l);
+    return r;
+}
 
-int young_pointer_p(gc_t *gc, ptr p) {
-    if (p.type != T_PTR) return 0;
-    ptrdiff_t offset = (uint8_t *)p.pointer - gc->young_from;
-    if (offset < 0 || offset >= gc->young_size) return 0;
-    return 1;
+int bigint_compare(ptr a, ptr b) {
+    obj *x = ptr_pointer(a), *y = ptr_pointer(b);
+    if (x->sign != y->sign) return x->sign < y->sign ? -1 : 1;
+    long an = x->bigint_size, bn = y->bigint_size;
+    int c = an != bn ? (an < bn ? -1 : 1) : limbs_cmp(x->digits, y->digits, an);
+    return x->sign < 0 ? -c : c;
+}
+
+char *bigint_to_string(ptr a, int radix) {
+    obj *x = ptr_pointer(a);
+    long n = x->bigint_size;
+    radix_t rx;
+    radix_init(&rx, radix);
+    // a limb holds at most k + 1 digits
+    long len = n * (rx.k + 1) + 1;
+    char *s = malloc(len + 2);
+    limb_t *d = malloc((n + 1) * sizeof(limb_t));
+    memcpy(d, x->digits, n * sizeof(limb_t));
+    limbs_to_radix(s + 1, len, d, n, &rx);
+    long z = 1;
+    while (z < len && s[z] == '0') z++;
+    if (x->sign < 0) s[--z] = '-';
+    memmove(s, s + z, len + 1 - z);
+    s[len + 1 - z] = 0;
+    free(d);
+    radix_free(&rx);
+    return s;
+}
+
+ptr bigint_from_string(gc_t *gc, const char *s, long n, int radix) {
+    int neg = n > 0 && s[0] == '-';
+    if (n > 0 && (s[0] == '-' || s[0] == '+')) {
+        s++;
+        n--;
+    }
+    if (n <= 0) return make_bool(0);
+    uint8_t *v = malloc(n);
+    for (long i = 0; i < n; i++) {
+        int c = s[i] >= '0' && s[i] <= '9'   ? s[i] - '0'
+                : s[i] >= 'a' && s[i] <= 'z' ? s[i] - 'a' + 10
+                : s[i] >= 'A' && s[i] <= 'Z' ? s[i] - 'A' + 10
+                                             : radix;
+        if (c >= radix) {
+            free(v);
+            return make_bool(0);
+        }
+        v[i] = c;
+    }
+    radix_t rx;
+    radix_init(&rx, radix);
+    limb_t *d = calloc(n / rx.k + 1, sizeof(limb_t));
+    long dn = limbs_from_radix(d, v, n, &rx);
+    ptr p = bigint_make(gc, d, dn, neg);
+    free(d);
+    free(v);
+    radix_free(&rx);
+    return p;
+}
+
+enum num_level_t {
+    NUM_FIXNUM,
+    NUM_BIGINT,
+    NUM_RATIONAL,
+    NUM_FLONUM,
+    NUM_COMPLEX,
+};
+
+enum num_op_t {
+    NUM_ADD,
+    NUM_SUB,
+    NUM_MUL,
+    NUM_DIV,
+};
+
+static int num_level(ptr a) {
+    if (fixnum_p(a)) return NUM_FIXNUM;
+    if (pointer_p(a)) switch (obj_type(ptr_pointer(a))) {
+            case H_BIGINT:
+                return NUM_BIGINT;
+            case H_RATIONAL:
+                return NUM_RATIONAL;
+            case H_FLONUM:
+                return NUM_FLONUM;
+            case H_COMPLEX:
+                return NUM_COMPLEX;
+            default:
+                break;
+        }
+    return -1;
+}
+
+static int num_check_level(ptr a) {
+    int level = num_level(a);
+    if (level < 0) FATAL("arithmetic: not a number");
+    return level;
+}
+
+int number_p(ptr a) { return num_level(a) >= 0; }
+
+int integer_p(ptr a) {
+    int level = num_level(a);
+    return level == NUM_FIXNUM || level == NUM_BIGINT;
+}
+
+static ptr make_int(gc_t *gc, int64_t x) {
+    if (x >= FIXNUM_MIN && x <= FIXNUM_MAX) return make_fixnum(x);
+    return make_bigint(gc, x);
+}
+
+// demotes a bigint in fixnum range
+static ptr int_normalize(ptr a) {
+    if (fixnum_p(a)) return a;
+    obj *o = ptr_pointer(a);
+    if (o->bigint_size > 1) return a;
+    if (!o->bigint_size) return make_fixnum(0);
+    uint64_t d = o->digits[0];
+    if (o->sign > 0 && d <= FIXNUM_MAX) return make_fixnum(d);
+    if (o->sign < 0 && d <= (uint64_t)FIXNUM_MAX + 1)
+        return make_fixnum(-(int64_t)d);
+    return a;
+}
+
+static int int_sign(ptr a) {
+    if (fixnum_p(a)) return (ptr_fixnum(a) > 0) - (ptr_fixnum(a) < 0);
+    return ptr_pointer(a)->sign;
+}
+
+// bigints are never in fixnum range, so their sign orders them against
+// fixnums
+static int int_compare(ptr a, ptr b) {
+    if (fixnums_p(a, b)) return num_compare(a, b);
+    if (fixnum_p(a)) return -ptr_pointer(b)->sign;
+    if (fixnum_p(b)) return ptr_pointer(a)->sign;
+    return bigint_compare(a, b);
+}
+
+// a + b, a - b or a * b
+static ptr int_arith(gc_t *gc, ptr a, ptr b, enum num_op_t op) {
+    if (fixnums_p(a, b)) {
+        int64_t x = ptr_fixnum(a), y = ptr_fixnum(b), r;
+        if (op == NUM_ADD) return make_int(gc, x + y);
+        if (op == NUM_SUB) return make_int(gc, x - y);
+        if (!__builtin_mul_overflow(x, y, &r)) return make_int(gc, r);
+    }
+    GC_LOCALS(l, 2);
+    l[0] = a;
+    l[1] = b;
+    if (fixnum_p(l[0])) l[0] = make_bigint(gc, ptr_fixnum(l[0]));
+    if (fixnum_p(l[1])) l[1] = make_bigint(gc, ptr_fixnum(l[1]));
+    ptr r = op == NUM_ADD   ? bigint_add(gc, l[0], l[1])
+            : op == NUM_SUB ? bigint_sub(gc, l[0], l[1])
+                            : bigint_mul(gc, l[0], l[1]);
+    GC_UNLOCALS(l);
+    return int_normalize(r);
+}
+
+// truncating division; rem, if not NULL, must be a root
+static ptr int_div(gc_t *gc, ptr a, ptr b, ptr *rem) {
+    if (eq_p(b, make_fixnum(0))) FATAL("arithmetic: division by zero");
+    if (fixnums_p(a, b)) {
+        int64_t x = ptr_fixnum(a), y = ptr_fixnum(b);
+        if (rem) *rem = make_fixnum(x % y);
+        return make_int(gc, x / y);
+    }
+    GC_LOCALS(l, 2);
+    l[0] = a;
+    l[1] = b;
+    if (fixnum_p(l[0])) l[0] = make_bigint(gc, ptr_fixnum(l[0]));
+    if (fixnum_p(l[1])) l[1] = make_bigint(gc, ptr_fixnum(l[1]));
+    ptr q = bigint_div(gc, l[0], l[1], rem);
+    if (rem) *rem = int_normalize(*rem);
+    GC_UNLOCALS(l);
+    return int_normalize(q);
+}
+
+static ptr int_gcd(gc_t *gc, ptr a, ptr b) {
+    GC_LOCALS(l, 3);
+    l[0] = a;
+    l[1] = b;
+    while (!eq_p(l[1], make_fixnum(0))) {
+        if (fixnums_p(l[0], l[1])) {
+            int64_t x = ptr_fixnum(l[0]), y = ptr_fixnum(l[1]);
+            while (y) {
+                int64_t t = x % y;
+                x = y;
+                y = t;
+            }
+            l[0] = make_fixnum(x);
+            break;
+        }
+        int_div(gc, l[0], l[1], &l[2]);
+        l[0] = l[1];
+        l[1] = l[2];
+    }
+    ptr r = l[0];
+    GC_UNLOCALS(l);
+    return int_sign(r) < 0 ? int_arith(gc, make_fixnum(0), r, NUM_SUB) : r;
+}
+
+// n / d in lowest terms, an integer if d divides n
+static ptr make_rational(gc_t *gc, ptr n, ptr d) {
+    if (eq_p(d, make_fixnum(0))) FATAL("arithmetic: division by zero");
+    GC_LOCALS(l, 3);
+    l[0] = n;
+    l[1] = d;
+    if (int_sign(l[1]) < 0) {
+        l[0] = int_arith(gc, make_fixnum(0), l[0], NUM_SUB);
+        l[1] = int_arith(gc, make_fixnum(0), l[1], NUM_SUB);
+    }
+    l[2] = int_gcd(gc, l[0], l[1]);
+    if (!eq_p(l[2], make_fixnum(1))) {
+        l[0] = int_div(gc, l[0], l[2], NULL);
+        l[1] = int_div(gc, l[1], l[2], NULL);
+    }
+    ptr r = l[0];
+    if (!eq_p(l[1], make_fixnum(1))) {
+        r = gc_alloc(gc, H_RATIONAL, 2 * sizeof(ptr));
+        ptr_pointer(r)->numerator = l[0];
+        ptr_pointer(r)->denominator = l[1];
+    }
+    GC_UNLOCALS(l);
+    return r;
+}
+
+static ptr num_numerator(ptr a) {
+    return num_level(a) == NUM_RATIONAL ? ptr_pointer(a)->numerator : a;
+}
+
+static ptr num_denominator(ptr a) {
+    return num_level(a) == NUM_RATIONAL ? ptr_pointer(a)->denominator
+                                        : make_fixnum(1);
+}
+
+static ptr rational_arith(gc_t *gc, ptr a, ptr b, enum num_op_t op) {
+    GC_LOCALS(l, 4);
+    l[0] = num_numerator(a);
+    l[1] = num_denominator(a);
+    l[2] = num_numerator(b);
+    l[3] = num_denominator(b);
+    if (op == NUM_DIV) {
+        ptr t = l[2];
+        l[2] = l[3];
+        l[3] = t;
+    }
+    if (op == NUM_ADD || op == NUM_SUB) {
+        // (an * bd +- bn * ad) / (ad * bd)
+        l[0] = int_arith(gc, l[0], l[3], NUM_MUL);
+        l[2] = int_arith(gc, l[2], l[1], NUM_MUL);
+        l[0] = int_arith(gc, l[0], l[2], op);
+    } else {
+        l[0] = int_arith(gc, l[0], l[2], NUM_MUL);
+    }
+    l[1] = int_arith(gc, l[1], l[3], NUM_MUL);
+    ptr r = make_rational(gc, l[0], l[1]);
+    GC_UNLOCALS(l);
+    return r;
+}
+
+// a ~ m * 2^e, from the top two limbs of a bigint
+static double int_frexp(ptr a, int *e) {
+    *e = 0;
+    if (fixnum_p(a)) return ptr_fixnum(a);
+    obj *o = ptr_pointer(a);
+    long n = o->bigint_size;
+    double m = o->digits[n - 1];
+    if (n > 1) {
+        m = m * 0x1p64 + o->digits[n - 2];
+        *e = (n - 2) * 64;
+    }
+    return o->sign * m;
+}
+
+static double num_to_flonum(ptr a) {
+    int e, f;
+    double m;
+    switch (num_level(a)) {
+        case NUM_FIXNUM:
+            return ptr_fixnum(a);
+        case NUM_BIGINT:
+            m = int_frexp(a, &e);
+            return ldexp(m, e);
+        case NUM_RATIONAL:
+            // scaled separately, so that huge parts do not overflow
+            m = int_frexp(ptr_pointer(a)->numerator, &e);
+            m /= int_frexp(ptr_pointer(a)->denominator, &f);
+            return ldexp(m, e - f);
+        default:
+            return ptr_flonum(a);
+    }
+}
+
+static ptr flonum_arith(gc_t *gc, ptr a, ptr b, enum num_op_t op) {
+    double x = num_to_flonum(a), y = num_to_flonum(b);
+    switch (op) {
+        case NUM_ADD:
+            return make_flonum(gc, x + y);
+        case NUM_SUB:
+            return make_flonum(gc, x - y);
+        case NUM_MUL:
+            return make_flonum(gc, x * y);
+        default:
+            return make_flonum(gc, x / y);
+    }
+}
+
+static ptr num_real_part(ptr a) {
+    return num_level(a) == NUM_COMPLEX ? ptr_pointer(a)->real : a;
+}
+
+static ptr num_imag_part(ptr a) {
+    return num_level(a) == NUM_COMPLEX ? ptr_pointer(a)->imaginary
+                                       : make_fixnum(0);
+}
+
+ptr make_rectangular(gc_t *gc, ptr re, ptr im) {
+    if (num_check_level(re) == NUM_COMPLEX ||
+        num_check_level(im) == NUM_COMPLEX)
+        FATAL("make-rectangular: complex part");
+    if (eq_p(im, make_fixnum(0))) return re;
+    GC_LOCALS(l, 2);
+    l[0] = re;
+    l[1] = im;
+    ptr r = gc_alloc(gc, H_COMPLEX, 2 * sizeof(ptr));
+    ptr_pointer(r)->real = l[0];
+    ptr_pointer(r)->imaginary = l[1];
+    GC_UNLOCALS(l);
+    return r;
+}
+
+static ptr num_arith(gc_t *gc, ptr a, ptr b, enum num_op_t op);
+
+// a + bi op c + di, with the parts combined by the real arithmetic
+static ptr complex_arith(gc_t *gc, ptr a, ptr b, enum num_op_t op) {
+    GC_LOCALS(l, 7);
+    l[0] = num_real_part(a);
+    l[1] = num_imag_part(a);
+    l[2] = num_real_part(b);
+    l[3] = num_imag_part(b);
+    switch (op) {
+        case NUM_ADD:
+        case NUM_SUB:
+            l[4] = num_arith(gc, l[0], l[2], op);
+            l[5] = num_arith(gc, l[1], l[3], op);
+            break;
+        case NUM_MUL:
+            // (ac - bd) + (ad + bc)i
+            l[4] = num_arith(gc, l[0], l[2], NUM_MUL);
+            l[5] = num_arith(gc, l[1], l[3], NUM_MUL);
+            l[4] = num_arith(gc, l[4], l[5], NUM_SUB);
+            l[5] = num_arith(gc, l[0], l[3], NUM_MUL);
+            l[6] = num_arith(gc, l[1], l[2], NUM_MUL);
+            l[5] = num_arith(gc, l[5], l[6], NUM_ADD);
+            break;
+        default:
+            // ((ac + bd) + (bc - ad)i) / (c^2 + d^2)
+            l[4] = num_arith(gc, l[2], l[2], NUM_MUL);
+            l[5] = num_arith(gc, l[3], l[3], NUM_MUL);
+            l[6] = num_arith(gc, l[4], l[5], NUM_ADD);
+            l[4] = num_arith(gc, l[0], l[2], NUM_MUL);
+            l[5] = num_arith(gc, l[1], l[3], NUM_MUL);
+            l[4] = num_arith(gc, l[4], l[5], NUM_ADD);
+            l[4] = num_arith(gc, l[4], l[6], NUM_DIV);
+            l[5] = num_arith(gc, l[1], l[2], NUM_MUL);
+            l[0] = num_arith(gc, l[0], l[3], NUM_MUL);
+            l[5] = num_arith(gc, l[5], l[0], NUM_SUB);
+            l[5] = num_arith(gc, l[5], l[6], NUM_DIV);
+            break;
+    }
+    ptr r = make_rectangular(gc, l[4], l[5]);
+    GC_UNLOCALS(l);
+    return r;
+}
+
+// operands are brought to the higher of their two levels
+static ptr num_arith(gc_t *gc, ptr a, ptr b, enum num_op_t op) {
+    int x = num_check_level(a), y = num_check_level(b);
+    int level = x > y ? x : y;
+    if (level == NUM_COMPLEX) return complex_arith(gc, a, b, op);
+    if (level == NUM_FLONUM) return flonum_arith(gc, a, b, op);
+    if (level == NUM_RATIONAL || op == NUM_DIV)
+        return rational_arith(gc, a, b, op);
+    return int_arith(gc, a, b, op);
+}
+
+ptr num_add_slow(gc_t *gc, ptr a, ptr b) {
+    return num_arith(gc, a, b, NUM_ADD);
+}
+
+ptr num_sub_slow(gc_t *gc, ptr a, ptr b) {
+    return num_arith(gc, a, b, NUM_SUB);
+}
+
+ptr num_mul_slow(gc_t *gc, ptr a, ptr b) {
+    return num_arith(gc, a, b, NUM_MUL);
+}
+
+ptr num_div(gc_t *gc, ptr a, ptr b) {
+    if (fixnums_p(a, b) && !eq_p(b, make_fixnum(0)) &&
+        ptr_fixnum(a) % ptr_fixnum(b) == 0)
+        return make_int(gc, ptr_fixnum(a) / ptr_fixnum(b));
+    return num_arith(gc, a, b, NUM_DIV);
+}
+
+ptr num_negate(gc_t *gc, ptr a) {
+    switch (num_check_level(a)) {
+        case NUM_FLONUM:
+            return make_flonum(gc, -ptr_flonum(a));
+        case NUM_COMPLEX: {
+            GC_LOCALS(l, 2);
+            l[0] = a;
+            l[1] = num_negate(gc, ptr_pointer(a)->real);
+            l[0] = num_negate(gc, ptr_pointer(l[0])->imaginary);
+            ptr r = make_rectangular(gc, l[1], l[0]);
+            GC_UNLOCALS(l);
+            return r;
+        }
+        default:
+            return num_arith(gc, make_fixnum(0), a, NUM_SUB);
+    }
+}
+
+ptr num_quotient(gc_t *gc, ptr a, ptr b) {
+    if (!integer_p(a) || !integer_p(b)) FATAL("quotient: not an integer");
+    return int_div(gc, a, b, NULL);
+}
+
+ptr num_remainder(gc_t *gc, ptr a, ptr b) {
+    if (!integer_p(a) || !integer_p(b)) FATAL("remainder: not an integer");
+    GC_LOCALS(l, 1);
+    int_div(gc, a, b, &l[0]);
+    ptr r = l[0];
+    GC_UNLOCALS(l);
+    return r;
+}
+
+// the magnitude of integer a; fixnums are stored in *tmp
+static const limb_t *int_limbs(ptr a, limb_t *tmp, long *n) {
+    if (fixnum_p(a)) {
+        int64_t x = ptr_fixnum(a);
+        *tmp = x < 0 ? -(limb_t)x : (limb_t)x;
+        *n = *tmp != 0;
+        return tmp;
+    }
+    *n = ptr_pointer(a)->bigint_size;
+    return ptr_pointer(a)->digits;
+}
+
+// compares an * bd with bn * ad, denominators being positive. the products
+// are formed outside the heap, so comparisons never allocate.
+static int rational_compare(ptr a, ptr b) {
+    ptr an = num_numerator(a), ad = num_denominator(a);
+    ptr bn = num_numerator(b), bd = num_denominator(b);
+    int s = int_sign(an), t = int_sign(bn);
+    if (s != t) return s < t ? -1 : 1;
+    if (!s) return 0;
+    limb_t tmp[4];
+    long n[4];
+    const limb_t *x[4] = {int_limbs(an, &tmp[0], &n[0]),
+                          int_limbs(bd, &tmp[1], &n[1]),
+                          int_limbs(bn, &tmp[2], &n[2]),
+                          int_limbs(ad, &tmp[3], &n[3])};
+    limb_t *p[2];
+    long pn[2];
+    for (int i = 0; i < 2; i++) {
+        const limb_t *u = x[2 * i], *v = x[2 * i + 1];
+        long un = n[2 * i], vn = n[2 * i + 1];
+        p[i] = malloc((un + vn) * sizeof(limb_t));
+        if (un >= vn)
+            limbs_mul(p[i], u, un, v, vn);
+        else
+            limbs_mul(p[i], v, vn, u, un);
+        pn[i] = limbs_normalize(p[i], un + vn);
+    }
+    int c = pn[0] != pn[1] ? (pn[0] < pn[1] ? -1 : 1)
+                           : limbs_cmp(p[0], p[1], pn[0]);
+    free(p[0]);
+    free(p[1]);
+    return s < 0 ? -c : c;
+}
+
+int num_compare_slow(ptr a, ptr b) {
+    int x = num_check_level(a), y = num_check_level(b);
+    int level = x > y ? x : y;
+    if (level == NUM_COMPLEX)
+        FATAL("arithmetic: complex numbers are unordered");
+    if (level == NUM_FLONUM) {
+        double p = num_to_flonum(a), q = num_to_flonum(b);
+        if (isnan(p) || isnan(q)) return NUM_UNORDERED;
+        return (p > q) - (p < q);
+    }
+    if (level == NUM_RATIONAL) return rational_compare(a, b);
+    return int_compare(a, b);
+}
+
+int num_equal_slow(ptr a, ptr b) {
+    if (num_check_level(a) == NUM_COMPLEX || num_check_level(b) == NUM_COMPLEX)
+        return num_compare(num_real_part(a), num_real_part(b)) == 0 &&
+               num_compare(num_imag_part(a), num_imag_part(b)) == 0;
+    return num_compare_slow(a, b) == 0;
+}
+
+static ptr f64vector_alloc(gc_t *gc, long n) {
+    if (n < 0) FATAL("f64vector: negative length");
+    ptr p = gc_alloc(gc, H_F64VECTOR,
+                     offsetof(obj, f64) - OBJ_HEADER_SIZE + n * sizeof(double));
+    ptr_pointer(p)->f64vector_size = n;
+    return p;
+}
+
+ptr make_f64vector(gc_t *gc, long n, double fill) {
+    ptr p = f64vector_alloc(gc, n);
+    double *d = ptr_pointer(p)->f64;
+    for (long i = 0; i < n; i++) d[i] = fill;
+    return p;
+}
+
+static inline double f64_add(double x, double y) { return x + y; }
+static inline double f64_sub(double x, double y) { return x - y; }
+static inline double f64_mul(double x, double y) { return x * y; }
+static inline double f64_div(double x, double y) { return x / y; }
+// as minpd and maxpd, returning y when either is a nan
+static inline double f64_min(double x, double y) { return x < y ? x : y; }
+static inline double f64_max(double x, double y) { return x > y ? x : y; }
+
+#ifdef __SSE2__
+#define F64_MAP_VECTOR(vop)                                       \
+    for (; i + 2 <= n; i += 2) {                                  \
+        __m128d y = step ? _mm_loadu_pd(b + i) : _mm_set1_pd(*b); \
+        _mm_storeu_pd(r + i, vop(_mm_loadu_pd(a + i), y));        \
+    }
+#define F64_FOLD_VECTOR(vop, sop, unit)        \
+    __m128d s0 = _mm_set1_pd(unit), s1 = s0;   \
+    for (; i + 4 <= n; i += 4) {               \
+        s0 = vop(s0, _mm_loadu_pd(a + i));     \
+        s1 = vop(s1, _mm_loadu_pd(a + i + 2)); \
+    }                                          \
+    double lanes[2];                           \
+    _mm_storeu_pd(lanes, vop(s0, s1));         \
+    x = sop(x, sop(lanes[0], lanes[1]));
+#else
+#define F64_MAP_VECTOR(vop)
+#define F64_FOLD_VECTOR(vop, sop, unit)
+#endif
+
+// r[i] = a[i] op b[i * step]
+#define F64_MAP(vop, sop)                                 \
+    do {                                                  \
+        F64_MAP_VECTOR(vop)                               \
+        for (; i < n; i++) r[i] = sop(a[i], b[i * step]); \
+    } while (0)
+
+#define F64_FOLD(vop, sop, unit)             \
+    do {                                     \
+        F64_FOLD_VECTOR(vop, sop, unit)      \
+        for (; i < n; i++) x = sop(x, a[i]); \
+    } while (0)
+
+static void f64_map(enum f64_op_t op, double *r, const double *a,
+                    const double *b, long step, long n) {
+    long i = 0;
+    switch (op) {
+        case F64_ADD:
+            F64_MAP(_mm_add_pd, f64_add);
+            break;
+        case F64_SUB:
+            F64_MAP(_mm_sub_pd, f64_sub);
+            break;
+        case F64_MUL:
+            F64_MAP(_mm_mul_pd, f64_mul);
+            break;
+        case F64_DIV:
+            F64_MAP(_mm_div_pd, f64_div);
+            break;
+        case F64_MIN:
+            F64_MAP(_mm_min_pd, f64_min);
+            break;
+        case F64_MAX:
+            F64_MAP(_mm_max_pd, f64_max);
+            break;
+    }
+}
+
+ptr f64vector_map(gc_t *gc, enum f64_op_t op, ptr a, ptr b) {
+    long n = f64vector_length(a);
+    if (n != f64vector_length(b)) FATAL("f64vector-map: length mismatch");
+    GC_LOCALS(l, 2);
+    l[0] = a;
+    l[1] = b;
+    ptr r = f64vector_alloc(gc, n);
+    f64_map(op, ptr_pointer(r)->f64, ptr_pointer(l[0])->f64,
+            ptr_pointer(l[1])->f64, 1, n);
+    GC_UNLOCALS(l);
+    return r;
+}
+
+ptr f64vector_map_scalar(gc_t *gc, enum f64_op_t op, ptr a, double x) {
+    GC_LOCALS(l, 1);
+    l[0] = a;
+    long n = f64vector_length(a);
+    ptr r = f64vector_alloc(gc, n);
+    f64_map(op, ptr_pointer(r)->f64, ptr_pointer(l[0])->f64, &x, 0, n);
+    GC_UNLOCALS(l);
+    return r;
+}
+
+double f64vector_fold(enum f64_op_t op, ptr v, double x) {
+    const double *a = ptr_pointer(v)->f64;
+    long n = f64vector_length(v), i = 0;
+    switch (op) {
+        case F64_ADD:
+            F64_FOLD(_mm_add_pd, f64_add, 0.0);
+            break;
+        case F64_MUL:
+            F64_FOLD(_mm_mul_pd, f64_mul, 1.0);
+            break;
+        case F64_MIN:
+            F64_FOLD(_mm_min_pd, f64_min, INFINITY);
+            break;
+        case F64_MAX:
+            F64_FOLD(_mm_max_pd, f64_max, -INFINITY);
+            break;
+        default:
+            FATAL("f64vector-fold: not an associative operation");
+    }
+    return x;
+}
+
+double f64vector_dot(ptr u, ptr v) {
+    const double *a = ptr_pointer(u)->f64, *b = ptr_pointer(v)->f64;
+    long n = f64vector_length(u), i = 0;
+    if (n != f64vector_length(v)) FATAL("f64vector-dot: length mismatch");
+    double x = 0;
+#ifdef __SSE2__
+    __m128d s0 = _mm_setzero_pd(), s1 = s0;
+    for (; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i),
+                                       _mm_loadu_pd(b + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2),
+                                       _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+    x = lanes[0] + lanes[1];
+#endif
+    for (; i < n; i++) x += a[i] * b[i];
+    return x;
+}
+
+void obarray_init(obarray_t *obarray) {
+    obarray->size = OBARRAY_INITIAL_SIZE;
+    obarray->heads = calloc(obarray->size, sizeof(obarray_node_t *));
+    obarray->count = 0;
+    obarray->names_size = OBARRAY_INITIAL_SIZE;
+    obarray->names = malloc(obarray->names_size * sizeof(obarray_node_t *));
+    obarray->names[0] = NULL;
+}
+
+// wyhash-style mixing: the folded 128-bit product of two words
+static inline uint64_t obarray_mix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+// hashes two characters per step
+static uint64_t obarray_hash(const char_t *s, long n) {
+    const uint64_t k0 = 0xa0761d6478bd642full, k1 = 0xe7037ed1a0b428dbull;
+    uint64_t h = k0 ^ (uint64_t)n;
+    long i;
+    for (i = 0; i + 1 < n; i += 2)
+        h = obarray_mix(h ^ ((uint32_t)s[i] | (uint64_t)s[i + 1] << 32), k1);
+    if (i < n) h = obarray_mix(h ^ (uint32_t)s[i], k1);
+    return obarray_mix(h ^ k0, k1);
+}
+
+static void obarray_grow(obarray_t *obarray) {
+    long size = obarray->size * 2;
+    obarray_node_t **heads = calloc(size, sizeof(obarray_node_t *));
+    for (long i = 0; i < obarray->size; i++) {
+        for (obarray_node_t *u = obarray->heads[i], *next; u; u = next) {
+            next = u->next;
+            obarray_node_t **head = heads + (u->hash & (size - 1));
+            u->next = *head;
+            *head = u;
+        }
+    }
+    free(obarray->heads);
+    obarray->heads = heads;
+    obarray->size = size;
+}
+
+ptr obarray_intern(obarray_t *obarray, const char_t *s) {
+    return obarray_intern_n(obarray, s, lstrlen(s));
+}
+
+ptr obarray_intern_n(obarray_t *obarray, const char_t *s, long n) {
+    uint64_t hash = obarray_hash(s, n);
+    obarray_node_t **head = obarray->heads + (hash & (obarray->size - 1));
+    for (obarray_node_t *u = *head; u; u = u->next) {
+        if (u->hash == hash && u->length == n &&
+            memcmp(u->s, s, n * sizeof(char_t)) == 0)
+            return make_symbol(u->index);
+    }
+    obarray->count++;
+    obarray_node_t *v =
+        malloc(sizeof(obarray_node_t) + (n + 1) * sizeof(char_t));
+    v->hash = hash;
+    v->index = obarray->count;
+    v->length = n;
+    memcpy(v->s, s, n * sizeof(char_t));
+    v->s[n] = 0;
+    v->next = *head;
+    *head = v;
+    if (obarray->count >= obarray->names_size) {
+        obarray->names_size *= 2;
+        obarray->names = realloc(obarray->names, obarray->names_size *
+                                                     sizeof(obarray_node_t *));
+    }
+    obarray->names[v->index] = v;
+    if (obarray->count > obarray->size * OBARRAY_LOAD) obarray_grow(obarray);
+    return make_symbol(v->index);
+}
+
+const char_t *obarray_name(obarray_t *obarray, ptr sym, long *length) {
+    obarray_node_t *u = obarray->names[ptr_symbol(sym)];
+    if (length) *length = u->length;
+    return u->s;
+}
+
+ptr_move_transform_t make_transform(uint8_t *from, uint8_t *to, size_t size) {
+    ptr_move_transform_t t;
+    t.from = from;
+    t.to = to;
+    t.size = size;
+    return t;
+}
+
+uint8_t *apply_transform(ptr_move_transform_t t, uint8_t *p) {
+    ptrdiff_t offset = p - t.from;
+    if (offset < 0 || offset >= t.size) return p;
+    return p - t.from + t.to;
+}
+
+obj *apply_transform_obj(ptr_move_transform_t t, obj *p) {
+    return (obj *)apply_transform(t, (uint8_t *)p);
+}
+
+// the heap lives in address space reserved once at startup. the committed
+// prefix of each region is made accessible with mprotect, and pages that no
+// longer hold objects are handed back to the kernel with madvise.
+static uint8_t *gc_reserve(size_t size) {
+    void *p = mmap(NULL, size, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) FATAL("gc: cannot reserve %zu bytes", size);
+    return p;
+}
+
+static void gc_commit(uint8_t *start, size_t size) {
+    if (mprotect(start, size, PROT_READ | PROT_WRITE))
+        FATAL("gc: cannot commit %zu bytes", size);
+}
+
+static void gc_decommit(uint8_t *start, uint8_t *end) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t s = ((uintptr_t)start + page - 1) & ~(page - 1);
+    uintptr_t e = (uintptr_t)end & ~(page - 1);
+    if (s < e) madvise((void *)s, e - s, MADV_DONTNEED);
+}
+
+_Thread_local gc_thread_t *gc_current;
+
+// gathers the root slots of all mutator threads, from their root stacks and
+// frames, into one array that each phase of a collection sweeps linearly
+static void roots_gather(gc_t *gc) {
+    long n = 0;
+    for (gc_thread_t *t = gc->mutators; t; t = t->next) {
+        n += t->sp;
+        for (gc_frame_t *f = t->frames; f; f = f->prev) n += f->count;
+    }
+    if (n > gc->roots_size) {
+        gc->roots_size = n * 2;
+        gc->roots = realloc(gc->roots, gc->roots_size * sizeof(ptr *));
+    }
+    ptr **r = gc->roots;
+    for (gc_thread_t *t = gc->mutators; t; t = t->next) {
+        memcpy(r, t->stack, t->sp * sizeof(ptr *));
+        r += t->sp;
+        for (gc_frame_t *f = t->frames; f; f = f->prev)
+            for (long i = 0; i < f->count; i++) *r++ = f->slots + i;
+    }
+    gc->roots_count = n;
+}
+
+// the contiguous share of the roots scanned by worker w
+static void roots_share(gc_t *gc, gc_worker_t *w, long *lo, long *hi) {
+    *lo = gc->roots_count * w->id / gc->threads;
+    *hi = gc->roots_count * (w->id + 1) / gc->threads;
+}
+
+static void tlab_retire(gc_thread_t *t) {
+    gc_t *gc = t->gc;
+    if (t->tlab_end == gc->young_alloc) {
+        gc->young_alloc = t->tlab_alloc;
+    } else if (t->tlab_alloc < t->tlab_end) {
+        // keep the young generation walkable
+        fill_header((obj *)t->tlab_alloc, H_FREE, t->tlab_end - t->tlab_alloc);
+    }
+    t->tlab_alloc = t->tlab_end = NULL;
+}
+
+static void tlab_retire_all(gc_t *gc) {
+    for (gc_thread_t *t = gc->mutators; t; t = t->next) tlab_retire(t);
+}
+
+static long gc_now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+// bytes in use in the young and old generations and the large-object space
+static size_t heap_used(gc_t *gc) {
+    return (gc->young_alloc - gc->young_from) +
+           (gc->old_alloc - gc->old - gc->old_free) + gc->large_bytes;
+}
+
+// the start of a collection: young allocation since the previous one is
+// counted from the bytes it left behind. returns the start time.
+static long stats_begin(gc_t *gc) {
+    gc->stats.allocated +=
+        gc->young_alloc - gc->young_from - gc->young_survived;
+    return gc_now_ns();
+}
+
+void gc_init(gc_t *gc) {
+    gc->young_from = gc_reserve(2 * GC_YOUNG_RESERVE);
+    gc->young_to = gc->young_from + GC_YOUNG_RESERVE;
+    gc->young_size = GC_INITIAL_SIZE;
+    gc->young_alloc = gc->young_from;
+    gc_commit(gc->young_from, gc->young_size);
+    gc_commit(gc->young_to, gc->young_size);
+
+    gc->old = gc_reserve(GC_OLD_RESERVE);
+    gc->old_alloc = gc->old;
+    gc->old_size = GC_INITIAL_SIZE * GC_OLD_TO_YOUNG_RATIO;
+    gc_commit(gc->old, gc->old_size);
+
+    gc->cards = gc_reserve(GC_OLD_RESERVE / GC_CARD_SIZE);
+    gc->card_first = gc_reserve(GC_OLD_RESERVE / GC_CARD_SIZE);
+    gc_commit(gc->cards, gc->old_size / GC_CARD_SIZE);
+    gc_commit(gc->card_first, gc->old_size / GC_CARD_SIZE);
+    gc->tenure_failed = 0;
+    memset(gc->free_lists, 0, sizeof(gc->free_lists));
+    gc->old_free = 0;
+    gc->promoted_size = GC_MARK_STACK_SIZE;
+    gc->promoted = malloc(gc->promoted_size * sizeof(obj *));
+    gc->promoted_sp = 0;
+
+    memset(gc->compact, 0, sizeof(gc->compact));
+    gc->marking = 0;
+    const char *step_kb = getenv("S3_GC_STEP_KB");
+    const char *step_us = getenv("S3_GC_STEP_US");
+    gc_set_incremental(gc, step_kb ? atol(step_kb) : 0,
+                       step_us ? atol(step_us) : 0);
+
+    pthread_mutex_init(&gc->pool_lock, NULL);
+    pthread_cond_init(&gc->pool_start, NULL);
+    pthread_cond_init(&gc->pool_done, NULL);
+    gc->pool_epoch = 0;
+    gc->workers = NULL;
+    const char *threads = getenv("S3_GC_THREADS");
+    gc_set_threads(gc, threads ? atoi(threads)
+                               : (int)sysconf(_SC_NPROCESSORS_ONLN));
+    gc_update_limit(gc);
+
+    pthread_mutex_init(&gc->lock, NULL);
+    pthread_cond_init(&gc->stopped, NULL);
+    pthread_cond_init(&gc->resumed, NULL);
+    gc->stop = 0;
+    gc->running = 0;
+    gc->mutators = NULL;
+    gc->roots = NULL;
+    gc->roots_size = gc->roots_count = 0;
+    gc->large = NULL;
+    gc->large_bytes = 0;
+    gc->large_limit = gc->old_size;
+    memset(&gc->stats, 0, sizeof(gc->stats));
+    const char *trace = getenv("S3_GC_TRACE");
+    gc->trace = trace ? atoi(trace) : 0;
+    gc->young_survived = 0;
+    gc->sample_bytes = 0;
+    gc->sample = NULL;
+    gc->census = 0;
+    memset(gc->census_count, 0, sizeof(gc->census_count));
+    memset(gc->census_bytes, 0, sizeof(gc->census_bytes));
+    gc_attach(gc);
+}
+
+void fill_header(obj *o, enum heapvar_type_t type, long size) {
+    o->header = (uintptr_t)size / GC_ALIGNMENT << HDR_SIZE_SHIFT | type;
+}
+
+// records that an object starts at p in the old generation
+static void card_note_object(gc_t *gc, uint8_t *p) {
+    size_t offset = p - gc->old;
+    uint8_t *first = gc->card_first + offset / GC_CARD_SIZE;
+    uint8_t words = offset % GC_CARD_SIZE / GC_ALIGNMENT + 1;
+    if (*first == GC_CARD_NONE || *first > words) *first = words;
+}
+
+static int check_refs_into(obj *p, uint8_t *start, uint8_t *end);
+
+// turns [p, p + size) into a free chunk of the old generation. chunks of a
+// single word cannot hold a link and are left off the free lists.
+static void old_free_chunk(gc_t *gc, uint8_t *p, size_t size) {
+    obj *o = (obj *)p;
+    fill_header(o, H_FREE, size);
+    card_note_object(gc, p);
+    if (size < OBJ_HEADER_SIZE + sizeof(obj *)) return;
+    long words = size / GC_ALIGNMENT;
+    obj **list = gc->free_lists + (words < GC_FREE_CLASSES ? words : 0);
+    o->next_free = *list;
+    *list = o;
+    gc->old_free += size;
+}
+
+static uint8_t *old_take_chunk(gc_t *gc, obj **list, size_t size) {
+    obj *o = *list;
+    size_t chunk = obj_size(o);
+    *list = o->next_free;
+    gc->old_free -= chunk;
+    if (chunk > size) old_free_chunk(gc, (uint8_t *)o + size, chunk - size);
+    return (uint8_t *)o;
+}
+
+// allocates in the old generation: exact fits and then bigger chunks from the
+// segregated free lists, bump allocation at the end of the generation last.
+// returns NULL if the old generation is full.
+static uint8_t *old_allocate(gc_t *gc, size_t size) {
+    long words = size / GC_ALIGNMENT;
+    uint8_t *p = NULL;
+    if (gc->old_free) {
+        for (long k = words; k < GC_FREE_CLASSES && !p; k++)
+            if (gc->free_lists[k])
+                p = old_take_chunk(gc, gc->free_lists + k, size);
+        for (obj **u = gc->free_lists; !p && *u; u = &(*u)->next_free) {
+            if (obj_size(*u) >= size) {
+                p = old_take_chunk(gc, u, size);
+                break;
+            }
+        }
+    }
+    if (!p && gc->old_alloc + size <= gc->old + gc->old_size) {
+        p = gc->old_alloc;
+        gc->old_alloc += size;
+    }
+    if (p) card_note_object(gc, p);
+    return p;
+}
+
+int gc_minor(gc_t *gc) {
+    tlab_retire_all(gc);
+    long start = stats_begin(gc);
+    gc_stats_t *s = &gc->stats, before = *s;
+    roots_gather(gc);
+    gc->young_alloc = gc->young_scan = gc->young_to;
+    gc->tenure_failed = 0;
+    uint8_t *to_end = gc->young_to + gc->young_size;
+    uint8_t *old_end = gc->old_alloc;
+    gc->promoted_sp = 0;
+
+    for (long i = 0; i < gc->roots_count; i++)
+        *gc->roots[i] = gc_copy(gc, *gc->roots[i]);
+
+    // objects tenured during this collection are scanned below as well
+    long cards = (old_end - gc->old + GC_CARD_SIZE - 1) / GC_CARD_SIZE;
+    for (long c = 0; c < cards; c++) {
+        if (!gc->cards[c] || gc->card_first[c] == GC_CARD_NONE) continue;
+        gc->cards[c] = 0;
+        s->remembered++;
+        uint8_t *p = gc->old + c * GC_CARD_SIZE +
+                     (gc->card_first[c] - 1) * GC_ALIGNMENT;
+        uint8_t *end = gc->old + (c + 1) * GC_CARD_SIZE;
+        if (end > old_end) end = old_end;
+        for (; p < end; p += obj_size((obj *)p)) {
+            s->scanned += obj_size((obj *)p);
+            copy_refs(gc, (obj *)p);
+            if (check_refs_into((obj *)p, gc->young_to, to_end))
+                gc->cards[c] = 1;
+        }
+    }
+
+    for (gc_large_t *l = gc->large; l; l = l->next) {
+        if (!l->dirty) continue;
+        obj *o = gc_large_obj(l);
+        s->remembered++;
+        s->scanned += obj_size(o);
+        copy_refs(gc, o);
+        l->dirty = check_refs_into(o, gc->young_to, to_end);
+    }
+
+    // cheney scan over both the to-space and the newly tenured objects, which
+    // are not contiguous when they fill holes in the old generation
+    while (gc->young_scan < gc->young_alloc || gc->promoted_sp) {
+        for (obj *p; gc->young_scan < gc->young_alloc;
+             gc->young_scan += obj_size(p)) {
+            p = (obj *)gc->young_scan;
+            copy_refs(gc, p);
+        }
+        while (gc->promoted_sp) {
+            obj *p = gc->promoted[--gc->promoted_sp];
+            copy_refs(gc, p);
+            if (check_refs_into(p, gc->young_to, to_end))
+                gc_card_mark(gc, p);
+        }
+    }
+
+    uint8_t *from = gc->young_from;
+    gc->young_from = gc->young_to;
+    gc->young_to = from;
+    gc_update_limit(gc);
+
+    gc->young_survived = gc->young_alloc - gc->young_from;
+    long ns = gc_now_ns() - start;
+    s->minor_count++;
+    s->minor_ns += ns;
+    if (gc->trace)
+        fprintf(stderr,
+                "gc: minor %ld us, %zu copied, %zu promoted, "
+                "%ld remembered (%zu bytes)\n",
+                ns / 1000, s->copied - before.copied,
+                s->promoted - before.promoted,
+                s->remembered - before.remembered,
+                s->scanned - before.scanned);
+    return gc->tenure_failed;
+}
+
+ptr gc_copy(gc_t *gc, ptr p) {
+    if (!young_pointer_p(gc, p)) return p;
+    obj *o = ptr_pointer(p);
+    if (obj_moved(o)) return make_pointer(o->forward);
+    size_t size = obj_size(o);
+    obj *to = NULL;
+    if (obj_age(o) + 1 >= GC_THRESHOLD_AGE) {
+        to = (obj *)old_allocate(gc, size);
+        // if the old generation is full, keep the object young for now
+        if (!to) gc->tenure_failed = 1;
+    }
+    if (to) {
+        if (gc->promoted_sp >= gc->promoted_size) {
+            gc->promoted_size *= 2;
+            gc->promoted =
+                realloc(gc->promoted, gc->promoted_size * sizeof(obj *));
+        }
+        gc->promoted[gc->promoted_sp++] = to;
+        gc->stats.promoted += size;
+        // objects tenured while marking are gray: their fields are untraced
+        if (gc->marking) gc_shade(gc, make_pointer(to));
+    } else {
+        to = (obj *)gc->young_alloc;
+        gc->young_alloc += size;
+        gc->stats.copied += size;
+    }
+    memcpy(to, o, size);
+    obj_grow_older(to);
+    obj_set_forward(o, to);
+    return make_pointer(to);
+}
+
+#define MAKE_WALKER(op, p)                                               \
+    do {                                                                 \
+        switch (obj_type(p)) {                                           \
+            case H_BIGINT:                                               \
+            case H_FLONUM:                                               \
+            case H_FREE:                                                 \
+            case H_BYTEVECTOR:                                           \
+            case H_F64VECTOR:                                            \
+                break;                                                   \
+            case H_CODE:                                                 \
+                for (long i = 0; i < p->code_size; i++)                  \
+                    for (int j = 0; j < 4; j++)                          \
+                        op(instructions[i].operand[j]);                  \
+                break;                                                   \
+            case H_STRING:                                               \
+                if (p->header & HDR_STRING_INDIRECT) op(string_target);  \
+                break;                                                   \
+            case H_RATIONAL:                                             \
+                op(numerator);                                           \
+                op(denominator);                                         \
+                break;                                                   \
+            case H_COMPLEX:                                              \
+                op(real);                                                \
+                op(imaginary);                                           \
+                break;                                                   \
+            case H_PAIR:                                                 \
+                op(car);                                                 \
+                op(cdr);                                                 \
+                break;                                                   \
+            case H_VECTOR:                                               \
+                for (long i = 0; i < p->vector_size; i++) op(vector[i]); \
+                break;                                                   \
+            case H_ENVIRONMENT:                                          \
+                for (long i = 0; i < p->env_size; i++) op(entry[i]);     \
+                break;                                                   \
+            case H_ACTIVATION_RECORD:                                    \
+                for (long i = 0; i < p->ar_size; i++) op(slot[i]);       \
+                break;                                                   \
+            case H_PROCEDURE:                                            \
+                op(formals);                                             \
+                op(p_env);                                               \
+                op(body);                                                \
+                op(code);                                                \
+                break;                                                   \
+            case H_MACRO:                                                \
+                for (long i = 0; i < p->macro_transformers_count; i++)   \
+                    op(transformers[i]);                                 \
+                break;                                                   \
+            case H_TRANSFORMER:                                          \
+                op(t_env);                                               \
+                op(pattern);                                             \
+                op(template);                                            \
+                break;                                                   \
+            case H_STRUCT:                                               \
+                for (long i = 0; i < p->struct_size; i++) op(field[i]);  \
+                break;                                                   \
+            default:                                                     \
+                FATAL("object walker: unknown object type");             \
+        }                                                                \
+    } while (0)
+
+// major collections run on a pool of gc->threads threads, the collecting
+// thread being worker 0. each phase is a job run by every worker; gc_run
+// returns when all of them have finished it.
+static void *gc_worker_main(void *arg) {
+    gc_worker_t *w = arg;
+    gc_t *gc = w->gc;
+    long epoch = 0;
+    for (;;) {
+        pthread_mutex_lock(&gc->pool_lock);
+        while (gc->pool_epoch == epoch)
+            pthread_cond_wait(&gc->pool_start, &gc->pool_lock);
+        epoch = gc->pool_epoch;
+        gc_job_t job = gc->pool_job;
+        pthread_mutex_unlock(&gc->pool_lock);
+        if (!job) return NULL;
+        job(gc, w);
+        pthread_mutex_lock(&gc->pool_lock);
+        if (++gc->pool_finished == gc->threads - 1)
+            pthread_cond_signal(&gc->pool_done);
+        pthread_mutex_unlock(&gc->pool_lock);
+    }
+}
+
+static void gc_run(gc_t *gc, gc_job_t job) {
+    if (gc->threads > 1) {
+        pthread_mutex_lock(&gc->pool_lock);
+        gc->pool_job = job;
+        gc->pool_finished = 0;
+        gc->pool_epoch++;
+        pthread_cond_broadcast(&gc->pool_start);
+        pthread_mutex_unlock(&gc->pool_lock);
+    }
+    if (job) job(gc, gc->workers);
+    if (gc->threads > 1) {
+        pthread_mutex_lock(&gc->pool_lock);
+        while (gc->pool_finished < gc->threads - 1)
+            pthread_cond_wait(&gc->pool_done, &gc->pool_lock);
+        pthread_mutex_unlock(&gc->pool_lock);
+    }
+}
+
+static gc_deque_buf_t *deque_buf_new(long size, gc_deque_buf_t *prev) {
+    gc_deque_buf_t *a = malloc(sizeof(gc_deque_buf_t) + size * sizeof(obj *));
+    a->size = size;
+    a->prev = prev;
+    return a;
+}
+
+void gc_set_threads(gc_t *gc, int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > GC_MAX_THREADS) threads = GC_MAX_THREADS;
+    if (gc->workers) {
+        // a null job stops the helper threads
+        gc_run(gc, NULL);
+        for (int i = 1; i < gc->threads; i++)
+            pthread_join(gc->workers[i].thread, NULL);
+        for (int i = 0; i < gc->threads; i++) free(gc->workers[i].deque.buf);
+        free(gc->workers);
+    }
+    gc->threads = threads;
+    gc->workers = calloc(threads, sizeof(gc_worker_t));
+    for (int i = 0; i < threads; i++) {
+        gc_worker_t *w = gc->workers + i;
+        w->gc = gc;
+        w->id = i;
+        w->deque.buf = deque_buf_new(GC_MARK_STACK_SIZE, NULL);
+        if (i) pthread_create(&w->thread, NULL, gc_worker_main, w);
+    }
+}
+
+// marking uses one chase-lev deque per worker: the owner pushes and takes at
+// the bottom without locking, idle workers steal from the top. buffers
+// outgrown during a collection are freed once marking is over, as thieves
+// may still be reading them.
+static void deque_push(gc_deque_t *d, obj *o) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    gc_deque_buf_t *a = d->buf;
+    if (b - t >= a->size) {
+        gc_deque_buf_t *n = deque_buf_new(a->size * 2, a);
+        for (long i = t; i < b; i++)
+            n->slot[i & (n->size - 1)] = a->slot[i & (a->size - 1)];
+        __atomic_store_n(&d->buf, n, __ATOMIC_RELEASE);
+        a = n;
+    }
+    __atomic_store_n(&a->slot[b & (a->size - 1)], o, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+static obj *deque_take(gc_deque_t *d) {
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    gc_deque_buf_t *a = d->buf;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    obj *o = NULL;
+    if (t <= b) {
+        o = __atomic_load_n(&a->slot[b & (a->size - 1)], __ATOMIC_RELAXED);
+        if (t == b) {
+            if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                             __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED))
+                o = NULL;
+            __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return o;
+}
+
+static obj *deque_steal(gc_deque_t *d) {
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return NULL;
+    gc_deque_buf_t *a = __atomic_load_n(&d->buf, __ATOMIC_ACQUIRE);
+    obj *o = __atomic_load_n(&a->slot[t & (a->size - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0, __ATOMIC_SEQ_CST,
+                                     __ATOMIC_RELAXED))
+        return NULL;
+    return o;
+}
+
+static int deque_empty(gc_deque_t *d) {
+    return __atomic_load_n(&d->top, __ATOMIC_ACQUIRE) >=
+           __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+}
+
+static gc_compact_t *compact_space(gc_t *gc, obj *o) {
+    for (int i = 0; i < 2; i++) {
+        gc_compact_t *c = gc->compact + i;
+        if ((uint8_t *)o >= c->start && (uint8_t *)o < c->end) return c;
+    }
+    return NULL;
+}
+
+// marks o in the live bitmap of its space, or in its header if it is large.
+// returns whether it was unmarked.
+static int mark_object(gc_t *gc, obj *o) {
+    gc_compact_t *c = compact_space(gc, o);
+    if (!c) {
+        if (!(o->header & HDR_LARGE)) return 0;
+        return !(__atomic_fetch_or(&o->header, HDR_MARK, __ATOMIC_RELAXED) &
+                 HDR_MARK);
+    }
+    size_t w = ((uint8_t *)o - c->start) / GC_ALIGNMENT;
+    uint64_t bit = (uint64_t)1 << w % GC_BLOCK_WORDS;
+    uint64_t *word = c->live + w / GC_BLOCK_WORDS;
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) return 0;
+    return !(__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit);
+}
+
+static void mark_ptr(gc_t *gc, gc_worker_t *w, ptr p) {
+    if (!pointer_p(p) || !mark_object(gc, ptr_pointer(p))) return;
+    __builtin_prefetch(ptr_pointer(p), 1);
+    deque_push(&w->deque, ptr_pointer(p));
+}
+
+// objects are marked when pushed. popped objects wait in a small fifo after
+// their header is prefetched, so the cache miss overlaps with scanning the
+// objects ahead of them.
+static void mark_drain(gc_t *gc, gc_worker_t *w) {
+    obj *fifo[GC_PREFETCH_DISTANCE];
+    int head = 0, count = 0;
+#define MARK_MEMBER(member) mark_ptr(gc, w, p->member)
+    for (;;) {
+        for (obj *o; count < GC_PREFETCH_DISTANCE &&
+                     (o = deque_take(&w->deque));) {
+            __builtin_prefetch(o, 1);
+            fifo[(head + count++) % GC_PREFETCH_DISTANCE] = o;
+        }
+        if (!count) return;
+        obj *p = fifo[head];
+        head = (head + 1) % GC_PREFETCH_DISTANCE;
+        count--;
+        if (gc->census) {
+            w->census_count[obj_type(p)]++;
+            w->census_bytes[obj_type(p)] += obj_size(p);
+        }
+        MAKE_WALKER(MARK_MEMBER, p);
+    }
+#undef MARK_MEMBER
+}
+
+// steals from the other workers until one of them has work or every worker
+// is idle. returns whether there is more work.
+static int mark_steal(gc_t *gc, gc_worker_t *w) {
+    for (;;) {
+        for (int i = 1; i < gc->threads; i++) {
+            gc_worker_t *v = gc->workers + (w->id + i) % gc->threads;
+            obj *o = deque_steal(&v->deque);
+            if (o) {
+                deque_push(&w->deque, o);
+                return 1;
+            }
+        }
+        __atomic_add_fetch(&gc->mark_idle, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&gc->mark_idle, __ATOMIC_SEQ_CST) ==
+                gc->threads)
+                return 0;
+            int found = 0;
+            for (int i = 0; i < gc->threads && !found; i++)
+                found = !deque_empty(&gc->workers[i].deque);
+            if (found) break;
+            sched_yield();
+        }
+        __atomic_sub_fetch(&gc->mark_idle, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void mark_job(gc_t *gc, gc_worker_t *w) {
+    long lo, hi;
+    roots_share(gc, w, &lo, &hi);
+    for (long i = lo; i < hi; i++) mark_ptr(gc, w, *gc->roots[i]);
+    do mark_drain(gc, w);
+    while (mark_steal(gc, w));
+}
+
+void gc_mark(gc_t *gc, obj *p) {
+    if (!mark_object(gc, p)) return;
+    deque_push(&gc->workers->deque, p);
+    mark_drain(gc, gc->workers);
+}
+
+// sliding compaction needs the payload intact until objects are moved, so
+// forwarding addresses are kept in side tables instead. marking sets one bit
+// per word for the start of every live object. each space is then cut into
+// regions, which are compacted in parallel: the destination of every region
+// comes from a prefix sum over the live bytes of the regions before it, and
+// within a region the destination of the first live object starting in each
+// block is recorded. the forwarding address of an object is that destination
+// plus the sizes of the live objects before it in its block.
+static void compact_reset(gc_compact_t *c, uint8_t *start, uint8_t *end) {
+    long blocks = (end - start + GC_BLOCK_SIZE - 1) / GC_BLOCK_SIZE;
+    long regions = (blocks + GC_REGION_BLOCKS - 1) / GC_REGION_BLOCKS;
+    if (blocks > c->max_blocks) {
+        c->live = realloc(c->live, blocks * sizeof(uint64_t));
+        c->block_dest = realloc(c->block_dest, blocks * sizeof(uintptr_t));
+        c->max_blocks = blocks;
+    }
+    if (regions > c->max_regions) {
+        c->region_live = realloc(c->region_live, regions * sizeof(size_t));
+        c->region_dest = realloc(c->region_dest, regions * sizeof(uint8_t *));
+        c->region_src_end =
+            realloc(c->region_src_end, regions * sizeof(uint8_t *));
+        c->region_wait = realloc(c->region_wait, regions * sizeof(long));
+        c->region_done = realloc(c->region_done, regions * sizeof(int));
+        c->max_regions = regions;
+    }
+    if (blocks) memset(c->live, 0, blocks * sizeof(uint64_t));
+    if (regions) memset(c->region_done, 0, regions * sizeof(int));
+    c->start = start;
+    c->end = end;
+    c->blocks = blocks;
+    c->regions = regions;
+}
+
+static uint8_t *region_start(gc_compact_t *c, long r) {
+    return c->start + r * GC_REGION_SIZE;
+}
+
+// calls body with o bound to each live object starting in region r of c
+#define FOR_LIVE_IN_REGION(c, r, o, ...)                                       \
+    do {                                                                       \
+        long b_end_ = ((r) + 1) * GC_REGION_BLOCKS;                            \
+        if (b_end_ > (c)->blocks) b_end_ = (c)->blocks;                        \
+        for (long b_ = (r) * GC_REGION_BLOCKS; b_ < b_end_; b_++) {            \
+            for (uint64_t l_ = (c)->live[b_]; l_; l_ &= l_ - 1) {              \
+                obj *o = (obj *)((c)->start +                                  \
+                                 (b_ * GC_BLOCK_WORDS + __builtin_ctzll(l_)) * \
+                                     GC_ALIGNMENT);                            \
+                __VA_ARGS__;                                                   \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+// hands out the regions of both spaces in address order
+static int next_region(gc_t *gc, gc_compact_t **c, long *r) {
+    long i = __atomic_fetch_add(&gc->region_next, 1, __ATOMIC_RELAXED);
+    for (int k = 0; k < 2; k++) {
+        if (i < gc->compact[k].regions) {
+            *c = gc->compact + k;
+            *r = i;
+            return 1;
+        }
+        i -= gc->compact[k].regions;
+    }
+    return 0;
+}
+
+// per block live bytes, stored in block_dest until region_job_dest runs
+static void region_job_sum(gc_t *gc, gc_worker_t *w) {
+    gc_compact_t *c;
+    long r;
+    while (next_region(gc, &c, &r)) {
+        if (c->sweep) continue;
+        uint8_t *src_end = region_start(c, r + 1);
+        long b = -1;
+        size_t live = 0;
+        FOR_LIVE_IN_REGION(c, r, o, {
+            long ob = ((uint8_t *)o - c->start) / GC_BLOCK_SIZE;
+            if (ob != b) c->block_dest[ob] = 0;
+            b = ob;
+            c->block_dest[b] += obj_size(o);
+            live += obj_size(o);
+            if ((uint8_t *)o + obj_size(o) > src_end)
+                src_end = (uint8_t *)o + obj_size(o);
+        });
+        c->region_live[r] = live;
+        c->region_src_end[r] = src_end;
+    }
+}
+
+static void region_job_dest(gc_t *gc, gc_worker_t *w) {
+    gc_compact_t *c;
+    long r;
+    while (next_region(gc, &c, &r)) {
+        if (c->sweep) continue;
+        uintptr_t dest = (uintptr_t)c->region_dest[r];
+        long b_end = (r + 1) * GC_REGION_BLOCKS;
+        if (b_end > c->blocks) b_end = c->blocks;
+        for (long b = r * GC_REGION_BLOCKS; b < b_end; b++) {
+            if (!c->live[b]) continue;
+            uintptr_t live = c->block_dest[b];
+            c->block_dest[b] = dest;
+            dest += live;
+        }
+    }
+}
+
+// sequential part: region destinations and the regions each one must wait
+// for before sliding, i.e. the earlier regions whose live objects overlap its
+// destination
+static void compact_plan(gc_compact_t *c) {
+    uint8_t *dest = c->start, *reach = c->start;
+    for (long r = 0, wait = 0; r < c->regions; r++) {
+        c->region_dest[r] = dest;
+        for (; wait < r && c->region_src_end[wait] <= dest; wait++)
+            ;
+        c->region_wait[r] = wait;
+        dest += c->region_live[r];
+        // regions are waited on as a range, so keep the ends monotonic
+        if (c->region_src_end[r] < reach) c->region_src_end[r] = reach;
+        reach = c->region_src_end[r];
+    }
+    c->free = dest;
+}
+
+static obj *compact_forward(gc_compact_t *c, obj *o) {
+    size_t w = ((uint8_t *)o - c->start) / GC_ALIGNMENT;
+    uint8_t *dest = (uint8_t *)c->block_dest[w / GC_BLOCK_WORDS];
+    uint64_t before = c->live[w / GC_BLOCK_WORDS] &
+                      (((uint64_t)1 << w % GC_BLOCK_WORDS) - 1);
+    for (; before; before &= before - 1) {
+        size_t v = w - w % GC_BLOCK_WORDS + __builtin_ctzll(before);
+        dest += obj_size((obj *)(c->start + v * GC_ALIGNMENT));
+    }
+    return (obj *)dest;
+}
+
+static ptr compact_update(gc_t *gc, ptr p) {
+    if (!pointer_p(p)) return p;
+    gc_compact_t *c = compact_space(gc, ptr_pointer(p));
+    if (!c || c->sweep) return p;
+    return make_pointer(compact_forward(c, ptr_pointer(p)));
+}
+
+// the card of an object's destination may be shared with another region
+static void card_note_object_atomic(gc_t *gc, uint8_t *p) {
+    size_t offset = p - gc->old;
+    uint8_t *first = gc->card_first + offset / GC_CARD_SIZE;
+    uint8_t words = offset % GC_CARD_SIZE / GC_ALIGNMENT + 1;
+    uint8_t cur = __atomic_load_n(first, __ATOMIC_RELAXED);
+    while ((cur == GC_CARD_NONE || cur > words) &&
+           !__atomic_compare_exchange_n(first, &cur, words, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void region_job_update(gc_t *gc, gc_worker_t *w) {
+    long lo, hi;
+    roots_share(gc, w, &lo, &hi);
+    for (long i = lo; i < hi; i++)
+        *gc->roots[i] = compact_update(gc, *gc->roots[i]);
+    gc_compact_t *c;
+    long r;
+#define UPDATE_MEMBER(member) o->member = compact_update(gc, o->member)
+    while (next_region(gc, &c, &r)) {
+        FOR_LIVE_IN_REGION(c, r, o, {
+            MAKE_WALKER(UPDATE_MEMBER, o);
+            if (c == gc->compact + 1) {
+                uint8_t *to = (uint8_t *)o;
+                if (!c->sweep) {
+                    to = (uint8_t *)compact_forward(c, o);
+                    card_note_object_atomic(gc, to);
+                }
+                if (check_young_refs(gc, o))
+                    __atomic_store_n(
+                        gc->cards + (to - gc->old) / GC_CARD_SIZE, 1,
+                        __ATOMIC_RELAXED);
+            }
+        });
+    }
+#undef UPDATE_MEMBER
+}
+
+static void region_job_slide(gc_t *gc, gc_worker_t *w) {
+    gc_compact_t *c;
+    long r;
+    while (next_region(gc, &c, &r)) {
+        if (c->sweep) continue;
+        for (long j = c->region_wait[r]; j < r; j++)
+            while (!__atomic_load_n(c->region_done + j, __ATOMIC_ACQUIRE))
+                sched_yield();
+        uint8_t *dest = c->region_dest[r];
+        FOR_LIVE_IN_REGION(c, r, o, {
+            size_t size = obj_size(o);
+            if (dest != (uint8_t *)o) memmove(dest, o, size);
+            dest += size;
+        });
+        __atomic_store_n(c->region_done + r, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void gc_run_regions(gc_t *gc, gc_job_t job) {
+    gc->region_next = 0;
+    gc_run(gc, job);
+}
+
+// rebuilds the free lists from the dead objects of the old generation,
+// coalescing neighbours. a free tail goes back to the bump pointer.
+static void old_sweep(gc_t *gc) {
+    gc_compact_t *c = gc->compact + 1;
+    memset(gc->free_lists, 0, sizeof(gc->free_lists));
+    gc->old_free = 0;
+    uint8_t *hole = NULL;
+    for (uint8_t *p = c->start; p < c->end; p += obj_size((obj *)p)) {
+        size_t w = (p - c->start) / GC_ALIGNMENT;
+        if (c->live[w / GC_BLOCK_WORDS] >> w % GC_BLOCK_WORDS & 1) {
+            if (hole) old_free_chunk(gc, hole, p - hole);
+            hole = NULL;
+            card_note_object(gc, p);
+        } else if (!hole) {
+            hole = p;
+        }
+    }
+    if (hole) gc->old_alloc = hole;
+}
+
+// the pointers in live large objects, which stay in place
+static void large_update(gc_t *gc) {
+#define UPDATE_MEMBER(member) o->member = compact_update(gc, o->member)
+    for (gc_large_t *l = gc->large; l; l = l->next) {
+        obj *o = gc_large_obj(l);
+        if (!obj_marked(o)) continue;
+        MAKE_WALKER(UPDATE_MEMBER, o);
+        l->dirty = check_young_refs(gc, o);
+    }
+#undef UPDATE_MEMBER
+}
+
+// unmaps the unmarked large objects and clears the marks of the others
+static void large_sweep(gc_t *gc) {
+    size_t live = 0;
+    for (gc_large_t **u = &gc->large; *u;) {
+        gc_large_t *l = *u;
+        if (obj_marked(gc_large_obj(l))) {
+            obj_set_mark(gc_large_obj(l), 0);
+            l->fresh = 0;
+            live += l->size;
+            u = &l->next;
+        } else {
+            *u = l->next;
+            munmap(l, l->size);
+        }
+    }
+    gc->large_bytes = live;
+    gc->large_limit = live * GC_GROW_RATIO;
+    if (gc->large_limit < (size_t)gc->old_size)
+        gc->large_limit = gc->old_size;
+}
+
+// sums up and clears the census the workers took while marking
+static void census_gather(gc_t *gc) {
+    gc->census = 0;
+    memset(gc->census_count, 0, sizeof(gc->census_count));
+    memset(gc->census_bytes, 0, sizeof(gc->census_bytes));
+    for (int i = 0; i < gc->threads; i++) {
+        gc_worker_t *w = gc->workers + i;
+        for (int k = 0; k < H_TYPES; k++) {
+            gc->census_count[k] += w->census_count[k];
+            gc->census_bytes[k] += w->census_bytes[k];
+        }
+        memset(w->census_count, 0, sizeof(w->census_count));
+        memset(w->census_bytes, 0, sizeof(w->census_bytes));
+    }
+}
+
+void gc_major(gc_t *gc) {
+    tlab_retire_all(gc);
+    long start = stats_begin(gc);
+    size_t used = heap_used(gc);
+    roots_gather(gc);
+    // a full collection supersedes an incremental cycle
+    if (gc->marking) {
+        gc->marking = 0;
+        while (deque_take(&gc->workers->deque))
+            ;
+        for (gc_thread_t *t = gc->mutators; t; t = t->next) t->gray_sp = 0;
+        for (gc_large_t *l = gc->large; l; l = l->next)
+            obj_set_mark(gc_large_obj(l), 0);
+    }
+    gc_compact_t *young = gc->compact, *old = gc->compact + 1;
+    compact_reset(young, gc->young_from, gc->young_alloc);
+    compact_reset(old, gc->old, gc->old_alloc);
+    // the old generation is swept in place unless too much of it is stuck in
+    // holes that tenuring could not reuse
+    young->sweep = 0;
+    old->sweep =
+        gc->old_free * 100 <= gc->old_size * GC_FRAGMENTATION_PERCENT;
+
+    gc->mark_idle = 0;
+    gc->census = gc->sample_bytes != 0;
+    gc_run(gc, mark_job);
+    if (gc->census) census_gather(gc);
+    for (int i = 0; i < gc->threads; i++) {
+        gc_deque_buf_t *a = gc->workers[i].deque.buf;
+        while (a->prev) {
+            gc_deque_buf_t *prev = a->prev;
+            a->prev = prev->prev;
+            free(prev);
+        }
+    }
+
+    // stage 1: compute forwarding addresses
+    gc_run_regions(gc, region_job_sum);
+    compact_plan(young);
+    if (!old->sweep) compact_plan(old);
+    gc_run_regions(gc, region_job_dest);
+
+    // stage 2: update pointers, and rebuild the card table for the new
+    // addresses
+    long cards = gc->old_size / GC_CARD_SIZE;
+    memset(gc->cards, 0, cards);
+    memset(gc->card_first, GC_CARD_NONE, cards);
+    gc_run_regions(gc, region_job_update);
+    large_update(gc);
+    large_sweep(gc);
+
+    // stage 3: slide live objects down, or sweep the old generation
+    gc_run_regions(gc, region_job_slide);
+    gc->young_alloc = young->free;
+    size_t compacted = young->free - young->start;
+    if (old->sweep) {
+        old_sweep(gc);
+    } else {
+        gc->old_alloc = old->free;
+        memset(gc->free_lists, 0, sizeof(gc->free_lists));
+        gc->old_free = 0;
+        compacted += old->free - old->start;
+    }
+
+    // the idle semispace and the freed tail of the old generation are not
+    // touched until the next minor collection or tenuring reaches them
+    gc_decommit(gc->young_to, gc->young_to + gc->young_size);
+    gc_decommit(gc->old_alloc, old->end);
+    gc_update_limit(gc);
+
+    gc_stats_t *s = &gc->stats;
+    gc->young_survived = gc->young_alloc - gc->young_from;
+    long ns = gc_now_ns() - start;
+    s->major_count++;
+    s->major_ns += ns;
+    s->live = heap_used(gc);
+    size_t freed = used > s->live ? used - s->live : 0;
+    s->freed += freed;
+    s->compacted += compacted;
+    if (gc->trace)
+        fprintf(stderr,
+                "gc: major %ld us, %zu live, %zu freed, %zu compacted\n",
+                ns / 1000, s->live, freed, compacted);
+}
+
+// incremental marking traces the old generation in small steps between
+// allocations. it keeps the usual tri-color invariant with a dijkstra
+// insertion barrier: while marking, gc_write_barrier shades the stored value,
+// and objects tenured during the cycle are shaded too. young objects move, so
+// they are not marked; instead the final step treats them as roots, together
+// with the root stack, and then sweeps the old generation.
+void gc_set_incremental(gc_t *gc, long step_kb, long step_us) {
+    gc->step_bytes = step_kb * 1024;
+    gc->step_ns = step_us * 1000;
+}
+
+// shaded objects are buffered per mutator thread, and moved to the marking
+// deque at the next step
+void gc_shade(gc_t *gc, ptr v) {
+    if (!pointer_p(v) || !mark_object(gc, ptr_pointer(v))) return;
+    gc_thread_t *t = gc_current;
+    if (t->gray_sp >= t->gray_size) {
+        t->gray_size *= 2;
+        t->gray = realloc(t->gray, t->gray_size * sizeof(obj *));
+    }
+    t->gray[t->gray_sp++] = ptr_pointer(v);
+}
+
+static void gray_flush(gc_t *gc) {
+    for (gc_thread_t *t = gc->mutators; t; t = t->next) {
+        while (t->gray_sp)
+            deque_push(&gc->workers->deque, t->gray[--t->gray_sp]);
+    }
+}
+
+static void gc_incremental_start(gc_t *gc) {
+    // only the old generation is marked; the bitmap covers all of its
+    // committed size, as tenuring keeps allocating during the cycle
+    compact_reset(gc->compact, NULL, NULL);
+    compact_reset(gc->compact + 1, gc->old, gc->old + gc->old_size);
+    gc->marking = 1;
+    roots_gather(gc);
+    for (long i = 0; i < gc->roots_count; i++) gc_shade(gc, *gc->roots[i]);
+    gc_update_limit(gc);
+}
+
+static void gc_incremental_finish(gc_t *gc) {
+    long start = gc_now_ns();
+    // empty the young generation; the survivors are scanned as roots
+    if (gc_minor(gc)) {
+        gc_major(gc);
+        return;
+    }
+    size_t used = heap_used(gc);
+#define SHADE_MEMBER(member) gc_shade(gc, o->member)
+    do {
+        for (long i = 0; i < gc->roots_count; i++)
+            gc_shade(gc, *gc->roots[i]);
+        for (uint8_t *p = gc->young_from; p < gc->young_alloc;
+             p += obj_size((obj *)p)) {
+            obj *o = (obj *)p;
+            MAKE_WALKER(SHADE_MEMBER, o);
+        }
+        // large objects allocated during the cycle start out marked, and
+        // may have been filled without the barrier
+        for (gc_large_t *l = gc->large; l; l = l->next) {
+            obj *o = gc_large_obj(l);
+            if (l->fresh) MAKE_WALKER(SHADE_MEMBER, o);
+        }
+        gray_flush(gc);
+        mark_drain(gc, gc->workers);
+    } while (!deque_empty(&gc->workers->deque));
+#undef SHADE_MEMBER
+    gc->marking = 0;
+    gc_compact_t *old = gc->compact + 1;
+    old->end = gc->old_alloc;
+    memset(gc->card_first, GC_CARD_NONE, gc->old_size / GC_CARD_SIZE);
+    old_sweep(gc);
+    large_sweep(gc);
+    gc_decommit(gc->old_alloc, gc->old + gc->old_size);
+    gc_update_limit(gc);
+
+    gc_stats_t *s = &gc->stats;
+    long ns = gc_now_ns() - start;
+    s->cycle_count++;
+    s->cycle_ns += ns;
+    s->live = heap_used(gc);
+    size_t freed = used > s->live ? used - s->live : 0;
+    s->freed += freed;
+    if (gc->trace)
+        fprintf(stderr, "gc: cycle %ld us, %zu live, %zu freed\n", ns / 1000,
+                s->live, freed);
+}
+
+// scans gray objects until the byte or time budget is spent, and finishes
+// the cycle when there are none left
+static void gc_step(gc_t *gc) {
+    gc_worker_t *w = gc->workers;
+    gray_flush(gc);
+    long start = gc->step_ns ? gc_now_ns() : 0;
+    size_t scanned = 0;
+    long n = 0;
+#define MARK_MEMBER(member) mark_ptr(gc, w, p->member)
+    for (obj *p; (p = deque_take(&w->deque));) {
+        MAKE_WALKER(MARK_MEMBER, p);
+        scanned += obj_size(p);
+        if (gc->step_bytes && scanned >= (size_t)gc->step_bytes) return;
+        if (gc->step_ns && ++n % 32 == 0 && gc_now_ns() - start >= gc->step_ns)
+            return;
+    }
+#undef MARK_MEMBER
+    gc_incremental_finish(gc);
+}
+
+// the allocation limit is lowered while marking, so that the slow path of
+// gc_alloc runs a marking step every GC_STEP_INTERVAL bytes
+void gc_update_limit(gc_t *gc) {
+    gc->young_limit = gc->young_from + gc->young_size;
+    if (gc->marking && gc->young_alloc + GC_STEP_INTERVAL < gc->young_limit)
+        gc->young_limit = gc->young_alloc + GC_STEP_INTERVAL;
+}
+
+// makes room for size bytes in the young generation, with the world stopped
+static void gc_make_room(gc_t *gc, long size) {
+    if (gc->marking) {
+        gc_step(gc);
+        gc_update_limit(gc);
+        if (gc->young_alloc + size <= gc->young_from + gc->young_size) return;
+    }
+
+    // trigger a minor collection
+    int flag = gc_minor(gc);
+
+    // if needed, trigger a major collection, and grow the heap if the old
+    // generation is still crowded afterwards. with incremental marking
+    // enabled, a cycle starts well before the old generation fills up.
+    size_t used = gc->old_alloc - gc->old - gc->old_free;
+    if (flag) {
+        gc_major(gc);
+        if (gc->old_alloc - gc->old - gc->old_free > gc->old_size / 2)
+            gc_grow(gc);
+    } else if ((gc->step_bytes || gc->step_ns) && !gc->marking &&
+               used * 100 > gc->old_size * GC_INCREMENTAL_START_PERCENT) {
+        gc_incremental_start(gc);
+    }
+
+    while (gc->young_alloc + size > gc->young_from + gc->young_size) {
+        gc_grow(gc);
+    }
+    gc_update_limit(gc);
+}
+
+// mutator threads allocate from private buffers carved out of the young
+// generation, and take the heap lock only to carve a new one. a collection
+// runs on the thread whose buffer could not be refilled, once every other
+// thread has parked at a safepoint: in the allocation slow path, in
+// gc_safepoint, or by detaching.
+
+// parks the calling thread until the collection in progress is over. called
+// with the heap lock held.
+static void safepoint_park(gc_t *gc) {
+    gc->running--;
+    pthread_cond_broadcast(&gc->stopped);
+    while (gc->stop) pthread_cond_wait(&gc->resumed, &gc->lock);
+    gc->running++;
+}
+
+static void world_stop(gc_t *gc) {
+    while (gc->stop) safepoint_park(gc);
+    gc->pause_start = gc_now_ns();
+    __atomic_store_n(&gc->stop, 1, __ATOMIC_RELEASE);
+    while (gc->running > 1) pthread_cond_wait(&gc->stopped, &gc->lock);
+    tlab_retire_all(gc);
+}
+
+static void world_start(gc_t *gc) {
+    gc_stats_t *s = &gc->stats;
+    long ns = gc_now_ns() - gc->pause_start;
+    int k = ns < 1000 ? 0 : 64 - __builtin_clzl(ns / 1000);
+    s->pauses[k < GC_PAUSE_BUCKETS ? k : GC_PAUSE_BUCKETS - 1]++;
+    s->pause_count++;
+    s->pause_ns += ns;
+    if (ns > s->pause_max_ns) s->pause_max_ns = ns;
+    __atomic_store_n(&gc->stop, 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&gc->resumed);
+}
+
+void gc_park(gc_t *gc) {
+    pthread_mutex_lock(&gc->lock);
+    if (gc->stop) safepoint_park(gc);
+    pthread_mutex_unlock(&gc->lock);
+}
+
+static void tlab_refill(gc_thread_t *t, long size) {
+    gc_t *gc = t->gc;
+    pthread_mutex_lock(&gc->lock);
+    while (gc->stop) safepoint_park(gc);
+    tlab_retire(t);
+    if (gc->young_alloc + size > gc->young_limit) {
+        world_stop(gc);
+        gc_make_room(gc, size);
+        world_start(gc);
+    }
+    uint8_t *end = gc->young_alloc + GC_TLAB_SIZE;
+    if (end > gc->young_limit) end = gc->young_limit;
+    if (end < gc->young_alloc + size) end = gc->young_alloc + size;
+    t->tlab_alloc = gc->young_alloc;
+    t->tlab_end = gc->young_alloc = end;
+    pthread_mutex_unlock(&gc->lock);
+}
+
+// the bytes to allocate before the next sample. the intervals are drawn from
+// an exponential distribution with mean sample_bytes, so that samples do not
+// fall in step with the allocations of a loop.
+static long sample_interval(gc_t *gc, gc_thread_t *t) {
+    if (!gc->sample_bytes) return LONG_MAX;
+    t->sample_seed =
+        t->sample_seed * 6364136223846793005u + 1442695040888963407u;
+    // the top 53 bits, as a uniform double in (0, 1]
+    double u = ((t->sample_seed >> 11) + 1) * 0x1p-53;
+    return (long)(-log(u) * gc->sample_bytes) + 1;
+}
+
+gc_thread_t *gc_attach(gc_t *gc) {
+    gc_thread_t *t = malloc(sizeof(gc_thread_t));
+    t->gc = gc;
+    t->tlab_alloc = t->tlab_end = NULL;
+    t->stack = malloc(GC_ROOTS_INITIAL_SIZE * sizeof(ptr *));
+    t->stack_size = GC_ROOTS_INITIAL_SIZE;
+    t->sp = 0;
+    t->gray = malloc(GC_ROOTS_INITIAL_SIZE * sizeof(obj *));
+    t->gray_size = GC_ROOTS_INITIAL_SIZE;
+    t->gray_sp = 0;
+    t->frames = NULL;
+    t->sample_seed = (uintptr_t)t;
+    t->sample_left = sample_interval(gc, t);
+    pthread_mutex_lock(&gc->lock);
+    while (gc->stop) pthread_cond_wait(&gc->resumed, &gc->lock);
+    t->next = gc->mutators;
+    gc->mutators = t;
+    gc->running++;
+    pthread_mutex_unlock(&gc->lock);
+    gc_current = t;
+    return t;
+}
+
+void gc_detach(gc_t *gc) {
+    gc_thread_t *t = gc_current;
+    pthread_mutex_lock(&gc->lock);
+    while (gc->stop) safepoint_park(gc);
+    tlab_retire(t);
+    // objects shaded by this thread must still be traced
+    for (long i = 0; i < t->gray_sp; i++)
+        deque_push(&gc->workers->deque, t->gray[i]);
+    gc_thread_t **u = &gc->mutators;
+    while (*u != t) u = &(*u)->next;
+    *u = t->next;
+    gc->running--;
+    pthread_cond_broadcast(&gc->stopped);
+    pthread_mutex_unlock(&gc->lock);
+    free(t->stack);
+    free(t->gray);
+    free(t);
+    gc_current = NULL;
+}
+
+static ptr large_alloc(gc_t *gc, enum heapvar_type_t type, long size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t bytes = (GC_LARGE_HEADER + size + page - 1) & ~(page - 1);
+    pthread_mutex_lock(&gc->lock);
+    while (gc->stop) safepoint_park(gc);
+    if (gc->large_bytes + bytes > gc->large_limit) {
+        world_stop(gc);
+        gc_major(gc);
+        world_start(gc);
+    }
+    gc_large_t *l = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (l == MAP_FAILED) FATAL("gc: cannot map %zu bytes", bytes);
+    l->size = bytes;
+    // it is filled without the barrier, possibly with young objects
+    l->dirty = 1;
+    // marked until the end of the cycle, when it is scanned as a root
+    l->fresh = gc->marking;
+    l->next = gc->large;
+    gc->large = l;
+    gc->large_bytes += bytes;
+    gc->stats.allocated += bytes;
+    obj *o = gc_large_obj(l);
+    fill_header(o, type, size);
+    o->header |= HDR_LARGE | (gc->marking ? HDR_MARK : 0);
+    pthread_mutex_unlock(&gc->lock);
+    return make_pointer(o);
+}
+
+void gc_set_sampling(gc_t *gc, long sample_bytes, gc_sample_t sample) {
+    gc->sample_bytes = sample_bytes;
+    gc->sample = sample;
+    for (gc_thread_t *t = gc->mutators; t; t = t->next)
+        t->sample_left = sample_interval(gc, t);
+}
+
+// takes the samples due once sample_left has run out, each standing for
+// sample_bytes
+static void alloc_sample(gc_t *gc, gc_thread_t *t, enum heapvar_type_t type,
+                         long size) {
+    if (!gc->sample_bytes) {
+        t->sample_left = LONG_MAX;
+        return;
+    }
+    size_t weight = 0;
+    while (t->sample_left < 0) {
+        t->sample_left += sample_interval(gc, t);
+        weight += gc->sample_bytes;
+    }
+    gc->sample(gc, type, size, weight);
+}
+
+ptr gc_alloc(gc_t *gc, enum heapvar_type_t type, long size) {
+    // leave room for the forwarding pointer
+    if (size < (long)sizeof(obj *)) size = sizeof(obj *);
+    size = ((size - 1) / GC_ALIGNMENT + 1) * GC_ALIGNMENT;
+    size += OBJ_HEADER_SIZE;
+    gc_thread_t *t = gc_current;
+    if ((t->sample_left -= size) < 0) alloc_sample(gc, t, type, size);
+    if (size >= GC_LARGE_SIZE) return large_alloc(gc, type, size);
+
+    if (t->tlab_alloc + size > t->tlab_end) tlab_refill(t, size);
+    ptr p = make_pointer((obj *)t->tlab_alloc);
+    t->tlab_alloc += size;
+    fill_header(ptr_pointer(p), type, size);
+    return p;
+}
+
+// grows the heap by GC_GROW_RATIO. the regions are reserved up front, so this
+// only commits more pages and never moves objects.
+void gc_grow(gc_t *gc) {
+    long young_size = gc->young_size * GC_GROW_RATIO;
+    long old_size = gc->old_size * GC_GROW_RATIO;
+    if (young_size > GC_YOUNG_RESERVE || old_size > GC_OLD_RESERVE)
+        FATAL("gc: heap exhausted");
+    gc_commit(gc->young_from, young_size);
+    gc_commit(gc->young_to, young_size);
+    gc_commit(gc->old, old_size);
+    gc_commit(gc->cards, old_size / GC_CARD_SIZE);
+    gc_commit(gc->card_first, old_size / GC_CARD_SIZE);
+    if (gc->marking) {
+        // extend the mark bitmap of the cycle in progress
+        gc_compact_t *c = gc->compact + 1;
+        size_t bytes = c->blocks * sizeof(uint64_t);
+        uint64_t *live = malloc(bytes);
+        memcpy(live, c->live, bytes);
+        compact_reset(c, gc->old, gc->old + old_size);
+        memcpy(c->live, live, bytes);
+        free(live);
+    }
+    gc->young_size = young_size;
+    gc->old_size = old_size;
+    gc_update_limit(gc);
+    gc->stats.grow_count++;
+    if (gc->trace)
+        fprintf(stderr, "gc: grew to %ld young, %ld old bytes\n", young_size,
+                old_size);
+}
+
+void gc_preserve(gc_t *gc, ptr *p) {
+    gc_thread_t *t = gc_current;
+    if (t->sp >= t->stack_size) {
+        t->stack_size *= 2;
+        t->stack = realloc(t->stack, t->stack_size * sizeof(ptr *));
+    }
+    t->stack[t->sp++] = p;
+}
+
+void gc_release(gc_t *gc, long count) {
+    gc_current->sp -= count;
+}
+
+void gc_stats_report(gc_t *gc, FILE *f) {
+    if (!gc->trace) return;
+    gc_stats_t *s = &gc->stats;
+    fprintf(f, "gc: %ld minor (%ld ms), %ld major (%ld ms), %ld cycles "
+               "(%ld ms), %ld grows\n",
+            s->minor_count, s->minor_ns / 1000000, s->major_count,
+            s->major_ns / 1000000, s->cycle_count, s->cycle_ns / 1000000,
+            s->grow_count);
+    fprintf(f, "gc: %zu allocated, %zu copied, %zu promoted, %zu freed, "
+               "%zu compacted\n",
+            s->allocated, s->copied, s->promoted, s->freed, s->compacted);
+    fprintf(f, "gc: %ld pauses, %ld us total, %ld us max\n", s->pause_count,
+            s->pause_ns / 1000, s->pause_max_ns / 1000);
+    for (int k = 0; k < GC_PAUSE_BUCKETS; k++)
+        if (s->pauses[k])
+            fprintf(f, "gc: %8ld under %ld us\n", s->pauses[k], 1L << k);
+}
+
+#define CHECK_MEMBER(member)                              \
+    do {                                                  \
+        if (pointer_p(p->member) &&                       \
+            (uint8_t *)ptr_pointer(p->member) >= start && \
+            (uint8_t *)ptr_pointer(p->member) < end)      \
+            return 1;                                     \
+    } while (0)
+
+#define COPY_MEMBER(member)                 \
+    do {                                    \
+        p->member = gc_copy(gc, p->member); \
+    } while (0)
+
+static int check_refs_into(obj *p, uint8_t *start, uint8_t *end) {
+    MAKE_WALKER(CHECK_MEMBER, p);
+    return 0;
+}
+
+int check_young_refs(gc_t *gc, obj *p) {
+    return check_refs_into(p, gc->young_from, gc->young_from + gc->young_size);
+}
+void copy_refs(gc_t *gc, obj *p) { MAKE_WALKER(COPY_MEMBER, p); }
+
+int young_pointer_p(gc_t *gc, ptr p) {
+    if (!pointer_p(p)) return 0;
+    ptrdiff_t offset = (uint8_t *)ptr_pointer(p) - gc->young_from;
+    if (offset < 0 || offset >= gc->young_size) return 0;
+    return 1;
+}
+
+// the reader and printer
+
+static int delimiter_p(char_t c) {
+    return c == EOF || c == ' ' || c == '\t' || c == '\n' || c == '\r' ||
+           c == '\f' || c == '(' || c == ')' || c == '"' || c == ';' ||
+           c == '\'';
+}
+
+// skips whitespace and comments; returns the next character, unread
+static char_t skip_space(port_t *port) {
+    for (;;) {
+        char_t c = port_peekc(port);
+        if (c == ';') {
+            while (c != EOF && c != '\n') c = port_getc(port);
+        } else if (c != EOF && delimiter_p(c) && c != '(' && c != ')' &&
+                   c != '"' && c != '\'') {
+            port_getc(port);
+        } else {
+            return c;
+        }
+    }
+}
+
+typedef struct token_t {
+    char_t *s;
+    long n, size;
+} token_t;
+
+static void token_push(token_t *t, char_t c) {
+    if (t->n == t->size) {
+        t->size = t->size ? 2 * t->size : 64;
+        t->s = realloc(t->s, t->size * sizeof(char_t));
+    }
+    t->s[t->n++] = c;
+}
+
+static ptr parse_number(gc_t *gc, const char_t *s, long n);
+
+// parse_number on the token s, copied to buf as ascii
+static ptr parse_number_ascii(gc_t *gc, const char_t *s, const char *buf,
+                              long n) {
+    if (!strcmp(buf, "+inf.0")) return make_flonum(gc, INFINITY);
+    if (!strcmp(buf, "-inf.0")) return make_flonum(gc, -INFINITY);
+    if (!strcmp(buf, "+nan.0") || !strcmp(buf, "-nan.0"))
+        return make_flonum(gc, NAN);
+    long i = buf[0] == '+' || buf[0] == '-', digits = 0;
+    while (buf[i] >= '0' && buf[i] <= '9') i++, digits++;
+    if (buf[i] == 0 && digits) {
+        if (digits <= 18) return make_fixnum(strtoll(buf, NULL, 10));
+        ptr p = bigint_from_string(gc, buf, n, 10);
+        return num_add(gc, p, make_fixnum(0));
+    }
+    if (buf[i] == '/' && digits) {
+        ptr d = parse_number(gc, s + i + 1, n - i - 1);
+        if (!integer_p(d) || buf[i + 1] == '+' || buf[i + 1] == '-')
+            return make_bool(0);
+        GC_LOCALS(l, 1);
+        l[0] = d;
+        ptr q = parse_number(gc, s, i);
+        q = num_div(gc, q, l[0]);
+        GC_UNLOCALS(l);
+        return q;
+    }
+    char *end;
+    double x = strtod(buf, &end);
+    if (*end || !strpbrk(buf, "0123456789") || strpbrk(buf, "xXpP"))
+        return make_bool(0);
+    return make_flonum(gc, x);
+}
+
+// a number, or #f if the token does not spell one
+static ptr parse_number(gc_t *gc, const char_t *s, long n) {
+    // long tokens, such as literals with many digits, get a buffer of their
+    // own
+    char small[64];
+    if (n == 0) return make_bool(0);
+    char *buf = n < (long)sizeof(small) ? small : malloc(n + 1);
+    long i = 0;
+    while (i < n && s[i] < 0x80) buf[i] = s[i], i++;
+    buf[n] = 0;
+    ptr x = i < n ? make_bool(0) : parse_number_ascii(gc, s, buf, n);
+    if (buf != small) free(buf);
+    return x;
+}
+
+static const struct {
+    const char *name;
+    char_t c;
+} char_names[] = {
+    {"space", ' '},  {"newline", '\n'}, {"tab", '\t'},     {"nul", 0},
+    {"return", '\r'}, {"alarm", 7},     {"backspace", 8}, {"delete", 127},
+    {"escape", 27},
+};
+
+static ptr read_char(token_t *t) {
+    if (t->n == 1) return make_char(t->s[0]);
+    for (size_t i = 0; i < sizeof(char_names) / sizeof(char_names[0]); i++) {
+        const char *name = char_names[i].name;
+        long j = 0;
+        while (j < t->n && name[j] && name[j] == t->s[j]) j++;
+        if (j == t->n && !name[j]) return make_char(char_names[i].c);
+    }
+    if (t->s[0] == 'x') {
+        char_t c = 0;
+        for (long j = 1; j < t->n; j++) {
+            int d = t->s[j];
+            d = d >= '0' && d <= '9'   ? d - '0'
+                : d >= 'a' && d <= 'f' ? d - 'a' + 10
+                : d >= 'A' && d <= 'F' ? d - 'A' + 10
+                                       : -1;
+            if (d < 0) FATAL("read: bad character name");
+            c = c * 16 + d;
+        }
+        return make_char(c);
+    }
+    FATAL("read: bad character name");
+}
+
+static ptr read_string(gc_t *gc, port_t *port, token_t *t) {
+    for (;;) {
+        char_t c = port_getc(port);
+        if (c == EOF) FATAL("read: end of file in string");
+        if (c == '"') break;
+        if (c == '\\') {
+            c = port_getc(port);
+            switch (c) {
+                case 'n':
+                    c = '\n';
+                    break;
+                case 't':
+                    c = '\t';
+                    break;
+                case 'r':
+                    c = '\r';
+                    break;
+                case 'a':
+                    c = 7;
+                    break;
+                case '0':
+                    c = 0;
+                    break;
+                case 'x': {
+                    char_t x = 0;
+                    for (c = port_getc(port); c != ';'; c = port_getc(port)) {
+                        int d = c >= '0' && c <= '9'   ? c - '0'
+                                : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                                : c >= 'A' && c <= 'F' ? c - 'A' + 10
+                                                       : -1;
+                        if (d < 0) FATAL("read: bad string escape");
+                        x = x * 16 + d;
+                    }
+                    c = x;
+                    break;
+                }
+                case EOF:
+                    FATAL("read: end of file in string");
+            }
+        }
+        token_push(t, c);
+    }
+    return make_string(gc, t->s, t->n);
+}
+
+static ptr list_to_vector(gc_t *gc, ptr list) {
+    long n = 0;
+    for (ptr p = list; pointer_p(p); p = ptr_pointer(p)->cdr) n++;
+    GC_LOCALS(l, 1);
+    l[0] = list;
+    ptr v = make_vector(gc, n, make_nil());
+    obj *o = ptr_pointer(v);
+    for (long i = 0; i < n; i++, l[0] = ptr_pointer(l[0])->cdr)
+        o->vector[i] = ptr_pointer(l[0])->car;
+    GC_UNLOCALS(l);
+    return v;
+}
+
+// what read_datum returns for the . of a dotted list
+#define READ_DOT make_unbound()
+
+static ptr read_datum(ctx_t *ctx, port_t *port, token_t *t);
+
+// the elements up to the closing parenthesis, the opening one being read
+static ptr read_list(ctx_t *ctx, port_t *port, token_t *t) {
+    gc_t *gc = &ctx->memory;
+    // head, last pair, datum
+    GC_LOCALS(l, 3);
+    l[0] = make_nil();
+    for (;;) {
+        char_t c = skip_space(port);
+        if (c == EOF) FATAL("read: end of file in list");
+        if (c == ')') {
+            port_getc(port);
+            break;
+        }
+        l[2] = read_datum(ctx, port, t);
+        if (eq_p(l[2], READ_DOT)) {
+            if (!pointer_p(l[0])) FATAL("read: bad dotted list");
+            l[2] = read_datum(ctx, port, t);
+            if (eq_p(l[2], READ_DOT) || eq_p(l[2], make_eof()) ||
+                skip_space(port) != ')')
+                FATAL("read: bad dotted list");
+            port_getc(port);
+            GC_STORE(gc, ptr_pointer(l[1]), cdr, l[2]);
+            break;
+        }
+        ptr p = make_pair(gc, l[2], make_nil());
+        if (pointer_p(l[0]))
+            GC_STORE(gc, ptr_pointer(l[1]), cdr, p);
+        else
+            l[0] = p;
+        l[1] = p;
+    }
+    ptr r = l[0];
+    GC_UNLOCALS(l);
+    return r;
+}
+
+static ptr read_datum(ctx_t *ctx, port_t *port, token_t *t) {
+    gc_t *gc = &ctx->memory;
+    char_t c = skip_space(port);
+    if (c == EOF) return make_eof();
+    port_getc(port);
+    t->n = 0;
+    switch (c) {
+        case '(':
+            return read_list(ctx, port, t);
+        case ')':
+            FATAL("read: unexpected ')'");
+        case '"':
+            return read_string(gc, port, t);
+        case '\'': {
+            GC_LOCALS(l, 1);
+            l[0] = read_datum(ctx, port, t);
+            if (eq_p(l[0], make_eof()) || eq_p(l[0], READ_DOT))
+                FATAL("read: bad quotation");
+            l[0] = make_pair(gc, l[0], make_nil());
+            ptr r = make_pair(gc, ctx->syntax[SYNTAX_QUOTE], l[0]);
+            GC_UNLOCALS(l);
+            return r;
+        }
+        case '#':
+            if (port_peekc(port) == '(') {
+                port_getc(port);
+                return list_to_vector(gc, read_list(ctx, port, t));
+            }
+            if (port_peekc(port) == '\\') {
+                port_getc(port);
+                token_push(t, port_getc(port));
+                while (!delimiter_p(port_peekc(port)))
+                    token_push(t, port_getc(port));
+                return read_char(t);
+            }
+            break;
+    }
+    token_push(t, c);
+    while (!delimiter_p(port_peekc(port))) token_push(t, port_getc(port));
+    if (c == '#') {
+        static const char *names[] = {"#t", "#true", "#f", "#false"};
+        for (int i = 0; i < 4; i++) {
+            long j = 0;
+            while (j < t->n && names[i][j] == t->s[j]) j++;
+            if (j == t->n && !names[i][j]) return make_bool(i < 2);
+        }
+        FATAL("read: bad # syntax");
+    }
+    if (t->n == 1 && c == '.') return READ_DOT;
+    ptr x = parse_number(gc, t->s, t->n);
+    if (!bool_p(x)) return x;
+    return obarray_intern_n(&ctx->obarray, t->s, t->n);
+}
+
+ptr ctx_read(ctx_t *ctx, port_t *port) {
+    token_t t = {0};
+    ptr x = read_datum(ctx, port, &t);
+    free(t.s);
+    if (eq_p(x, READ_DOT)) FATAL("read: unexpected '.'");
+    return x;
+}
+
+static void port_puts(port_t *port, const char *s) {
+    while (*s) port_putc(port, (unsigned char)*s++);
+}
+
+// the shortest representation that reads back as x
+static void write_flonum(port_t *port, double x) {
+    char buf[40];
+    if (isnan(x)) {
+        port_puts(port, "+nan.0");
+        return;
+    }
+    if (isinf(x)) {
+        port_puts(port, x > 0 ? "+inf.0" : "-inf.0");
+        return;
+    }
+    int precision = 1;
+    for (; precision < 17; precision++) {
+        snprintf(buf, sizeof(buf), "%.*g", precision, x);
+        if (strtod(buf, NULL) == x) break;
+    }
+    snprintf(buf, sizeof(buf), "%.*g", precision, x);
+    // positional notation for moderate exponents
+    char *e = strchr(buf, 'e');
+    int exponent = e ? atoi(e + 1) : 0;
+    if (e && exponent >= -7 && exponent < 21) {
+        int digits = precision - 1 - exponent;
+        snprintf(buf, sizeof(buf), "%.*f", digits > 0 ? digits : 0, x);
+    }
+    port_puts(port, buf);
+    if (!strpbrk(buf, ".e")) port_puts(port, ".0");
+}
+
+// whether x is written with a leading sign
+static int signed_number_p(ptr x) {
+    if (pointer_p(x) && obj_type(ptr_pointer(x)) == H_FLONUM)
+        return signbit(ptr_flonum(x)) || !isfinite(ptr_flonum(x));
+    return num_compare(x, make_fixnum(0)) < 0;
+}
+
+static void write_number(port_t *port, ptr x) {
+    if (fixnum_p(x)) {
+        char buf[24];
+        snprintf(buf, sizeof(buf), "%lld", (long long)ptr_fixnum(x));
+        port_puts(port, buf);
+        return;
+    }
+    obj *o = ptr_pointer(x);
+    switch (obj_type(o)) {
+        case H_BIGINT: {
+            char *s = bigint_to_string(x, 10);
+            port_puts(port, s);
+            free(s);
+            break;
+        }
+        case H_RATIONAL:
+            write_number(port, o->numerator);
+            port_putc(port, '/');
+            write_number(port, o->denominator);
+            break;
+        case H_FLONUM:
+            write_flonum(port, o->flonum);
+            break;
+        default:
+            write_number(port, o->real);
+            if (!signed_number_p(o->imaginary)) port_putc(port, '+');
+            write_number(port, o->imaginary);
+            port_putc(port, 'i');
+            break;
+    }
+}
+
+static void write_char(port_t *port, char_t c) {
+    port_puts(port, "#\\");
+    for (size_t i = 0; i < sizeof(char_names) / sizeof(char_names[0]); i++)
+        if (char_names[i].c == c) {
+            port_puts(port, char_names[i].name);
+            return;
+        }
+    if (c < 0x20) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "x%x", c);
+        port_puts(port, buf);
+        return;
+    }
+    port_putc(port, c);
+}
+
+static void write_string(port_t *port, ptr s) {
+    port_putc(port, '"');
+    for (long i = 0, n = string_length(s); i < n; i++) {
+        char_t c = string_ref(s, i);
+        switch (c) {
+            case '"':
+            case '\\':
+                port_putc(port, '\\');
+                port_putc(port, c);
+                break;
+            case '\n':
+                port_puts(port, "\\n");
+                break;
+            case '\t':
+                port_puts(port, "\\t");
+                break;
+            case '\r':
+                port_puts(port, "\\r");
+                break;
+            default:
+                if (c < 0x20) {
+                    char buf[16];
+                    snprintf(buf, sizeof(buf), "\\x%x;", c);
+                    port_puts(port, buf);
+                } else {
+                    port_putc(port, c);
+                }
+        }
+    }
+    port_putc(port, '"');
+}
+
+// does not allocate, so x stays put while it is written
+void ctx_write(ctx_t *ctx, port_t *port, ptr x, int display) {
+    switch (PTR_TAG(x)) {
+        case TAG_FIXNUM:
+            write_number(port, x);
+            return;
+        case TAG_SYMBOL: {
+            long n;
+            const char_t *s = obarray_name(&ctx->obarray, x, &n);
+            port_write_string(port, s, n);
+            return;
+        }
+        case TAG_CHARACTER:
+            if (display)
+                port_putc(port, ptr_char(x));
+            else
+                write_char(port, ptr_char(x));
+            return;
+        case TAG_PRIMITIVE:
+            port_puts(port, "#<primitive ");
+            port_puts(port, primitives[ptr_primitive(x)].name);
+            port_putc(port, '>');
+            return;
+        case TAG_BOOLEAN:
+            port_puts(port, ptr_bool(x) ? "#t" : "#f");
+            return;
+        case TAG_SPECIAL:
+            switch (ptr_type(x)) {
+                case T_EOF:
+                    port_puts(port, "#<eof>");
+                    break;
+                case T_NIL:
+                    port_puts(port, "()");
+                    break;
+                case T_VOID:
+                    port_puts(port, "#<void>");
+                    break;
+                default:
+                    port_puts(port, "#<unbound>");
+                    break;
+            }
+            return;
+    }
+    obj *o = ptr_pointer(x);
+    switch (obj_type(o)) {
+        case H_BIGINT:
+        case H_RATIONAL:
+        case H_FLONUM:
+        case H_COMPLEX:
+            write_number(port, x);
+            break;
+        case H_PAIR:
+            port_putc(port, '(');
+            for (;;) {
+                ctx_write(ctx, port, o->car, display);
+                ptr next = o->cdr;
+                if (!pointer_p(next) || obj_type(ptr_pointer(next)) != H_PAIR)
+                    break;
+                port_putc(port, ' ');
+                o = ptr_pointer(o->cdr);
+            }
+            if (!eq_p(o->cdr, make_nil())) {
+                port_puts(port, " . ");
+                ctx_write(ctx, port, o->cdr, display);
+            }
+            port_putc(port, ')');
+            break;
+        case H_VECTOR:
+            port_puts(port, "#(");
+            for (long i = 0; i < o->vector_size; i++) {
+                if (i) port_putc(port, ' ');
+                ctx_write(ctx, port, o->vector[i], display);
+            }
+            port_putc(port, ')');
+            break;
+        case H_F64VECTOR:
+            port_puts(port, "#f64(");
+            for (long i = 0; i < o->f64vector_size; i++) {
+                if (i) port_putc(port, ' ');
+                write_flonum(port, o->f64[i]);
+            }
+            port_putc(port, ')');
+            break;
+        case H_STRING:
+            if (display) {
+                for (long i = 0, n = string_length(x); i < n; i++)
+                    port_putc(port, string_ref(x, i));
+            } else {
+                write_string(port, x);
+            }
+            break;
+        case H_PROCEDURE:
+            port_puts(port, "#<procedure>");
+            break;
+        default:
+            port_puts(port, "#<object>");
+            break;
+    }
+}
+
+// primitives
+
+static ptr intern_ascii(obarray_t *obarray, const char *s) {
+    char_t buf[64];
+    long n = 0;
+    for (; s[n]; n++) buf[n] = (unsigned char)s[n];
+    return obarray_intern_n(obarray, buf, n);
+}
+
+static int heap_p(ptr x, enum heapvar_type_t type) {
+    return pointer_p(x) && obj_type(ptr_pointer(x)) == type;
+}
+
+static ptr prim_add(ctx_t *ctx, ptr *args, long n) {
+    ptr r = make_fixnum(0);
+    for (long i = 0; i < n; i++) r = num_add(&ctx->memory, r, args[i]);
+    return r;
+}
+
+static ptr prim_sub(ctx_t *ctx, ptr *args, long n) {
+    if (n == 1) return num_negate(&ctx->memory, args[0]);
+    ptr r = args[0];
+    for (long i = 1; i < n; i++) r = num_sub(&ctx->memory, r, args[i]);
+    return r;
+}
+
+static ptr prim_mul(ctx_t *ctx, ptr *args, long n) {
+    ptr r = make_fixnum(1);
+    for (long i = 0; i < n; i++) r = num_mul(&ctx->memory, r, args[i]);
+    return r;
+}
+
+static ptr prim_div(ctx_t *ctx, ptr *args, long n) {
+    if (n == 1) return num_div(&ctx->memory, make_fixnum(1), args[0]);
+    ptr r = args[0];
+    for (long i = 1; i < n; i++) r = num_div(&ctx->memory, r, args[i]);
+    return r;
+}
+
+// chained comparisons; a lone argument is still checked to be a number
+#define COMPARISON(name, test)                                    \
+    static ptr name(ctx_t *ctx, ptr *args, long n) {              \
+        for (long i = 0; i + 1 < n; i++)                          \
+            if (!test(args[i], args[i + 1])) return make_bool(0); \
+        if (n == 1) test(args[0], args[0]);                       \
+        return make_bool(1);                                      \
+    }
+COMPARISON(prim_num_eq, num_eq)
+COMPARISON(prim_lt, num_lt)
+COMPARISON(prim_gt, num_gt)
+COMPARISON(prim_le, num_le)
+COMPARISON(prim_ge, num_ge)
+#undef COMPARISON
+
+static ptr prim_quotient(ctx_t *ctx, ptr *args, long n) {
+    return num_quotient(&ctx->memory, args[0], args[1]);
+}
+
+static ptr prim_remainder(ctx_t *ctx, ptr *args, long n) {
+    return num_remainder(&ctx->memory, args[0], args[1]);
+}
+
+static ptr prim_modulo(ctx_t *ctx, ptr *args, long n) {
+    ptr r = num_remainder(&ctx->memory, args[0], args[1]);
+    if (!eq_p(r, make_fixnum(0)) &&
+        num_lt(r, make_fixnum(0)) != num_lt(args[1], make_fixnum(0)))
+        r = num_add(&ctx->memory, r, args[1]);
+    return r;
+}
+
+static ptr prim_number_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(number_p(args[0]));
+}
+
+static ptr prim_integer_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(integer_p(args[0]));
+}
+
+static double num_to_flonum(ptr a);
+
+static ptr prim_inexact(ctx_t *ctx, ptr *args, long n) {
+    if (!number_p(args[0]) || heap_p(args[0], H_COMPLEX))
+        FATAL("inexact: not a real number");
+    return make_flonum(&ctx->memory, num_to_flonum(args[0]));
+}
+
+static ptr prim_cons(ctx_t *ctx, ptr *args, long n) {
+    return make_pair(&ctx->memory, args[0], args[1]);
+}
+
+static ptr prim_car(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_PAIR)) FATAL("car: not a pair");
+    return ptr_pointer(args[0])->car;
+}
+
+static ptr prim_cdr(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_PAIR)) FATAL("cdr: not a pair");
+    return ptr_pointer(args[0])->cdr;
+}
+
+static ptr prim_set_car(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_PAIR)) FATAL("set-car!: not a pair");
+    GC_STORE(&ctx->memory, ptr_pointer(args[0]), car, args[1]);
+    return make_void();
+}
+
+static ptr prim_set_cdr(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_PAIR)) FATAL("set-cdr!: not a pair");
+    GC_STORE(&ctx->memory, ptr_pointer(args[0]), cdr, args[1]);
+    return make_void();
+}
+
+static ptr prim_list(ctx_t *ctx, ptr *args, long n) {
+    ptr r = make_nil();
+    for (long i = n - 1; i >= 0; i--) r = make_pair(&ctx->memory, args[i], r);
+    return r;
+}
+
+static ptr prim_length(ctx_t *ctx, ptr *args, long n) {
+    long length = 0;
+    ptr p = args[0];
+    for (; heap_p(p, H_PAIR); p = ptr_pointer(p)->cdr) length++;
+    if (!eq_p(p, make_nil())) FATAL("length: not a list");
+    return make_fixnum(length);
+}
+
+static ptr prim_pair_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(heap_p(args[0], H_PAIR));
+}
+
+static ptr prim_null_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(eq_p(args[0], make_nil()));
+}
+
+static ptr prim_eq_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(eq_p(args[0], args[1]));
+}
+
+// numbers of one type and value are eqv, eq objects otherwise
+static int eqv_p(ptr a, ptr b) {
+    if (eq_p(a, b)) return 1;
+    if (!pointer_p(a) || !pointer_p(b)) return 0;
+    enum heapvar_type_t t = obj_type(ptr_pointer(a));
+    if (t != obj_type(ptr_pointer(b))) return 0;
+    if (t == H_FLONUM)
+        return ptr_flonum(a) == ptr_flonum(b) &&
+               signbit(ptr_flonum(a)) == signbit(ptr_flonum(b));
+    if (t == H_BIGINT || t == H_RATIONAL || t == H_COMPLEX)
+        return num_eq(a, b);
+    return 0;
+}
+
+static int equal_p(ptr a, ptr b) {
+    while (heap_p(a, H_PAIR) && heap_p(b, H_PAIR)) {
+        if (!equal_p(ptr_pointer(a)->car, ptr_pointer(b)->car)) return 0;
+        a = ptr_pointer(a)->cdr;
+        b = ptr_pointer(b)->cdr;
+    }
+    if (heap_p(a, H_VECTOR) && heap_p(b, H_VECTOR)) {
+        obj *x = ptr_pointer(a), *y = ptr_pointer(b);
+        if (x->vector_size != y->vector_size) return 0;
+        for (long i = 0; i < x->vector_size; i++)
+            if (!equal_p(x->vector[i], y->vector[i])) return 0;
+        return 1;
+    }
+    if (heap_p(a, H_STRING) && heap_p(b, H_STRING))
+        return string_equal_p(a, b);
+    return eqv_p(a, b);
+}
+
+static ptr prim_eqv_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(eqv_p(args[0], args[1]));
+}
+
+static ptr prim_equal_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(equal_p(args[0], args[1]));
+}
+
+static ptr prim_not(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(false_p(args[0]));
+}
+
+static ptr prim_symbol_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(symbol_p(args[0]));
+}
+
+static ptr prim_string_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(heap_p(args[0], H_STRING));
+}
+
+static ptr prim_procedure_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(primitive_p(args[0]) || heap_p(args[0], H_PROCEDURE));
+}
+
+static ptr prim_boolean_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(bool_p(args[0]));
+}
+
+static ptr prim_vector_p(ctx_t *ctx, ptr *args, long n) {
+    return make_bool(heap_p(args[0], H_VECTOR));
+}
+
+static long index_arg(ptr i, long size, const char *who) {
+    if (!fixnum_p(i) || ptr_fixnum(i) < 0 || ptr_fixnum(i) >= size)
+        FATAL("%s: bad index", who);
+    return ptr_fixnum(i);
+}
+
+static long length_arg(ptr n, const char *who) {
+    if (!fixnum_p(n) || ptr_fixnum(n) < 0) FATAL("%s: bad length", who);
+    return ptr_fixnum(n);
+}
+
+static ptr prim_make_vector(ctx_t *ctx, ptr *args, long n) {
+    return make_vector(&ctx->memory, length_arg(args[0], "make-vector"),
+                       n > 1 ? args[1] : make_fixnum(0));
+}
+
+static ptr prim_vector(ctx_t *ctx, ptr *args, long n) {
+    ptr v = make_vector(&ctx->memory, n, make_fixnum(0));
+    for (long i = 0; i < n; i++) ptr_pointer(v)->vector[i] = args[i];
+    return v;
+}
+
+static ptr prim_vector_length(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_VECTOR)) FATAL("vector-length: not a vector");
+    return make_fixnum(ptr_pointer(args[0])->vector_size);
+}
+
+static ptr prim_vector_ref(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_VECTOR)) FATAL("vector-ref: not a vector");
+    obj *v = ptr_pointer(args[0]);
+    return v->vector[index_arg(args[1], v->vector_size, "vector-ref")];
+}
+
+static ptr prim_vector_set(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_VECTOR)) FATAL("vector-set!: not a vector");
+    obj *v = ptr_pointer(args[0]);
+    long i = index_arg(args[1], v->vector_size, "vector-set!");
+    GC_STORE(&ctx->memory, v, vector[i], args[2]);
+    return make_void();
+}
+
+static ptr prim_string_length(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_STRING)) FATAL("string-length: not a string");
+    return make_fixnum(string_length(args[0]));
+}
+
+static ptr prim_string_ref(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_STRING)) FATAL("string-ref: not a string");
+    long i = index_arg(args[1], string_length(args[0]), "string-ref");
+    return make_char(string_ref(args[0], i));
+}
+
+static ptr prim_string_to_symbol(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_STRING)) FATAL("string->symbol: not a string");
+    long k = string_length(args[0]);
+    obj *o = string_chars(args[0]);
+    if (o->header & HDR_STRING_WIDE)
+        return obarray_intern_n(&ctx->obarray, o->string, k);
+    char_t *s = malloc((k + 1) * sizeof(char_t));
+    for (long i = 0; i < k; i++) s[i] = o->string_narrow[i];
+    ptr sym = obarray_intern_n(&ctx->obarray, s, k);
+    free(s);
+    return sym;
+}
+
+// a fresh string, since strings are mutable and the name is not
+static ptr prim_symbol_to_string(ctx_t *ctx, ptr *args, long n) {
+    if (!symbol_p(args[0])) FATAL("symbol->string: not a symbol");
+    long k;
+    const char_t *s = obarray_name(&ctx->obarray, args[0], &k);
+    return make_string(&ctx->memory, s, k);
+}
+
+static double flonum_arg(ptr x, const char *who) {
+    if (!number_p(x) || heap_p(x, H_COMPLEX))
+        FATAL("%s: not a real number", who);
+    return num_to_flonum(x);
+}
+
+static ptr prim_make_f64vector(ctx_t *ctx, ptr *args, long n) {
+    return make_f64vector(&ctx->memory,
+                          length_arg(args[0], "make-f64vector"),
+                          n > 1 ? flonum_arg(args[1], "make-f64vector") : 0);
+}
+
+static ptr prim_f64vector_length(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_F64VECTOR))
+        FATAL("f64vector-length: not an f64vector");
+    return make_fixnum(f64vector_length(args[0]));
+}
+
+static ptr prim_f64vector_ref(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_F64VECTOR))
+        FATAL("f64vector-ref: not an f64vector");
+    long i = index_arg(args[1], f64vector_length(args[0]), "f64vector-ref");
+    return make_flonum(&ctx->memory, f64vector_ref(args[0], i));
+}
+
+static ptr prim_f64vector_set(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_F64VECTOR))
+        FATAL("f64vector-set!: not an f64vector");
+    long i = index_arg(args[1], f64vector_length(args[0]), "f64vector-set!");
+    f64vector_set(args[0], i, flonum_arg(args[2], "f64vector-set!"));
+    return make_void();
+}
+
+static ptr prim_f64vector_dot(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_F64VECTOR) || !heap_p(args[1], H_F64VECTOR))
+        FATAL("f64vector-dot: not an f64vector");
+    return make_flonum(&ctx->memory, f64vector_dot(args[0], args[1]));
+}
+
+static ptr prim_f64vector_sum(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_F64VECTOR))
+        FATAL("f64vector-sum: not an f64vector");
+    return make_flonum(&ctx->memory, f64vector_fold(F64_ADD, args[0], 0));
+}
+
+// the operation a symbol names, or the arithmetic primitive it is, for the
+// bulk f64vector primitives
+static enum f64_op_t f64_op_arg(ctx_t *ctx, ptr x, const char *who) {
+    static const char *names[] = {
+        [F64_ADD] = "+",
+        [F64_SUB] = "-",
+        [F64_MUL] = "*",
+        [F64_DIV] = "/",
+        [F64_MIN] = "min",
+        [F64_MAX] = "max",
+    };
+    for (int op = F64_ADD; op <= F64_MAX; op++) {
+        if (symbol_p(x) && eq_p(x, intern_ascii(&ctx->obarray, names[op])))
+            return op;
+        if (primitive_p(x) &&
+            !strcmp(primitives[ptr_primitive(x)].name, names[op]))
+            return op;
+    }
+    FATAL("%s: not an operation", who);
+}
+
+// (f64vector-map op a b), where b is an f64vector or a real number
+static ptr prim_f64vector_map(ctx_t *ctx, ptr *args, long n) {
+    enum f64_op_t op = f64_op_arg(ctx, args[0], "f64vector-map");
+    if (!heap_p(args[1], H_F64VECTOR))
+        FATAL("f64vector-map: not an f64vector");
+    if (heap_p(args[2], H_F64VECTOR))
+        return f64vector_map(&ctx->memory, op, args[1], args[2]);
+    return f64vector_map_scalar(&ctx->memory, op, args[1],
+                                flonum_arg(args[2], "f64vector-map"));
+}
+
+// (f64vector-fold op x v) is x op v[0] op v[1] ...
+static ptr prim_f64vector_fold(ctx_t *ctx, ptr *args, long n) {
+    enum f64_op_t op = f64_op_arg(ctx, args[0], "f64vector-fold");
+    double x = flonum_arg(args[1], "f64vector-fold");
+    if (!heap_p(args[2], H_F64VECTOR))
+        FATAL("f64vector-fold: not an f64vector");
+    return make_flonum(&ctx->memory, f64vector_fold(op, args[2], x));
+}
+
+static ptr prim_write(ctx_t *ctx, ptr *args, long n) {
+    ctx_write(ctx, &ctx->out, args[0], 0);
+    return make_void();
+}
+
+static ptr prim_display(ctx_t *ctx, ptr *args, long n) {
+    ctx_write(ctx, &ctx->out, args[0], 1);
+    return make_void();
+}
+
+static ptr prim_newline(ctx_t *ctx, ptr *args, long n) {
+    port_putc(&ctx->out, '\n');
+    return make_void();
+}
+
+static ptr prim_dump_heap(ctx_t *ctx, ptr *args, long n) {
+    if (!heap_p(args[0], H_STRING)) FATAL("dump-heap: not a string");
+    char *path;
+    size_t size;
+    FILE *f = open_memstream(&path, &size);
+    for (long i = 0; i < string_length(args[0]); i++)
+        utf8_putc(f, string_ref(args[0], i));
+    fclose(f);
+    ctx_dump_image(ctx, path);
+    free(path);
+    return make_void();
+}
+
+// the collector's statistics, as an association list from symbols to counts
+// plus the pause histogram as a vector
+static ptr prim_gc_stats(ctx_t *ctx, ptr *args, long n) {
+    gc_t *gc = &ctx->memory;
+    gc_stats_t s = gc->stats;
+    const struct {
+        const char *name;
+        long value;
+    } fields[] = {
+        {"minor-collections", s.minor_count},
+        {"major-collections", s.major_count},
+        {"incremental-cycles", s.cycle_count},
+        {"heap-grows", s.grow_count},
+        {"minor-ns", s.minor_ns},
+        {"major-ns", s.major_ns},
+        {"cycle-ns", s.cycle_ns},
+        {"pauses", s.pause_count},
+        {"pause-ns", s.pause_ns},
+        {"max-pause-ns", s.pause_max_ns},
+        {"allocated-bytes", s.allocated},
+        {"copied-bytes", s.copied},
+        {"promoted-bytes", s.promoted},
+        {"remembered", s.remembered},
+        {"remembered-bytes", s.scanned},
+        {"live-bytes", s.live},
+        {"freed-bytes", s.freed},
+        {"compacted-bytes", s.compacted},
+        {"young-size", gc->young_size},
+        {"old-size", gc->old_size},
+        {"large-bytes", gc->large_bytes},
+    };
+    GC_LOCALS(l, 2);
+    l[0] = make_vector(gc, GC_PAUSE_BUCKETS, make_fixnum(0));
+    for (int k = 0; k < GC_PAUSE_BUCKETS; k++)
+        ptr_pointer(l[0])->vector[k] = make_fixnum(s.pauses[k]);
+    l[0] = make_pair(gc, intern_ascii(&ctx->obarray, "pause-histogram"), l[0]);
+    l[0] = make_pair(gc, l[0], make_nil());
+    for (long i = sizeof(fields) / sizeof(fields[0]) - 1; i >= 0; i--) {
+        l[1] = make_pair(gc, intern_ascii(&ctx->obarray, fields[i].name),
+                         make_fixnum(fields[i].value));
+        l[0] = make_pair(gc, l[1], l[0]);
+    }
+    ptr r = l[0];
+    GC_UNLOCALS(l);
+    return r;
+}
+
+const primitive_t primitives[] = {
+    {"+", 0, -1, prim_add},
+    {"-", 1, -1, prim_sub},
+    {"*", 0, -1, prim_mul},
+    {"/", 1, -1, prim_div},
+    {"=", 1, -1, prim_num_eq},
+    {"<", 1, -1, prim_lt},
+    {">", 1, -1, prim_gt},
+    {"<=", 1, -1, prim_le},
+    {">=", 1, -1, prim_ge},
+    {"quotient", 2, 2, prim_quotient},
+    {"remainder", 2, 2, prim_remainder},
+    {"modulo", 2, 2, prim_modulo},
+    {"number?", 1, 1, prim_number_p},
+    {"integer?", 1, 1, prim_integer_p},
+    {"inexact", 1, 1, prim_inexact},
+    {"cons", 2, 2, prim_cons},
+    {"car", 1, 1, prim_car},
+    {"cdr", 1, 1, prim_cdr},
+    {"set-car!", 2, 2, prim_set_car},
+    {"set-cdr!", 2, 2, prim_set_cdr},
+    {"list", 0, -1, prim_list},
+    {"length", 1, 1, prim_length},
+    {"pair?", 1, 1, prim_pair_p},
+    {"null?", 1, 1, prim_null_p},
+    {"eq?", 2, 2, prim_eq_p},
+    {"eqv?", 2, 2, prim_eqv_p},
+    {"equal?", 2, 2, prim_equal_p},
+    {"not", 1, 1, prim_not},
+    {"symbol?", 1, 1, prim_symbol_p},
+    {"string?", 1, 1, prim_string_p},
+    {"procedure?", 1, 1, prim_procedure_p},
+    {"boolean?", 1, 1, prim_boolean_p},
+    {"vector?", 1, 1, prim_vector_p},
+    {"make-vector", 1, 2, prim_make_vector},
+    {"vector", 0, -1, prim_vector},
+    {"vector-length", 1, 1, prim_vector_length},
+    {"vector-ref", 2, 2, prim_vector_ref},
+    {"vector-set!", 3, 3, prim_vector_set},
+    {"string-length", 1, 1, prim_string_length},
+    {"string-ref", 2, 2, prim_string_ref},
+    {"string->symbol", 1, 1, prim_string_to_symbol},
+    {"symbol->string", 1, 1, prim_symbol_to_string},
+    {"make-f64vector", 1, 2, prim_make_f64vector},
+    {"f64vector-length", 1, 1, prim_f64vector_length},
+    {"f64vector-ref", 2, 2, prim_f64vector_ref},
+    {"f64vector-set!", 3, 3, prim_f64vector_set},
+    {"f64vector-dot", 2, 2, prim_f64vector_dot},
+    {"f64vector-sum", 1, 1, prim_f64vector_sum},
+    {"f64vector-map", 3, 3, prim_f64vector_map},
+    {"f64vector-fold", 3, 3, prim_f64vector_fold},
+    {"write", 1, 1, prim_write},
+    {"display", 1, 1, prim_display},
+    {"newline", 0, 0, prim_newline},
+    {"gc-stats", 0, 0, prim_gc_stats},
+    {"dump-heap", 1, 1, prim_dump_heap},
+    {NULL, 0, 0, NULL},
+};
+
+// the compiler. it only reads the expression and allocates nothing until all
+// of it is compiled, so pointers into the expression stay valid throughout.
+// constants are gathered in a table that is rooted while the procedures'
+// code objects are built at the end, inner procedures first.
+
+// the variables of a procedure, in slot order. a scope without variables gets
+// no activation record (frame is 0) and does not count towards the depth.
+typedef struct scope_t {
+    struct scope_t *parent;
+    ptr *names;
+    long count, size;
+    int frame;
+} scope_t;
+
+// a procedure being compiled. operands referring to constants hold their
+// index in the table until the code object is built.
+typedef struct proto_t {
+    instruction *code;
+    long count, size;
+    long depth, max_depth;  // stack slots in use
+    long slot;              // the constant the code object goes into
+    ptr name;               // the code_name of the code object
+} proto_t;
+
+typedef struct compiler_t {
+    ctx_t *ctx;
+    ptr *consts;
+    long consts_count, consts_size;
+    proto_t **protos;  // finished, inner ones first
+    long protos_count, protos_size;
+} compiler_t;
+
+static int pair_p(ptr x) { return heap_p(x, H_PAIR); }
+static ptr car(ptr x) { return ptr_pointer(x)->car; }
+static ptr cdr(ptr x) { return ptr_pointer(x)->cdr; }
+
+// the length of a proper list, or -1
+static long list_length(ptr x) {
+    long n = 0;
+    for (; pair_p(x); x = cdr(x)) n++;
+    return eq_p(x, make_nil()) ? n : -1;
+}
+
+static void fatal_datum(ctx_t *ctx, const char *who, const char *message,
+                        ptr x);
+
+static void syntax_error(compiler_t *c, const char *message, ptr x) {
+    fatal_datum(c->ctx, "compile", message, x);
+}
+
+static void scope_add(scope_t *s, ptr name) {
+    if (s->count == s->size) {
+        s->size = s->size ? 2 * s->size : 8;
+        s->names = realloc(s->names, s->size * sizeof(ptr));
+    }
+    s->names[s->count++] = name;
+}
+
+// the number of activation records enclosing the one of s, whose display
+// comes before the variables
+static long scope_fathers(scope_t *s) {
+    long n = 0;
+    for (s = s->parent; s; s = s->parent) n += s->frame;
+    return n;
+}
+
+// the slots in the activation record of s; 0 if it has none
+static long scope_record_size(scope_t *s) {
+    return s->count ? scope_fathers(s) + s->count : 0;
+}
+
+// finds the innermost binding of a variable and its slot; 0 if it is global
+static int scope_lookup(scope_t *s, ptr name, long *depth, long *index) {
+    for (long d = 0; s; s = s->parent) {
+        for (long i = s->count - 1; i >= 0; i--)
+            if (eq_p(s->names[i], name)) {
+                *depth = d;
+                *index = scope_fathers(s) + i;
+                return 1;
+            }
+        d += s->frame;
+    }
+    return 0;
+}
+
+// whether x is the keyword k, not shadowed by a local variable
+static int keyword_p(compiler_t *c, scope_t *s, ptr x, enum syntax_t k) {
+    long depth, index;
+    return eq_p(x, c->ctx->syntax[k]) && !scope_lookup(s, x, &depth, &index);
+}
+
+static long constant(compiler_t *c, ptr x) {
+    if (c->consts_count == c->consts_size) {
+        c->consts_size = c->consts_size ? 2 * c->consts_size : 16;
+        c->consts = realloc(c->consts, c->consts_size * sizeof(ptr));
+    }
+    c->consts[c->consts_count] = x;
+    return c->consts_count++;
+}
+
+static proto_t *proto_new(compiler_t *c, ptr name) {
+    proto_t *p = calloc(1, sizeof(proto_t));
+    p->slot = constant(c, make_bool(0));
+    p->name = name;
+    return p;
+}
+
+static void proto_finish(compiler_t *c, proto_t *p) {
+    if (c->protos_count == c->protos_size) {
+        c->protos_size = c->protos_size ? 2 * c->protos_size : 8;
+        c->protos = realloc(c->protos, c->protos_size * sizeof(proto_t *));
+    }
+    c->protos[c->protos_count++] = p;
+}
+
+// appends an instruction that changes the stack depth by delta; returns its
+// index
+static long emit(proto_t *p, enum opcode_t op, long delta, ptr a, ptr b,
+                 ptr d) {
+    if (p->count == p->size) {
+        p->size = p->size ? 2 * p->size : 16;
+        p->code = realloc(p->code, p->size * sizeof(instruction));
+    }
+    p->code[p->count] =
+        (instruction){NULL, op, {a, b, d, make_fixnum(0)}};
+    p->depth += delta;
+    if (p->depth > p->max_depth) p->max_depth = p->depth;
+    return p->count++;
+}
+
+static long emit0(proto_t *p, enum opcode_t op, long delta) {
+    return emit(p, op, delta, make_fixnum(0), make_fixnum(0),
+                make_fixnum(0));
+}
+
+static long emit1(proto_t *p, enum opcode_t op, long delta, ptr a) {
+    return emit(p, op, delta, a, make_fixnum(0), make_fixnum(0));
+}
+
+// points a jump (or a frame's return target) at the next instruction
+static void patch(proto_t *p, long at) {
+    p->code[at].operand[0] = make_fixnum(p->count);
+}
+
+static void emit_const(compiler_t *c, proto_t *p, ptr x) {
+    emit1(p, O_CONST, 1, make_fixnum(constant(c, x)));
+}
+
+// values in tail position are returned
+static void finish(proto_t *p, int tail) {
+    if (tail) emit0(p, O_RETURN, -1);
+}
+
+static void compile_expr(compiler_t *c, proto_t *p, scope_t *s, ptr x,
+                         int tail);
+
+static void compile_sequence(compiler_t *c, proto_t *p, scope_t *s, ptr body,
+                             int tail) {
+    if (!pair_p(body)) {
+        emit_const(c, p, make_void());
+        finish(p, tail);
+        return;
+    }
+    for (; pair_p(cdr(body)); body = cdr(body)) {
+        compile_expr(c, p, s, car(body), 0);
+        emit0(p, O_POP, -1);
+    }
+    compile_expr(c, p, s, car(body), tail);
+}
+
+static ptr define_name(compiler_t *c, ptr x) {
+    if (list_length(x) < 2) syntax_error(c, "bad define", x);
+    ptr target = car(cdr(x));
+    if (pair_p(target)) target = car(target);
+    if (!symbol_p(target)) syntax_error(c, "bad define", x);
+    return target;
+}
+
+// the number of definitions at the start of body, adding their names to s
+// if add
+static long body_defines(compiler_t *c, scope_t *s, ptr body, int add) {
+    long n = 0;
+    for (; pair_p(body); body = cdr(body)) {
+        ptr x = car(body);
+        if (!pair_p(x) || !keyword_p(c, s, car(x), SYNTAX_DEFINE)) break;
+        if (add) scope_add(s, define_name(c, x));
+        n++;
+    }
+    return n;
+}
+
+// the body of a procedure whose parameters are already in s
+static void compile_body(compiler_t *c, proto_t *p, scope_t *s, ptr body) {
+    if (!pair_p(body)) syntax_error(c, "empty body", body);
+    body_defines(c, s, body, 1);
+    s->frame = s->count > 0;
+    compile_sequence(c, p, s, body, 1);
+}
+
+// compiles a procedure taking formals, or the variables of let bindings if
+// bindings, and emits its closure into p. name is its code_name.
+static void compile_lambda(compiler_t *c, proto_t *p, scope_t *s, ptr formals,
+                           int bindings, ptr body, ptr name) {
+    scope_t inner = {s, NULL, 0, 0, 0};
+    long required = 0;
+    int rest = 0;
+    ptr f = formals;
+    for (; pair_p(f); f = cdr(f), required++) {
+        ptr name = bindings ? car(car(f)) : car(f);
+        if (!symbol_p(name)) syntax_error(c, "bad parameter", name);
+        scope_add(&inner, name);
+    }
+    if (symbol_p(f) && !bindings) {
+        scope_add(&inner, f);
+        rest = 1;
+    } else if (!eq_p(f, make_nil())) {
+        syntax_error(c, "bad parameter list", formals);
+    }
+    proto_t *q = proto_new(c, name);
+    long entry = emit(q, O_CREATE_ACTIVATION_RECORD, 0, make_fixnum(required),
+                      make_fixnum(rest), make_fixnum(0));
+    compile_body(c, q, &inner, body);
+    q->code[entry].operand[2] = make_fixnum(scope_record_size(&inner));
+    proto_finish(c, q);
+    free(inner.names);
+    emit(p, O_CLOSURE, 1, make_fixnum(q->slot),
+         make_fixnum(constant(c, bindings ? make_nil() : formals)),
+         make_fixnum(0));
+}
+
+// compiles the value of a variable, naming it after the variable if it is a
+// lambda expression
+static void compile_value(compiler_t *c, proto_t *p, scope_t *s, ptr name,
+                          ptr x) {
+    if (pair_p(x) && keyword_p(c, s, car(x), SYNTAX_LAMBDA) &&
+        list_length(x) >= 3)
+        compile_lambda(c, p, s, car(cdr(x)), 0, cdr(cdr(x)), name);
+    else
+        compile_expr(c, p, s, x, 0);
+}
+
+// a non-tail call returns to a frame pushed before the procedure and its
+// arguments; a tail call reuses the caller's
+static long call_begin(proto_t *p, int tail) {
+    return tail ? -1 : emit0(p, O_FRAME, 3);
+}
+
+static void call_end(proto_t *p, long frame, long argc) {
+    if (frame < 0) {
+        emit1(p, O_CALL, -(argc + 1), make_fixnum(argc));
+    } else {
+        emit1(p, O_CALL, -(argc + 1) - 3 + 1, make_fixnum(argc));
+        patch(p, frame);
+    }
+}
+
+static void compile_call(compiler_t *c, proto_t *p, scope_t *s, ptr x,
+                         int tail) {
+    long argc = list_length(x) - 1;
+    if (argc < 0) syntax_error(c, "bad call", x);
+    ptr f = car(x);
+    long depth, index;
+    if (symbol_p(f) && !scope_lookup(s, f, &depth, &index)) {
+        obj *env = ptr_pointer(c->ctx->env);
+        long i = ptr_symbol(f);
+        if (i < env->env_size && primitive_p(env->entry[i])) {
+            for (ptr a = cdr(x); pair_p(a); a = cdr(a))
+                compile_expr(c, p, s, car(a), 0);
+            emit(p, O_PRIMCALL, 1 - argc, f, make_fixnum(argc),
+                 make_fixnum(0));
+            finish(p, tail);
+            return;
+        }
+    }
+    long frame = call_begin(p, tail);
+    for (ptr a = x; pair_p(a); a = cdr(a)) compile_expr(c, p, s, car(a), 0);
+    call_end(p, frame, argc);
+}
+
+static void check_bindings(compiler_t *c, ptr bindings, ptr x) {
+    if (list_length(bindings) < 0) syntax_error(c, "bad bindings", x);
+    for (ptr b = bindings; pair_p(b); b = cdr(b))
+        if (list_length(car(b)) != 2 || !symbol_p(car(car(b))))
+            syntax_error(c, "bad binding", car(b));
+}
+
+// (let ((v e) ...) body) calls (lambda (v ...) body) with the e
+static void compile_let(compiler_t *c, proto_t *p, scope_t *s, ptr x,
+                        int tail) {
+    ptr bindings = car(cdr(x)), body = cdr(cdr(x));
+    check_bindings(c, bindings, x);
+    long frame = call_begin(p, tail);
+    compile_lambda(c, p, s, bindings, 1, body, p->name);
+    for (ptr b = bindings; pair_p(b); b = cdr(b))
+        compile_value(c, p, s, car(car(b)), car(cdr(car(b))));
+    call_end(p, frame, list_length(bindings));
+}
+
+// (let loop ((v e) ...) body) calls a procedure of the v that binds loop to
+// (lambda (v ...) body) in its own record and calls it with the v
+static void compile_named_let(compiler_t *c, proto_t *p, scope_t *s, ptr x,
+                              int tail) {
+    ptr name = car(cdr(x)), bindings = car(cdr(cdr(x)));
+    ptr body = cdr(cdr(cdr(x)));
+    check_bindings(c, bindings, x);
+    long n = list_length(bindings);
+    scope_t inner = {s, NULL, 0, 0, 1};
+    for (ptr b = bindings; pair_p(b); b = cdr(b))
+        scope_add(&inner, car(car(b)));
+    scope_add(&inner, name);
+    proto_t *q = proto_new(c, p->name);
+    long fathers = scope_fathers(&inner);
+    emit(q, O_CREATE_ACTIVATION_RECORD, 0, make_fixnum(n), make_fixnum(0),
+         make_fixnum(scope_record_size(&inner)));
+    compile_lambda(c, q, &inner, bindings, 1, body, name);
+    emit(q, O_STORE, 0, make_fixnum(0), make_fixnum(fathers + n),
+         make_fixnum(0));
+    emit0(q, O_POP, -1);
+    for (long i = 0; i <= n; i++)
+        emit(q, O_LOAD, 1, make_fixnum(0),
+             make_fixnum(fathers + (i == 0 ? n : i - 1)), make_fixnum(0));
+    emit1(q, O_CALL, -(n + 1), make_fixnum(n));
+    proto_finish(c, q);
+    free(inner.names);
+
+    long frame = call_begin(p, tail);
+    emit(p, O_CLOSURE, 1, make_fixnum(q->slot),
+         make_fixnum(constant(c, make_nil())), make_fixnum(0));
+    for (ptr b = bindings; pair_p(b); b = cdr(b))
+        compile_value(c, p, s, car(car(b)), car(cdr(car(b))));
+    call_end(p, frame, n);
+}
+
+// let*, letrec and letrec* call a procedure of no arguments whose record
+// holds the variables, initialized in order. let* brings each variable into
+// scope after its initializer, letrec all of them before the first.
+static void compile_let_star(compiler_t *c, proto_t *p, scope_t *s, ptr x,
+                             int tail, int rec) {
+    ptr bindings = car(cdr(x)), body = cdr(cdr(x));
+    check_bindings(c, bindings, x);
+    if (!pair_p(body)) syntax_error(c, "empty body", x);
+    scope_t inner = {s, NULL, 0, 0, 0};
+    inner.frame = list_length(bindings) + body_defines(c, &inner, body, 0) > 0;
+    if (rec)
+        for (ptr b = bindings; pair_p(b); b = cdr(b))
+            scope_add(&inner, car(car(b)));
+    proto_t *q = proto_new(c, p->name);
+    long entry = emit(q, O_CREATE_ACTIVATION_RECORD, 0, make_fixnum(0),
+                      make_fixnum(0), make_fixnum(0));
+    long i = 0;
+    for (ptr b = bindings; pair_p(b); b = cdr(b), i++) {
+        compile_value(c, q, &inner, car(car(b)), car(cdr(car(b))));
+        if (!rec) scope_add(&inner, car(car(b)));
+        emit(q, O_STORE, 0, make_fixnum(0),
+             make_fixnum(scope_fathers(&inner) + (rec ? i : inner.count - 1)),
+             make_fixnum(0));
+        emit0(q, O_POP, -1);
+    }
+    body_defines(c, &inner, body, 1);
+    compile_sequence(c, q, &inner, body, 1);
+    q->code[entry].operand[2] = make_fixnum(scope_record_size(&inner));
+    proto_finish(c, q);
+    free(inner.names);
+
+    long frame = call_begin(p, tail);
+    emit(p, O_CLOSURE, 1, make_fixnum(q->slot),
+         make_fixnum(constant(c, make_nil())), make_fixnum(0));
+    call_end(p, frame, 0);
+}
+
+// a two-way branch is compiled as the test, branch_test, the consequent,
+// branch_else, the alternative and branch_end
+static long branch_test(proto_t *p) {
+    return emit1(p, O_JUMP_IF_FALSE, -1, make_fixnum(0));
+}
+
+static long branch_else(proto_t *p, long test, int tail) {
+    long join = tail ? -1 : emit1(p, O_JUMP, 0, make_fixnum(0));
+    patch(p, test);
+    // the alternative starts from the depth before the consequent
+    p->depth -= !tail;
+    return join;
+}
+
+static void branch_end(proto_t *p, long join) {
+    if (join >= 0) patch(p, join);
+}
+
+static void compile_if(compiler_t *c, proto_t *p, scope_t *s, ptr x,
+                       int tail) {
+    long n = list_length(x);
+    if (n != 3 && n != 4) syntax_error(c, "bad if", x);
+    compile_expr(c, p, s, car(cdr(x)), 0);
+    long test = branch_test(p);
+    compile_expr(c, p, s, car(cdr(cdr(x))), tail);
+    long join = branch_else(p, test, tail);
+    if (n == 4)
+        compile_expr(c, p, s, car(cdr(cdr(cdr(x)))), tail);
+    else
+        compile_sequence(c, p, s, make_nil(), tail);
+    branch_end(p, join);
+}
+
+// and and or: each value but the last is tested, and kept as the result if
+// it decides it
+static void compile_junction(compiler_t *c, proto_t *p, scope_t *s, ptr x,
+                             int tail, enum opcode_t op, ptr empty) {
+    ptr args = cdr(x);
+    if (list_length(args) < 0) syntax_error(c, "bad syntax", x);
+    if (!pair_p(args)) {
+        emit_const(c, p, empty);
+        finish(p, tail);
+        return;
+    }
+    long n = list_length(args), depth = p->depth;
+    long *jumps = malloc(n * sizeof(long));
+    for (long i = 0; i < n - 1; i++, args = cdr(args)) {
+        compile_expr(c, p, s, car(args), 0);
+        jumps[i] = emit1(p, op, -1, make_fixnum(0));
+    }
+    compile_expr(c, p, s, car(args), tail);
+    for (long i = 0; i < n - 1; i++) patch(p, jumps[i]);
+    free(jumps);
+    if (tail && n > 1) {
+        p->depth = depth + 1;
+        finish(p, tail);
+    }
+}
+
+static void compile_cond(compiler_t *c, proto_t *p, scope_t *s, ptr clauses,
+                         int tail) {
+    if (!pair_p(clauses)) {
+        compile_sequence(c, p, s, clauses, tail);
+        return;
+    }
+    ptr clause = car(clauses);
+    if (list_length(clause) < 1) syntax_error(c, "bad cond clause", clause);
+    ptr test = car(clause), body = cdr(clause);
+    if (keyword_p(c, s, test, SYNTAX_ELSE)) {
+        compile_sequence(c, p, s, body, tail);
+        return;
+    }
+    long depth = p->depth;
+    compile_expr(c, p, s, test, 0);
+    if (!pair_p(body)) {
+        long done = emit1(p, O_JUMP_IF_TRUE_OR_POP, -1, make_fixnum(0));
+        compile_cond(c, p, s, cdr(clauses), tail);
+        patch(p, done);
+        p->depth = depth + 1;
+        finish(p, tail);
+        return;
+    }
+    long branch = branch_test(p);
+    compile_sequence(c, p, s, body, tail);
+    long join = branch_else(p, branch, tail);
+    compile_cond(c, p, s, cdr(clauses), tail);
+    branch_end(p, join);
+}
+
+static void compile_ref(proto_t *p, scope_t *s, ptr name) {
+    long depth, index;
+    if (scope_lookup(s, name, &depth, &index))
+        emit(p, O_LOAD, 1, make_fixnum(depth), make_fixnum(index),
+             make_fixnum(0));
+    else
+        emit1(p, O_GLOBAL, 1, name);
+}
+
+static void compile_define(compiler_t *c, proto_t *p, scope_t *s, ptr x,
+                           int tail) {
+    ptr name = define_name(c, x), target = car(cdr(x));
+    if (pair_p(target))
+        compile_lambda(c, p, s, cdr(target), 0, cdr(cdr(x)), name);
+    else if (list_length(x) == 3)
+        compile_value(c, p, s, name, car(cdr(cdr(x))));
+    else
+        syntax_error(c, "bad define", x);
+    long depth, index;
+    if (!s) {
+        emit1(p, O_DEFINE, 0, name);
+    } else if (scope_lookup(s, name, &depth, &index) && depth == 0 &&
+               s->count) {
+        emit(p, O_STORE, 0, make_fixnum(0), make_fixnum(index),
+             make_fixnum(0));
+    } else {
+        syntax_error(c, "define not at the start of a body", x);
+    }
+    finish(p, tail);
+}
+
+static void compile_set(compiler_t *c, proto_t *p, scope_t *s, ptr x,
+                        int tail) {
+    if (list_length(x) != 3 || !symbol_p(car(cdr(x))))
+        syntax_error(c, "bad set!", x);
+    ptr name = car(cdr(x));
+    compile_expr(c, p, s, car(cdr(cdr(x))), 0);
+    long depth, index;
+    if (scope_lookup(s, name, &depth, &index))
+        emit(p, O_STORE, 0, make_fixnum(depth), make_fixnum(index),
+             make_fixnum(0));
+    else
+        emit1(p, O_SET_GLOBAL, 0, name);
+    finish(p, tail);
+}
+
+static void compile_expr(compiler_t *c, proto_t *p, scope_t *s, ptr x,
+                         int tail) {
+    if (symbol_p(x)) {
+        compile_ref(p, s, x);
+        finish(p, tail);
+        return;
+    }
+    if (!pair_p(x)) {
+        if (eq_p(x, make_nil())) syntax_error(c, "empty combination", x);
+        emit_const(c, p, x);
+        finish(p, tail);
+        return;
+    }
+    ptr head = car(x);
+    long n = list_length(x);
+    if (n < 0) syntax_error(c, "improper combination", x);
+    if (keyword_p(c, s, head, SYNTAX_QUOTE)) {
+        if (n != 2) syntax_error(c, "bad quote", x);
+        emit_const(c, p, car(cdr(x)));
+        finish(p, tail);
+    } else if (keyword_p(c, s, head, SYNTAX_IF)) {
+        compile_if(c, p, s, x, tail);
+    } else if (keyword_p(c, s, head, SYNTAX_DEFINE)) {
+        compile_define(c, p, s, x, tail);
+    } else if (keyword_p(c, s, head, SYNTAX_SET)) {
+        compile_set(c, p, s, x, tail);
+    } else if (keyword_p(c, s, head, SYNTAX_LAMBDA)) {
+        if (n < 3) syntax_error(c, "bad lambda", x);
+        compile_lambda(c, p, s, car(cdr(x)), 0, cdr(cdr(x)), make_bool(0));
+        finish(p, tail);
+    } else if (keyword_p(c, s, head, SYNTAX_BEGIN)) {
+        compile_sequence(c, p, s, cdr(x), tail);
+    } else if (keyword_p(c, s, head, SYNTAX_LET)) {
+        if (n < 3) syntax_error(c, "bad let", x);
+        if (symbol_p(car(cdr(x)))) {
+            if (n < 4) syntax_error(c, "bad let", x);
+            compile_named_let(c, p, s, x, tail);
+        } else {
+            compile_let(c, p, s, x, tail);
+        }
+    } else if (keyword_p(c, s, head, SYNTAX_LET_STAR)) {
+        if (n < 3) syntax_error(c, "bad let*", x);
+        compile_let_star(c, p, s, x, tail, 0);
+    } else if (keyword_p(c, s, head, SYNTAX_LETREC) ||
+               keyword_p(c, s, head, SYNTAX_LETREC_STAR)) {
+        if (n < 3) syntax_error(c, "bad letrec", x);
+        compile_let_star(c, p, s, x, tail, 1);
+    } else if (keyword_p(c, s, head, SYNTAX_COND)) {
+        compile_cond(c, p, s, cdr(x), tail);
+    } else if (keyword_p(c, s, head, SYNTAX_AND)) {
+        compile_junction(c, p, s, x, tail, O_JUMP_IF_FALSE_OR_POP,
+                         make_bool(1));
+    } else if (keyword_p(c, s, head, SYNTAX_OR)) {
+        compile_junction(c, p, s, x, tail, O_JUMP_IF_TRUE_OR_POP,
+                         make_bool(0));
+    } else if (keyword_p(c, s, head, SYNTAX_WHEN) ||
+               keyword_p(c, s, head, SYNTAX_UNLESS)) {
+        if (n < 3) syntax_error(c, "bad when", x);
+        int when = keyword_p(c, s, head, SYNTAX_WHEN);
+        compile_expr(c, p, s, car(cdr(x)), 0);
+        long test = branch_test(p);
+        compile_sequence(c, p, s, when ? cdr(cdr(x)) : make_nil(), tail);
+        long join = branch_else(p, test, tail);
+        compile_sequence(c, p, s, when ? make_nil() : cdr(cdr(x)), tail);
+        branch_end(p, join);
+    } else {
+        compile_call(c, p, s, x, tail);
+    }
+}
+
+static const struct {
+    enum opcode_t fused;
+    int length;
+    enum opcode_t ops[3];
+} fusions[] = {
+    {O_LOAD_LOAD_PRIMCALL, 3, {O_LOAD, O_LOAD, O_PRIMCALL}},
+    {O_LOAD_CONST_PRIMCALL, 3, {O_LOAD, O_CONST, O_PRIMCALL}},
+    {O_LOAD_LOAD, 2, {O_LOAD, O_LOAD}},
+    {O_LOAD_CONST, 2, {O_LOAD, O_CONST}},
+    {O_PRIMCALL_JUMP_IF_FALSE, 2, {O_PRIMCALL, O_JUMP_IF_FALSE}},
+    {O_LOAD_RETURN, 2, {O_LOAD, O_RETURN}},
+};
+
+// replaces the opcodes starting the sequences in fusions, longest first
+static void fuse(instruction *code, long n) {
+    long nfusions = sizeof(fusions) / sizeof(fusions[0]);
+    for (long i = 0; i < n;) {
+        long k = 0, j;
+        for (; k < nfusions; k++) {
+            for (j = 0; j < fusions[k].length && i + j < n; j++)
+                if (code[i + j].opcode != fusions[k].ops[j]) break;
+            if (j == fusions[k].length) break;
+        }
+        if (k < nfusions) {
+            code[i].opcode = fusions[k].fused;
+            i += fusions[k].length;
+        } else {
+            i++;
+        }
+    }
+}
+
+// builds the code objects, inner procedures first so that their closures'
+// operands can refer to them; returns the last one
+static ptr compile_link(compiler_t *c) {
+    gc_t *gc = &c->ctx->memory;
+    gc_frame_t frame;
+    gc_push_frame(&frame, c->consts, c->consts_count);
+    ptr code = make_bool(0);
+    for (long i = 0; i < c->protos_count; i++) {
+        proto_t *p = c->protos[i];
+        code = gc_alloc(gc, H_CODE,
+                        offsetof(obj, instructions) - OBJ_HEADER_SIZE +
+                            p->count * sizeof(instruction));
+        obj *o = ptr_pointer(code);
+        o->code_size = p->count;
+        o->code_stack = p->max_depth;
+        o->code_name = p->name;
+        memcpy(o->instructions, p->code, p->count * sizeof(instruction));
+        for (long j = 0; j < p->count; j++) {
+            instruction *in = &o->instructions[j];
+            if (in->opcode == O_CONST || in->opcode == O_CLOSURE)
+                in->operand[0] = c->consts[ptr_fixnum(in->operand[0])];
+            if (in->opcode == O_CLOSURE)
+                in->operand[1] = c->consts[ptr_fixnum(in->operand[1])];
+        }
+        if (c->ctx->fuse) fuse(o->instructions, o->code_size);
+        c->consts[p->slot] = code;
+        free(p->code);
+        free(p);
+    }
+    gc_pop_frame(&frame);
+    return code;
+}
+
+ptr compile(ctx_t *ctx, ptr x) {
+    compiler_t c = {ctx, NULL, 0, 0, NULL, 0, 0};
+    proto_t *p = proto_new(&c, make_bool(1));
+    compile_expr(&c, p, NULL, x, 1);
+    proto_finish(&c, p);
+    ptr code = compile_link(&c);
+    free(c.consts);
+    free(c.protos);
+    return code;
+}
+
+// the vm. the value stack is malloc'd and registered as a frame of roots
+// whose count is brought up to date before anything that can collect; the
+// code being run and the current activation record are roots too. a call
+// pushes a return frame (code, return index, activation record) below the
+// procedure and its arguments, which the procedure's entry pops; a tail call
+// leaves its caller's frame in place.
+#define VM_STACK_INITIAL_SIZE 1024
+#define VM_FRAME_SIZE 3
+#define VM_PROFILE_PAIRS 20  // reported by vm_profile_report
+#define ALLOC_SAMPLE_BYTES (512 << 10)  // without S3_ALLOC_SAMPLE
+
+// prints "who: message: x" to stderr and aborts
+static void fatal_datum(ctx_t *ctx, const char *who, const char *message,
+                        ptr x) {
+    port_flush(&ctx->out);
+    port_t err;
+    port_open(&err, stderr, 1);
+    port_puts(&err, who);
+    port_puts(&err, ": ");
+    port_puts(&err, message);
+    port_puts(&err, ": ");
+    ctx_write(ctx, &err, x, 0);
+    port_putc(&err, '\n');
+    port_close(&err);
+    abort();
+}
+
+// the activation record depth levels up the display from ar
+static inline obj *vm_display(ptr ar, long depth) {
+    obj *a = ptr_pointer(ar);
+    return depth ? ptr_pointer(a->slot[depth - 1]) : a;
+}
+
+static ptr vm_global(ctx_t *ctx, ptr sym) {
+    obj *env = ptr_pointer(ctx->env);
+    long i = ptr_symbol(sym);
+    if (i >= env->env_size || eq_p(env->entry[i], make_unbound()))
+        fatal_datum(ctx, "vm", "unbound variable", sym);
+    return env->entry[i];
+}
+
+static const primitive_t *vm_primitive(ctx_t *ctx, ptr f, long argc) {
+    const primitive_t *p = &primitives[ptr_primitive(f)];
+    if (argc < p->min_args || (p->max_args >= 0 && argc > p->max_args))
+        fatal_datum(ctx, "vm", "wrong number of arguments to", f);
+    return p;
+}
+
+// fills in the cache of a primitive call after checking the arity; 0 if the
+// global is no longer a primitive
+static int vm_primcall_cache(ctx_t *ctx, instruction *in) {
+    ptr f = vm_global(ctx, in->operand[0]);
+    if (!primitive_p(f)) return 0;
+    vm_primitive(ctx, f, ptr_fixnum(in->operand[1]));
+    in->operand[2] = f;
+    in->operand[3] = ctx->globals_epoch;
+    return 1;
+}
+
+// a primitive call's cache holds the primitive its global was bound to, so
+// only changing a global from or to a primitive invalidates the caches
+static void vm_invalidate(ctx_t *ctx, ptr old, ptr value) {
+    if (!eq_p(old, value) && (primitive_p(old) || primitive_p(value)))
+        ctx->globals_epoch = make_fixnum(ptr_fixnum(ctx->globals_epoch) + 1);
+}
+
+ptr vm_run(ctx_t *ctx, ptr code) {
+    static const void *const labels[O_OPCODE_COUNT] = {
+        [O_JUMP] = &&op_jump,
+        [O_LOAD] = &&op_load,
+        [O_CREATE_ACTIVATION_RECORD] = &&op_create_activation_record,
+        [O_STORE] = &&op_store,
+        [O_CONST] = &&op_const,
+        [O_GLOBAL] = &&op_global,
+        [O_DEFINE] = &&op_define,
+        [O_SET_GLOBAL] = &&op_set_global,
+        [O_JUMP_IF_FALSE] = &&op_jump_if_false,
+        [O_JUMP_IF_FALSE_OR_POP] = &&op_jump_if_false_or_pop,
+        [O_JUMP_IF_TRUE_OR_POP] = &&op_jump_if_true_or_pop,
+        [O_POP] = &&op_pop,
+        [O_CLOSURE] = &&op_closure,
+        [O_FRAME] = &&op_frame,
+        [O_CALL] = &&op_call,
+        [O_PRIMCALL] = &&op_primcall,
+        [O_RETURN] = &&op_return,
+        [O_LOAD_LOAD] = &&op_load_load,
+        [O_LOAD_CONST] = &&op_load_const,
+        [O_LOAD_LOAD_PRIMCALL] = &&op_load_load_primcall,
+        [O_LOAD_CONST_PRIMCALL] = &&op_load_const_primcall,
+        [O_PRIMCALL_JUMP_IF_FALSE] = &&op_primcall_jump_if_false,
+        [O_LOAD_RETURN] = &&op_load_return,
+    };
+    int previous = O_OPCODE_COUNT;
+    gc_t *gc = &ctx->memory;
+    GC_LOCALS(r, 2);  // code, activation record
+    r[0] = code;
+    r[1] = make_bool(0);
+    long size = VM_STACK_INITIAL_SIZE, argc = 0, pc = 0;
+    ptr *outer_code = ctx->vm_code;
+    long *outer_pc = ctx->vm_pc;
+    ctx->vm_code = r;
+    ctx->vm_pc = &pc;
+    ptr *stack = malloc(size * sizeof(ptr)), *sp = stack, value, f;
+    gc_frame_t frame;
+    gc_push_frame(&frame, stack, 0);
+    instruction *base, *ip;
+
+#define SYNC() (frame.count = sp - stack)
+#define SAVE() (SYNC(), pc = ip - base)
+#define RESTORE() (base = ptr_pointer(r[0])->instructions, ip = base + pc)
+#define OPERAND(i) (ip->operand[i])
+#define LOAD(in)                                    \
+    (vm_display(r[1], ptr_fixnum((in)->operand[0])) \
+         ->slot[ptr_fixnum((in)->operand[1])])
+#define NEXT goto *ip->label
+#define JUMP()                              \
+    do {                                    \
+        ip = base + ptr_fixnum(OPERAND(0)); \
+        NEXT;                               \
+    } while (0)
+
+    // returning to a frame without code leaves the loop
+    sp[0] = make_bool(0);
+    sp[1] = make_fixnum(0);
+    sp[2] = make_bool(0);
+    sp += VM_FRAME_SIZE;
+
+enter:
+    SYNC();
+    gc_safepoint(gc);
+    {
+        obj *o = ptr_pointer(r[0]);
+        if (!o->instructions[0].label)
+            for (long i = 0; i < o->code_size; i++)
+                o->instructions[i].label =
+                    ctx->opcode_pairs ? &&op_profile
+                                      : labels[o->instructions[i].opcode];
+        // room for the procedure's values, and for a primitive call turned
+        // into a procedure call
+        long need = (sp - stack) + o->code_stack + VM_FRAME_SIZE + 1;
+        if (need > size) {
+            long depth = sp - stack;
+            size = need > 2 * size ? need : 2 * size;
+            stack = realloc(stack, size * sizeof(ptr));
+            sp = stack + depth;
+            frame.slots = stack;
+        }
+        base = ip = o->instructions;
+    }
+    NEXT;
+
+    // profiled code has every label pointing here
+op_profile:
+    if (previous < O_OPCODE_COUNT)
+        ctx->opcode_pairs[previous * O_OPCODE_COUNT + ip->opcode]++;
+    previous = ip->opcode;
+    goto *labels[ip->opcode];
+
+op_jump:
+    JUMP();
+
+op_load:
+    *sp++ = LOAD(ip);
+    ip++;
+    NEXT;
+
+op_create_activation_record: {
+    long required = ptr_fixnum(OPERAND(0)), n = ptr_fixnum(OPERAND(2));
+    int rest = ptr_fixnum(OPERAND(1)) != 0;
+    ptr *args = sp - argc;
+    if (argc < required || (!rest && argc > required))
+        fatal_datum(ctx, "vm", "wrong number of arguments to", args[-1]);
+    if (n == 0) {
+        r[1] = ptr_pointer(args[-1])->p_env;
+        sp = args - 1;
+        ip++;
+        NEXT;
+    }
+    if (rest) {
+        *sp++ = make_nil();
+        for (long i = argc - 1; i >= required; i--) {
+            SAVE();
+            sp[-1] = make_pair(gc, args[i], sp[-1]);
+        }
+    }
+    SAVE();
+    ptr ar = gc_alloc(gc, H_ACTIVATION_RECORD,
+                      offsetof(obj, slot) - OBJ_HEADER_SIZE + n * sizeof(ptr));
+    RESTORE();
+    obj *a = ptr_pointer(ar);
+    // the display is the parent's extended by the parent
+    ptr parent = ptr_pointer(args[-1])->p_env;
+    long fathers = 0;
+    if (pointer_p(parent)) {
+        obj *p = ptr_pointer(parent);
+        fathers = p->ar_fathers + 1;
+        a->slot[0] = parent;
+        memcpy(a->slot + 1, p->slot, p->ar_fathers * sizeof(ptr));
+    }
+    a->ar_size = n;
+    a->ar_fathers = fathers;
+    ptr *values = a->slot + fathers;
+    for (long i = 0; i < required; i++) values[i] = args[i];
+    for (long i = fathers + required; i < n; i++) a->slot[i] = make_unbound();
+    if (rest) values[required] = sp[-1];
+    r[1] = ar;
+    sp = args - 1;
+    ip++;
+    NEXT;
+}
+
+op_store: {
+    obj *a = vm_display(r[1], ptr_fixnum(OPERAND(0)));
+    GC_STORE(gc, a, slot[ptr_fixnum(OPERAND(1))], sp[-1]);
+    sp[-1] = make_void();
+    ip++;
+    NEXT;
+}
+
+op_const:
+    *sp++ = OPERAND(0);
+    ip++;
+    NEXT;
+
+op_global:
+    *sp++ = vm_global(ctx, OPERAND(0));
+    ip++;
+    NEXT;
+
+op_define:
+    SAVE();
+    define_global(ctx, OPERAND(0), sp[-1]);
+    RESTORE();
+    sp[-1] = make_void();
+    ip++;
+    NEXT;
+
+op_set_global:
+    vm_invalidate(ctx, vm_global(ctx, OPERAND(0)), sp[-1]);
+    GC_STORE(gc, ptr_pointer(ctx->env), entry[ptr_symbol(OPERAND(0))],
+             sp[-1]);
+    sp[-1] = make_void();
+    ip++;
+    NEXT;
+
+op_jump_if_false:
+    if (false_p(*--sp)) JUMP();
+    ip++;
+    NEXT;
+
+op_jump_if_false_or_pop:
+    if (false_p(sp[-1])) JUMP();
+    sp--;
+    ip++;
+    NEXT;
+
+op_jump_if_true_or_pop:
+    if (!false_p(sp[-1])) JUMP();
+    sp--;
+    ip++;
+    NEXT;
+
+op_pop:
+    sp--;
+    ip++;
+    NEXT;
+
+op_closure: {
+    SAVE();
+    ptr p = gc_alloc(gc, H_PROCEDURE, 4 * sizeof(ptr));
+    RESTORE();
+    obj *o = ptr_pointer(p);
+    o->formals = OPERAND(1);
+    o->p_env = r[1];
+    o->body = make_bool(0);
+    o->code = OPERAND(0);
+    *sp++ = p;
+    ip++;
+    NEXT;
+}
+
+op_frame:
+    sp[0] = r[0];
+    sp[1] = OPERAND(0);
+    sp[2] = r[1];
+    sp += VM_FRAME_SIZE;
+    ip++;
+    NEXT;
+
+op_call:
+    argc = ptr_fixnum(OPERAND(0));
+apply:
+    f = sp[-argc - 1];
+    if (pointer_p(f) && obj_type(ptr_pointer(f)) == H_PROCEDURE) {
+        r[0] = ptr_pointer(f)->code;
+        goto enter;
+    }
+    if (!primitive_p(f)) fatal_datum(ctx, "vm", "not a procedure", f);
+    SAVE();
+    value = vm_primitive(ctx, f, argc)->fn(ctx, sp - argc, argc);
+    sp -= argc + 1;
+    goto ret;
+
+op_primcall:
+    argc = ptr_fixnum(OPERAND(1));
+    if (eq_p(OPERAND(3), ctx->globals_epoch) || vm_primcall_cache(ctx, ip)) {
+        SAVE();
+        value = primitives[ptr_primitive(OPERAND(2))].fn(ctx, sp - argc, argc);
+        RESTORE();
+        sp -= argc;
+        *sp++ = value;
+        ip++;
+        NEXT;
+    }
+    // no longer a primitive: make it a call returning to the next
+    // instruction
+primcall_slow:
+    f = vm_global(ctx, OPERAND(0));
+    memmove(sp - argc + VM_FRAME_SIZE + 1, sp - argc, argc * sizeof(ptr));
+    sp -= argc;
+    sp[0] = r[0];
+    sp[1] = make_fixnum(ip - base + 1);
+    sp[2] = r[1];
+    sp[3] = f;
+    sp += VM_FRAME_SIZE + 1 + argc;
+    goto apply;
+
+op_load_load:
+    sp[0] = LOAD(ip);
+    sp[1] = LOAD(ip + 1);
+    sp += 2;
+    ip += 2;
+    NEXT;
+
+op_load_const:
+    sp[0] = LOAD(ip);
+    sp[1] = ip[1].operand[0];
+    sp += 2;
+    ip += 2;
+    NEXT;
+
+op_load_load_primcall:
+    sp[0] = LOAD(ip);
+    sp[1] = LOAD(ip + 1);
+    sp += 2;
+    ip += 2;
+    goto op_primcall;
+
+op_load_const_primcall:
+    sp[0] = LOAD(ip);
+    sp[1] = ip[1].operand[0];
+    sp += 2;
+    ip += 2;
+    goto op_primcall;
+
+op_primcall_jump_if_false:
+    argc = ptr_fixnum(OPERAND(1));
+    if (!eq_p(OPERAND(3), ctx->globals_epoch) && !vm_primcall_cache(ctx, ip))
+        goto primcall_slow;
+    SAVE();
+    value = primitives[ptr_primitive(OPERAND(2))].fn(ctx, sp - argc, argc);
+    RESTORE();
+    sp -= argc;
+    ip++;
+    if (false_p(value)) JUMP();
+    ip++;
+    NEXT;
+
+op_load_return:
+    value = LOAD(ip);
+    goto ret;
+
+op_return:
+    value = *--sp;
+ret:
+    sp -= VM_FRAME_SIZE;
+    r[0] = sp[0];
+    pc = ptr_fixnum(sp[1]);
+    r[1] = sp[2];
+    if (false_p(r[0])) {
+        ctx->vm_code = outer_code;
+        ctx->vm_pc = outer_pc;
+        gc_pop_frame(&frame);
+        free(stack);
+        GC_UNLOCALS(r);
+        return value;
+    }
+    *sp++ = value;
+    RESTORE();
+    NEXT;
+
+#undef SYNC
+#undef SAVE
+#undef RESTORE
+#undef OPERAND
+#undef LOAD
+#undef NEXT
+#undef JUMP
+}
+
+void define_global(ctx_t *ctx, ptr sym, ptr value) {
+    long i = ptr_symbol(sym);
+    if (i >= ptr_pointer(ctx->env)->env_size) {
+        GC_LOCALS(l, 1);
+        l[0] = value;
+        long n = ptr_pointer(ctx->env)->env_size;
+        long size = i + 1 > 2 * n ? i + 1 : 2 * n;
+        ptr env = gc_alloc(&ctx->memory, H_ENVIRONMENT,
+                           offsetof(obj, entry) - OBJ_HEADER_SIZE +
+                               size * sizeof(ptr));
+        obj *o = ptr_pointer(env), *old = ptr_pointer(ctx->env);
+        o->env_size = size;
+        memcpy(o->entry, old->entry, n * sizeof(ptr));
+        for (long j = n; j < size; j++) o->entry[j] = make_unbound();
+        ctx->env = env;
+        value = l[0];
+        GC_UNLOCALS(l);
+    }
+    vm_invalidate(ctx, ptr_pointer(ctx->env)->entry[i], value);
+    GC_STORE(&ctx->memory, ptr_pointer(ctx->env), entry[i], value);
+}
+
+static uint64_t alloc_site_hash(alloc_site_t *a) {
+    uint64_t h = a->name.bits;
+    h = h * 31 + a->primitive.bits;
+    h = h * 31 + a->pc;
+    return (h * 31 + a->type) * 0x9e3779b97f4a7c15ull;
+}
+
+// the entry of the site like key in ctx's table, or the empty one for it
+static alloc_site_t *alloc_site_find(ctx_t *ctx, alloc_site_t *key) {
+    uint64_t mask = ctx->alloc_sites_size - 1;
+    for (uint64_t i = alloc_site_hash(key);; i++) {
+        alloc_site_t *a = ctx->alloc_sites + (i & mask);
+        if (!a->samples ||
+            (eq_p(a->name, key->name) && eq_p(a->primitive, key->primitive) &&
+             a->pc == key->pc && a->type == key->type))
+            return a;
+    }
+}
+
+// the sample hook: counts the allocation at the vm's current instruction
+static void alloc_sample_site(gc_t *gc, enum heapvar_type_t type, long size,
+                              size_t weight) {
+    ctx_t *ctx = (ctx_t *)((char *)gc - offsetof(ctx_t, memory));
+    alloc_site_t key = {make_bool(0), make_bool(0), -1, type, 0, 0};
+    if (ctx->vm_code) {
+        obj *code = ptr_pointer(*ctx->vm_code);
+        key.name = code->code_name;
+        key.pc = *ctx->vm_pc;
+        instruction *in = &code->instructions[key.pc];
+        if (key.pc < code->code_size &&
+            (in->opcode == O_PRIMCALL ||
+             in->opcode == O_PRIMCALL_JUMP_IF_FALSE))
+            key.primitive = in->operand[0];
+    }
+    pthread_mutex_lock(&ctx->alloc_sites_lock);
+    if (2 * (ctx->alloc_sites_count + 1) > ctx->alloc_sites_size) {
+        alloc_site_t *old = ctx->alloc_sites;
+        long n = ctx->alloc_sites_size;
+        ctx->alloc_sites_size = n ? 2 * n : 256;
+        ctx->alloc_sites = calloc(ctx->alloc_sites_size, sizeof(alloc_site_t));
+        for (long i = 0; i < n; i++)
+            if (old[i].samples) *alloc_site_find(ctx, old + i) = old[i];
+        free(old);
+    }
+    alloc_site_t *a = alloc_site_find(ctx, &key);
+    if (!a->samples) {
+        *a = key;
+        ctx->alloc_sites_count++;
+    }
+    a->samples++;
+    a->bytes += weight;
+    pthread_mutex_unlock(&ctx->alloc_sites_lock);
+}
+
+// everything but the global environment
+static void ctx_setup(ctx_t *ctx) {
+    static const char *const keywords[SYNTAX_COUNT] = {
+        [SYNTAX_QUOTE] = "quote",       [SYNTAX_IF] = "if",
+        [SYNTAX_DEFINE] = "define",     [SYNTAX_SET] = "set!",
+        [SYNTAX_LAMBDA] = "lambda",     [SYNTAX_BEGIN] = "begin",
+        [SYNTAX_LET] = "let",           [SYNTAX_LET_STAR] = "let*",
+        [SYNTAX_LETREC] = "letrec",     [SYNTAX_LETREC_STAR] = "letrec*",
+        [SYNTAX_COND] = "cond",         [SYNTAX_ELSE] = "else",
+        [SYNTAX_AND] = "and",           [SYNTAX_OR] = "or",
+        [SYNTAX_WHEN] = "when",         [SYNTAX_UNLESS] = "unless",
+    };
+    gc_init(&ctx->memory);
+    obarray_init(&ctx->obarray);
+    for (int k = 0; k < SYNTAX_COUNT; k++)
+        ctx->syntax[k] = intern_ascii(&ctx->obarray, keywords[k]);
+    port_open(&ctx->in, stdin, 0);
+    port_open(&ctx->out, stdout, 1);
+    ctx->opcode_pairs =
+        getenv("S3_VM_PROFILE")
+            ? calloc(O_OPCODE_COUNT * O_OPCODE_COUNT, sizeof(uint64_t))
+            : NULL;
+    // operands start out as fixnum 0, never a valid epoch
+    ctx->globals_epoch = make_fixnum(1);
+    const char *fuse = getenv("S3_VM_FUSE");
+    ctx->fuse = fuse ? atoi(fuse) : 1;
+    ctx->vm_code = NULL;
+    ctx->vm_pc = NULL;
+    ctx->alloc_profile = getenv("S3_ALLOC_PROFILE");
+    ctx->alloc_sites = NULL;
+    ctx->alloc_sites_count = ctx->alloc_sites_size = 0;
+    pthread_mutex_init(&ctx->alloc_sites_lock, NULL);
+    if (ctx->alloc_profile) {
+        const char *sample = getenv("S3_ALLOC_SAMPLE");
+        long bytes = sample ? atol(sample) : ALLOC_SAMPLE_BYTES;
+        gc_set_sampling(&ctx->memory, bytes > 0 ? bytes : ALLOC_SAMPLE_BYTES,
+                        alloc_sample_site);
+    }
+}
+
+// heap images. dumping runs a major collection and writes the young and old
+// generations and every large object as they are, after a header, the
+// sections' addresses, and the names of the symbols in index order. loading
+// maps the generations into the old generation of a fresh heap and each large
+// object into a mapping of its own, then relocates every pointer in one pass
+// with the moves from the sections' addresses to their new places, and clears
+// the code objects' labels so the vm threads them again.
+#define IMAGE_MAGIC 0x31676d6933737300ull  // "\0ss3img1"
+
+typedef struct image_header_t {
+    uint64_t magic;
+    long primitives;  // the image is only valid for the same table
+    long page;
+    long sections, symbols;
+    ptr env, globals_epoch;
+} image_header_t;
+
+// the old generation, then the young one right after it in the file, then
+// the large objects
+typedef struct image_section_t {
+    uint8_t *from;
+    size_t size, offset;
+} image_section_t;
+
+static long primitives_count() {
+    long n = 0;
+    while (primitives[n].name) n++;
+    return n;
+}
+
+static void image_write(FILE *f, const void *p, size_t size) {
+    if (fwrite(p, 1, size, f) != size) FATAL("dump-heap: write failed");
+}
+
+static void image_pad(FILE *f, size_t offset) {
+    static const uint8_t zero[256];
+    for (long n = offset - ftell(f); n > 0; n -= sizeof(zero))
+        image_write(f, zero, n < (long)sizeof(zero) ? n : sizeof(zero));
+}
+
+void ctx_dump_image(ctx_t *ctx, const char *path) {
+    // a loaded image maps its file, so the new one is written beside it and
+    // renamed over it rather than truncating it
+    size_t n = strlen(path);
+    char *tmp = malloc(n + sizeof(".tmp"));
+    memcpy(tmp, path, n);
+    memcpy(tmp + n, ".tmp", sizeof(".tmp"));
+    FILE *f = fopen(tmp, "wb");
+    if (!f) FATAL("dump-heap: can't open %s", tmp);
+    gc_t *gc = &ctx->memory;
+    pthread_mutex_lock(&gc->lock);
+    world_stop(gc);
+    gc_major(gc);
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    image_header_t h = {IMAGE_MAGIC, primitives_count(), page, 2,
+                        ctx->obarray.count, ctx->env, ctx->globals_epoch};
+    for (gc_large_t *l = gc->large; l; l = l->next) h.sections++;
+    image_section_t *sections = malloc(h.sections * sizeof(image_section_t));
+    sections[0] = (image_section_t){gc->old, gc->old_alloc - gc->old, 0};
+    sections[1] =
+        (image_section_t){gc->young_from, gc->young_alloc - gc->young_from, 0};
+    long i = 2;
+    for (gc_large_t *l = gc->large; l; l = l->next, i++)
+        sections[i] = (image_section_t){(uint8_t *)gc_large_obj(l),
+                                        obj_size(gc_large_obj(l)), 0};
+
+    // the generations start on a page, and so do the mappings the large
+    // objects go in
+    size_t offset = sizeof(h) + h.sections * sizeof(image_section_t);
+    for (long k = 1; k <= h.symbols; k++)
+        offset += sizeof(long) + ctx->obarray.names[k]->length * sizeof(char_t);
+    offset = (offset + page - 1) & ~(page - 1);
+    sections[0].offset = offset;
+    sections[1].offset = offset + sections[0].size;
+    offset = sections[1].offset + sections[1].size;
+    for (i = 2; i < h.sections; i++) {
+        offset = (offset + page - 1) & ~(page - 1);
+        sections[i].offset = offset + GC_LARGE_HEADER;
+        offset = sections[i].offset + sections[i].size;
+    }
+
+    image_write(f, &h, sizeof(h));
+    image_write(f, sections, h.sections * sizeof(image_section_t));
+    for (long k = 1; k <= h.symbols; k++) {
+        obarray_node_t *u = ctx->obarray.names[k];
+        image_write(f, &u->length, sizeof(long));
+        image_write(f, u->s, u->length * sizeof(char_t));
+    }
+    for (i = 0; i < h.sections; i++) {
+        image_pad(f, sections[i].offset);
+        image_write(f, sections[i].from, sections[i].size);
+    }
+    world_start(gc);
+    pthread_mutex_unlock(&gc->lock);
+    free(sections);
+    if (fclose(f)) FATAL("dump-heap: write failed");
+    if (rename(tmp, path)) FATAL("dump-heap: can't rename %s", tmp);
+    free(tmp);
+}
+
+// the moves of the sections, sorted by their old addresses
+typedef struct image_moves_t {
+    ptr_move_transform_t *moves;
+    long count;
+} image_moves_t;
+
+static int move_compare(const void *a, const void *b) {
+    uint8_t *x = ((const ptr_move_transform_t *)a)->from;
+    uint8_t *y = ((const ptr_move_transform_t *)b)->from;
+    return x < y ? -1 : x > y;
+}
+
+static ptr image_relocate(image_moves_t *m, ptr x) {
+    if (!pointer_p(x)) return x;
+    uint8_t *p = (uint8_t *)ptr_pointer(x);
+    long lo = 0, hi = m->count;
+    while (hi - lo > 1) {
+        long mid = (lo + hi) / 2;
+        if (m->moves[mid].from <= p)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    ptr_move_transform_t t = m->moves[lo];
+    if (p < t.from || p >= t.from + t.size) FATAL("image: bad pointer");
+    return make_pointer((obj *)apply_transform(t, p));
+}
+
+static void image_fixup(image_moves_t *m, obj *o) {
+#define RELOCATE_MEMBER(member) o->member = image_relocate(m, o->member)
+    MAKE_WALKER(RELOCATE_MEMBER, o);
+#undef RELOCATE_MEMBER
+    if (obj_type(o) == H_CODE)
+        for (long i = 0; i < o->code_size; i++)
+            o->instructions[i].label = NULL;
+}
+
+static void image_read(int fd, void *p, size_t size, size_t offset) {
+    if (pread(fd, p, size, offset) != (ssize_t)size)
+        FATAL("image: truncated file");
+}
+
+void ctx_init_image(ctx_t *ctx, const char *path) {
+    ctx_setup(ctx);
+    gc_t *gc = &ctx->memory;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) FATAL("image: can't open %s", path);
+    image_header_t h;
+    image_read(fd, &h, sizeof(h), 0);
+    if (h.magic != IMAGE_MAGIC) FATAL("image: %s is not an image", path);
+    if (h.primitives != primitives_count() || h.page != sysconf(_SC_PAGESIZE))
+        FATAL("image: %s was dumped by another build", path);
+    image_section_t *sections = malloc(h.sections * sizeof(image_section_t));
+    size_t offset = sizeof(h);
+    image_read(fd, sections, h.sections * sizeof(image_section_t), offset);
+    offset += h.sections * sizeof(image_section_t);
+
+    // interning the names in order gives them back their indices
+    char_t *name = NULL;
+    for (long k = 1; k <= h.symbols; k++) {
+        long n;
+        image_read(fd, &n, sizeof(long), offset);
+        name = realloc(name, (n + 1) * sizeof(char_t));
+        image_read(fd, name, n * sizeof(char_t), offset + sizeof(long));
+        offset += sizeof(long) + n * sizeof(char_t);
+        if (ptr_symbol(obarray_intern_n(&ctx->obarray, name, n)) != k)
+            FATAL("image: %s has conflicting symbols", path);
+    }
+    free(name);
+
+    size_t heap = sections[0].size + sections[1].size;
+    while (heap > (size_t)gc->old_size / 2) gc_grow(gc);
+    if (heap &&
+        mmap(gc->old, heap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             fd, sections[0].offset) == MAP_FAILED)
+        FATAL("image: cannot map %s", path);
+    gc->old_alloc = gc->old + heap;
+
+    image_moves_t m = {malloc(h.sections * sizeof(ptr_move_transform_t)),
+                       h.sections};
+    m.moves[0] = make_transform(sections[0].from, gc->old, sections[0].size);
+    m.moves[1] = make_transform(sections[1].from, gc->old + sections[0].size,
+                                sections[1].size);
+    size_t page = h.page;
+    for (long i = 2; i < h.sections; i++) {
+        size_t bytes =
+            (GC_LARGE_HEADER + sections[i].size + page - 1) & ~(page - 1);
+        gc_large_t *l =
+            mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                 sections[i].offset - GC_LARGE_HEADER);
+        if (l == MAP_FAILED) FATAL("image: cannot map %s", path);
+        *l = (gc_large_t){gc->large, bytes, 0, 0};
+        gc->large = l;
+        gc->large_bytes += bytes;
+        m.moves[i] = make_transform(sections[i].from,
+                                    (uint8_t *)gc_large_obj(l),
+                                    sections[i].size);
+    }
+    close(fd);
+    qsort(m.moves, m.count, sizeof(ptr_move_transform_t), move_compare);
+
+    for (uint8_t *p = gc->old; p < gc->old_alloc;) {
+        obj *o = (obj *)p;
+        size_t size = obj_size(o);
+        if (obj_type(o) == H_FREE) {
+            old_free_chunk(gc, p, size);
+        } else {
+            card_note_object(gc, p);
+            image_fixup(&m, o);
+        }
+        p += size;
+    }
+    for (gc_large_t *l = gc->large; l; l = l->next)
+        image_fixup(&m, gc_large_obj(l));
+    gc->large_limit = gc->large_bytes * GC_GROW_RATIO;
+    if (gc->large_limit < (size_t)gc->old_size)
+        gc->large_limit = gc->old_size;
+
+    ctx->env = image_relocate(&m, h.env);
+    ctx->globals_epoch = h.globals_epoch;
+    gc_preserve(gc, &ctx->env);
+    free(m.moves);
+    free(sections);
+}
+
+void ctx_init(ctx_t *ctx) {
+    ctx_setup(ctx);
+    long size = 256;
+    ctx->env = gc_alloc(&ctx->memory, H_ENVIRONMENT,
+                        offsetof(obj, entry) - OBJ_HEADER_SIZE +
+                            size * sizeof(ptr));
+    obj *env = ptr_pointer(ctx->env);
+    env->env_size = size;
+    for (long i = 0; i < size; i++) env->entry[i] = make_unbound();
+    gc_preserve(&ctx->memory, &ctx->env);
+    for (int i = 0; primitives[i].name; i++)
+        define_global(ctx, intern_ascii(&ctx->obarray, primitives[i].name),
+                      make_primitive(i));
+}
+
+static const char *const opcode_names[O_OPCODE_COUNT] = {
+    [O_JUMP] = "jump",
+    [O_LOAD] = "load",
+    [O_CREATE_ACTIVATION_RECORD] = "create-activation-record",
+    [O_STORE] = "store",
+    [O_CONST] = "const",
+    [O_GLOBAL] = "global",
+    [O_DEFINE] = "define",
+    [O_SET_GLOBAL] = "set-global",
+    [O_JUMP_IF_FALSE] = "jump-if-false",
+    [O_JUMP_IF_FALSE_OR_POP] = "jump-if-false-or-pop",
+    [O_JUMP_IF_TRUE_OR_POP] = "jump-if-true-or-pop",
+    [O_POP] = "pop",
+    [O_CLOSURE] = "closure",
+    [O_FRAME] = "frame",
+    [O_CALL] = "call",
+    [O_PRIMCALL] = "primcall",
+    [O_RETURN] = "return",
+    [O_LOAD_LOAD] = "load+load",
+    [O_LOAD_CONST] = "load+const",
+    [O_LOAD_LOAD_PRIMCALL] = "load+load+primcall",
+    [O_LOAD_CONST_PRIMCALL] = "load+const+primcall",
+    [O_PRIMCALL_JUMP_IF_FALSE] = "primcall+jump-if-false",
+    [O_LOAD_RETURN] = "load+return",
+};
+
+static int pair_count_compare(const void *a, const void *b) {
+    uint64_t x = **(uint64_t *const *)a, y = **(uint64_t *const *)b;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void vm_profile_report(ctx_t *ctx, FILE *f) {
+    if (!ctx->opcode_pairs) return;
+    long n = O_OPCODE_COUNT * O_OPCODE_COUNT;
+    uint64_t **sorted = malloc(n * sizeof(uint64_t *)), total = 0;
+    for (long i = 0; i < n; i++) {
+        sorted[i] = ctx->opcode_pairs + i;
+        total += ctx->opcode_pairs[i];
+    }
+    qsort(sorted, n, sizeof(uint64_t *), pair_count_compare);
+    fprintf(f, "vm: %llu opcode pairs\n", (unsigned long long)total);
+    for (long i = 0; i < VM_PROFILE_PAIRS && i < n && *sorted[i]; i++) {
+        long k = sorted[i] - ctx->opcode_pairs;
+        fprintf(f, "%6.2f%% %12llu  %s %s\n", 100.0 * *sorted[i] / total,
+                (unsigned long long)*sorted[i],
+                opcode_names[k / O_OPCODE_COUNT],
+                opcode_names[k % O_OPCODE_COUNT]);
+    }
+    free(sorted);
+}
+
+static const char *const type_names[H_TYPES] = {
+    [H_BIGINT] = "bigint",
+    [H_FLONUM] = "flonum",
+    [H_RATIONAL] = "rational",
+    [H_COMPLEX] = "complex",
+    [H_PAIR] = "pair",
+    [H_VECTOR] = "vector",
+    [H_BYTEVECTOR] = "bytevector",
+    [H_F64VECTOR] = "f64vector",
+    [H_STRING] = "string",
+    [H_ENVIRONMENT] = "environment",
+    [H_ACTIVATION_RECORD] = "activation-record",
+    [H_PROCEDURE] = "procedure",
+    [H_MACRO] = "macro",
+    [H_TRANSFORMER] = "transformer",
+    [H_STRUCT] = "struct",
+    [H_CODE] = "code",
+    [H_FREE] = "free",
+};
+
+// the frame of a site's code: toplevel, a procedure's name, or lambda
+static void alloc_site_frame(ctx_t *ctx, port_t *port, alloc_site_t *a) {
+    if (symbol_p(a->name))
+        ctx_write(ctx, port, a->name, 1);
+    else
+        port_puts(port, eq_p(a->name, make_bool(1)) ? "toplevel" : "lambda");
+}
+
+void alloc_profile_report(ctx_t *ctx, FILE *f) {
+    if (!ctx->alloc_profile) return;
+    FILE *out = fopen(ctx->alloc_profile, "w");
+    if (!out) FATAL("can't open %s", ctx->alloc_profile);
+    port_t port;
+    port_open(&port, out, 1);
+    pthread_mutex_lock(&ctx->alloc_sites_lock);
+    for (long i = 0; i < ctx->alloc_sites_size; i++) {
+        alloc_site_t *a = ctx->alloc_sites + i;
+        if (!a->samples) continue;
+        char buf[32];
+        if (a->pc < 0) {
+            port_puts(&port, "runtime");
+        } else {
+            alloc_site_frame(ctx, &port, a);
+            port_putc(&port, ';');
+            alloc_site_frame(ctx, &port, a);
+            snprintf(buf, sizeof(buf), "+%ld", a->pc);
+            port_puts(&port, buf);
+            if (symbol_p(a->primitive)) {
+                port_puts(&port, " (");
+                ctx_write(ctx, &port, a->primitive, 1);
+                port_putc(&port, ')');
+            }
+        }
+        port_putc(&port, ';');
+        port_puts(&port, type_names[a->type]);
+        snprintf(buf, sizeof(buf), " %zu\n", a->bytes);
+        port_puts(&port, buf);
+    }
+    pthread_mutex_unlock(&ctx->alloc_sites_lock);
+    port_close(&port);
+    fclose(out);
+
+    gc_t *gc = &ctx->memory;
+    for (int k = 0; k < H_TYPES; k++)
+        if (gc->census_count[k])
+            fprintf(f, "alloc: %10zu %-18s %12zu bytes live\n",
+                    gc->census_count[k], type_names[k], gc->census_bytes[k]);
+}
+
+ptr eval(ctx_t *ctx, ptr x) { return vm_run(ctx, compile(ctx, x)); }
+
+// the ahead-of-time compiler. it parses the program into a tree with the
+// local variables resolved, finds the variables each procedure closes over,
+// and writes each procedure and each toplevel expression as a C function
+// taking its closure and its arguments. a function keeps its variables in
+// local roots: the closure in slot 0, the parameters, and then the other
+// variables and the temporaries as a stack. closures are flat, copying the
+// values of their free variables into a vector; captured variables that can
+// change after the capture, the assigned ones and those of letrec, are boxed.
+// calls to procedures bound by a letrec or a toplevel define and never
+// assigned are direct C calls, and self tail calls jumps; calls to primitives
+// call their function or are expanded inline, and other calls go through
+// aot_call. quoted data and closures without free variables are static
+// objects, the symbols being interned in index order at startup.
+#define AOT_EXPR_SIZE 512
+#define AOT_STACK_SIZE ((size_t)1 << 30)  // of the thread running a program
+
+enum aot_kind_t {
+    A_CONST,
+    A_REF,
+    A_GLOBAL,
+    A_SET,
+    A_SET_GLOBAL,
+    A_DEFINE,
+    A_IF,
+    A_SEQ,
+    A_AND,
+    A_OR,
+    A_LAMBDA,
+    A_CALL,
+    A_LET,     // kids[i] -> vars[i], then the body, kids[count]
+    A_LETREC,  // the same, with the vars in scope in the kids
+};
+
+struct aot_lambda_t;
+
+// a local variable. known is the procedure a letrec binds it to; calls
+// through it are direct unless it is assigned.
+typedef struct aot_var_t {
+    ptr name;
+    struct aot_lambda_t *owner, *known;
+    int assigned, captured, letrec;
+    long slot;
+} aot_var_t;
+
+typedef struct aot_node_t {
+    enum aot_kind_t kind;
+    ptr value;  // of a constant, or the symbol of a global
+    aot_var_t *var, **vars;
+    struct aot_lambda_t *lambda;
+    struct aot_node_t **kids;
+    long count;  // of the kids, or the bindings of a let
+} aot_node_t;
+
+// a procedure, or a toplevel expression if parent is NULL. self is the
+// variable of slot 0, holding the closure. the body is generated into code,
+// depth being the slots in use.
+typedef struct aot_lambda_t {
+    long id;
+    char cname[48];
+    struct aot_lambda_t *parent;
+    aot_var_t *self, **params, **free;
+    long required, free_count, free_size;
+    int rest;
+    int top;  // whether a self tail call jumps back to the top
+    aot_node_t *body;
+    FILE *code;
+    char *text;
+    size_t length;
+    long depth, max_depth, indent;
+} aot_lambda_t;
+
+// how the program uses a global. it has a slot in the globals array if it
+// defines or assigns it, known being the procedure of its last definition.
+typedef struct aot_global_t {
+    long index, defines;
+    int assigned;
+    aot_lambda_t *known;
+} aot_global_t;
+
+typedef struct aot_scope_t {
+    struct aot_scope_t *parent;
+    aot_var_t **vars;
+    long count, size;
+} aot_scope_t;
+
+typedef struct aot_t {
+    ctx_t *ctx;
+    aot_global_t *globals;  // by symbol index
+    long *global_symbols;   // by slot
+    long globals_count, globals_size;
+    aot_lambda_t **lambdas;
+    long lambdas_count, lambdas_size;
+    obj **consts;  // the static objects
+    long consts_count, consts_size;
+    void **blocks;  // everything allocated, to be freed at the end
+    long blocks_count, blocks_size;
+} aot_t;
+
+static void aot_error(aot_t *a, const char *message, ptr x) {
+    fatal_datum(a->ctx, "compile", message, x);
+}
+
+static void *aot_alloc(aot_t *a, size_t size) {
+    if (a->blocks_count == a->blocks_size) {
+        a->blocks_size = a->blocks_size ? 2 * a->blocks_size : 64;
+        a->blocks = realloc(a->blocks, a->blocks_size * sizeof(void *));
+    }
+    return a->blocks[a->blocks_count++] = calloc(1, size);
+}
+
+// a node with room for count kids and a body
+static aot_node_t *aot_node(aot_t *a, enum aot_kind_t kind, long count) {
+    aot_node_t *x = aot_alloc(a, sizeof(aot_node_t));
+    x->kind = kind;
+    x->count = count;
+    x->kids = aot_alloc(a, (count + 1) * sizeof(aot_node_t *));
+    return x;
+}
+
+static aot_node_t *aot_const(aot_t *a, ptr value) {
+    aot_node_t *x = aot_node(a, A_CONST, 0);
+    x->value = value;
+    return x;
+}
+
+// a variable of l, brought into scope s unless it is NULL
+static aot_var_t *aot_var(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                          ptr name) {
+    if (!symbol_p(name)) aot_error(a, "bad parameter", name);
+    aot_var_t *v = aot_alloc(a, sizeof(aot_var_t));
+    v->name = name;
+    v->owner = l;
+    if (s) {
+        if (s->count == s->size) {
+            s->size = s->size ? 2 * s->size : 8;
+            s->vars = realloc(s->vars, s->size * sizeof(aot_var_t *));
+        }
+        s->vars[s->count++] = v;
+    }
+    return v;
+}
+
+static aot_var_t *aot_lookup(aot_scope_t *s, ptr name) {
+    for (; s; s = s->parent)
+        for (long i = s->count - 1; i >= 0; i--)
+            if (eq_p(s->vars[i]->name, name)) return s->vars[i];
+    return NULL;
+}
+
+static int aot_keyword_p(aot_t *a, aot_scope_t *s, ptr x, enum syntax_t k) {
+    return eq_p(x, a->ctx->syntax[k]) && !aot_lookup(s, x);
+}
+
+// the global of a symbol, given a slot if bind
+static aot_global_t *aot_global(aot_t *a, ptr sym, int bind) {
+    aot_global_t *g = &a->globals[ptr_symbol(sym)];
+    if (bind && g->index < 0) {
+        if (a->globals_count == a->globals_size) {
+            a->globals_size = a->globals_size ? 2 * a->globals_size : 64;
+            a->global_symbols =
+                realloc(a->global_symbols, a->globals_size * sizeof(long));
+        }
+        a->global_symbols[a->globals_count] = ptr_symbol(sym);
+        g->index = a->globals_count++;
+    }
+    return g;
+}
+
+// a procedure named name (a symbol, #f if anonymous, #t for toplevel code)
+static aot_lambda_t *aot_lambda(aot_t *a, aot_lambda_t *parent, ptr name) {
+    aot_lambda_t *l = aot_alloc(a, sizeof(aot_lambda_t));
+    if (a->lambdas_count == a->lambdas_size) {
+        a->lambdas_size = a->lambdas_size ? 2 * a->lambdas_size : 64;
+        a->lambdas =
+            realloc(a->lambdas, a->lambdas_size * sizeof(aot_lambda_t *));
+    }
+    l->id = a->lambdas_count;
+    a->lambdas[a->lambdas_count++] = l;
+    l->parent = parent;
+    l->self = aot_var(a, l, NULL, make_symbol(0));
+    l->self->known = l;
+    // the c name is the id and what can be kept of the name
+    int n = snprintf(l->cname, sizeof(l->cname), "f%ld", l->id);
+    if (symbol_p(name)) {
+        long length;
+        const char_t *s = obarray_name(&a->ctx->obarray, name, &length);
+        l->cname[n++] = '_';
+        for (long i = 0; i < length && n < (int)sizeof(l->cname) - 1; i++)
+            l->cname[n++] = (uint32_t)s[i] < 0x80 && isalnum(s[i]) ? s[i] : '_';
+        l->cname[n] = 0;
+    } else if (eq_p(name, make_bool(1))) {
+        strcat(l->cname, "_toplevel");
+    }
+    return l;
+}
+
+static aot_node_t *aot_expr(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                            ptr x);
+
+static aot_node_t *aot_sequence(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                                ptr body) {
+    long n = list_length(body);
+    if (n <= 0) return aot_const(a, make_void());
+    if (n == 1) return aot_expr(a, l, s, car(body));
+    aot_node_t *x = aot_node(a, A_SEQ, n);
+    for (long i = 0; i < n; i++, body = cdr(body))
+        x->kids[i] = aot_expr(a, l, s, car(body));
+    return x;
+}
+
+static aot_node_t *aot_body(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                            ptr body);
+
+// a procedure taking formals, or the variables of let bindings if bindings
+static aot_node_t *aot_lambda_expr(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                                   ptr formals, int bindings, ptr body,
+                                   ptr name) {
+    aot_lambda_t *m = aot_lambda(a, l, name);
+    aot_scope_t inner = {s, NULL, 0, 0};
+    ptr f = formals;
+    long n = 0;
+    for (; pair_p(f); f = cdr(f)) n++;
+    m->params = aot_alloc(a, (n + 1) * sizeof(aot_var_t *));
+    for (f = formals; pair_p(f); f = cdr(f))
+        m->params[m->required++] =
+            aot_var(a, m, &inner, bindings ? car(car(f)) : car(f));
+    if (symbol_p(f) && !bindings) {
+        m->params[m->required] = aot_var(a, m, &inner, f);
+        m->rest = 1;
+    } else if (!eq_p(f, make_nil())) {
+        aot_error(a, "bad parameter list", formals);
+    }
+    m->body = aot_body(a, m, &inner, body);
+    free(inner.vars);
+    aot_node_t *x = aot_node(a, A_LAMBDA, 0);
+    x->lambda = m;
+    return x;
+}
+
+// the value of a variable, naming it after the variable if it is a lambda
+// expression
+static aot_node_t *aot_value(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                             ptr name, ptr x) {
+    if (pair_p(x) && aot_keyword_p(a, s, car(x), SYNTAX_LAMBDA) &&
+        list_length(x) >= 3)
+        return aot_lambda_expr(a, l, s, car(cdr(x)), 0, cdr(cdr(x)), name);
+    return aot_expr(a, l, s, x);
+}
+
+static ptr aot_define_name(aot_t *a, ptr x) {
+    if (list_length(x) < 2) aot_error(a, "bad define", x);
+    ptr target = car(cdr(x));
+    if (pair_p(target)) target = car(target);
+    if (!symbol_p(target)) aot_error(a, "bad define", x);
+    return target;
+}
+
+static aot_node_t *aot_define_value(aot_t *a, aot_lambda_t *l,
+                                    aot_scope_t *s, ptr x) {
+    ptr name = aot_define_name(a, x), target = car(cdr(x));
+    if (pair_p(target))
+        return aot_lambda_expr(a, l, s, cdr(target), 0, cdr(cdr(x)), name);
+    if (list_length(x) != 3) aot_error(a, "bad define", x);
+    return aot_value(a, l, s, name, car(cdr(cdr(x))));
+}
+
+// binds the variables of a letrec node to their values, which are known
+// procedures if they are lambda expressions
+static void aot_letrec_known(aot_node_t *x) {
+    for (long i = 0; i < x->count; i++) {
+        x->vars[i]->letrec = 1;
+        if (x->kids[i]->kind == A_LAMBDA)
+            x->vars[i]->known = x->kids[i]->lambda;
+    }
+}
+
+// the definitions at the start of a body bind variables of s, as letrec*
+static aot_node_t *aot_body(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                            ptr body) {
+    if (!pair_p(body)) aot_error(a, "empty body", body);
+    long n = 0;
+    ptr b = body;
+    for (; pair_p(b); b = cdr(b), n++)
+        if (!pair_p(car(b)) ||
+            !aot_keyword_p(a, s, car(car(b)), SYNTAX_DEFINE))
+            break;
+    if (n == 0) return aot_sequence(a, l, s, body);
+    aot_node_t *x = aot_node(a, A_LETREC, n);
+    x->vars = aot_alloc(a, n * sizeof(aot_var_t *));
+    b = body;
+    for (long i = 0; i < n; i++, b = cdr(b))
+        x->vars[i] = aot_var(a, l, s, aot_define_name(a, car(b)));
+    b = body;
+    for (long i = 0; i < n; i++, b = cdr(b))
+        x->kids[i] = aot_define_value(a, l, s, car(b));
+    x->kids[n] = aot_sequence(a, l, s, b);
+    aot_letrec_known(x);
+    return x;
+}
+
+static void aot_check_bindings(aot_t *a, ptr bindings, ptr x) {
+    if (list_length(bindings) < 0) aot_error(a, "bad bindings", x);
+    for (ptr b = bindings; pair_p(b); b = cdr(b))
+        if (list_length(car(b)) != 2 || !symbol_p(car(car(b))))
+            aot_error(a, "bad binding", car(b));
+}
+
+static aot_node_t *aot_let(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                           ptr x) {
+    ptr bindings = car(cdr(x)), body = cdr(cdr(x));
+    aot_check_bindings(a, bindings, x);
+    long n = list_length(bindings), i = 0;
+    aot_scope_t inner = {s, NULL, 0, 0};
+    aot_node_t *y = aot_node(a, A_LET, n);
+    y->vars = aot_alloc(a, n * sizeof(aot_var_t *));
+    for (ptr b = bindings; pair_p(b); b = cdr(b), i++) {
+        y->kids[i] = aot_value(a, l, s, car(car(b)), car(cdr(car(b))));
+        y->vars[i] = aot_var(a, l, &inner, car(car(b)));
+    }
+    y->kids[n] = aot_body(a, l, &inner, body);
+    free(inner.vars);
+    return y;
+}
+
+// (let loop ((v e) ...) body) binds loop to (lambda (v ...) body) by letrec
+// and calls it with the e, which are outside its scope
+static aot_node_t *aot_named_let(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                                 ptr x) {
+    ptr name = car(cdr(x)), bindings = car(cdr(cdr(x)));
+    ptr body = cdr(cdr(cdr(x)));
+    aot_check_bindings(a, bindings, x);
+    long n = list_length(bindings);
+    aot_scope_t inner = {s, NULL, 0, 0};
+    aot_node_t *y = aot_node(a, A_LETREC, 1);
+    aot_node_t *call = aot_node(a, A_CALL, n + 1);
+    y->vars = aot_alloc(a, sizeof(aot_var_t *));
+    y->vars[0] = aot_var(a, l, &inner, name);
+    y->kids[0] = aot_lambda_expr(a, l, &inner, bindings, 1, body, name);
+    call->kids[0] = aot_node(a, A_REF, 0);
+    call->kids[0]->var = y->vars[0];
+    long i = 1;
+    for (ptr b = bindings; pair_p(b); b = cdr(b), i++)
+        call->kids[i] = aot_value(a, l, s, car(car(b)), car(cdr(car(b))));
+    y->kids[1] = call;
+    aot_letrec_known(y);
+    free(inner.vars);
+    return y;
+}
+
+static aot_node_t *aot_let_star(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                                ptr bindings, ptr body) {
+    aot_scope_t inner = {s, NULL, 0, 0};
+    aot_node_t *x;
+    if (!pair_p(bindings)) {
+        x = aot_body(a, l, &inner, body);
+    } else {
+        ptr b = car(bindings);
+        x = aot_node(a, A_LET, 1);
+        x->vars = aot_alloc(a, sizeof(aot_var_t *));
+        x->kids[0] = aot_value(a, l, s, car(b), car(cdr(b)));
+        x->vars[0] = aot_var(a, l, &inner, car(b));
+        x->kids[1] = aot_let_star(a, l, &inner, cdr(bindings), body);
+    }
+    free(inner.vars);
+    return x;
+}
+
+static aot_node_t *aot_letrec(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                              ptr x) {
+    ptr bindings = car(cdr(x)), body = cdr(cdr(x));
+    aot_check_bindings(a, bindings, x);
+    long n = list_length(bindings), i = 0;
+    aot_scope_t inner = {s, NULL, 0, 0};
+    aot_node_t *y = aot_node(a, A_LETREC, n);
+    y->vars = aot_alloc(a, n * sizeof(aot_var_t *));
+    for (ptr b = bindings; pair_p(b); b = cdr(b), i++)
+        y->vars[i] = aot_var(a, l, &inner, car(car(b)));
+    i = 0;
+    for (ptr b = bindings; pair_p(b); b = cdr(b), i++)
+        y->kids[i] = aot_value(a, l, &inner, car(car(b)), car(cdr(car(b))));
+    y->kids[n] = aot_body(a, l, &inner, body);
+    aot_letrec_known(y);
+    free(inner.vars);
+    return y;
+}
+
+static aot_node_t *aot_if(aot_t *a, aot_node_t *test, aot_node_t *then,
+                          aot_node_t *otherwise) {
+    aot_node_t *x = aot_node(a, A_IF, 3);
+    x->kids[0] = test;
+    x->kids[1] = then;
+    x->kids[2] = otherwise;
+    return x;
+}
+
+static aot_node_t *aot_cond(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                            ptr clauses) {
+    if (!pair_p(clauses)) return aot_const(a, make_void());
+    ptr clause = car(clauses);
+    if (list_length(clause) < 1) aot_error(a, "bad cond clause", clause);
+    ptr test = car(clause), body = cdr(clause);
+    if (aot_keyword_p(a, s, test, SYNTAX_ELSE))
+        return aot_sequence(a, l, s, body);
+    aot_node_t *t = aot_expr(a, l, s, test);
+    if (!pair_p(body)) {
+        aot_node_t *x = aot_node(a, A_OR, 2);
+        x->kids[0] = t;
+        x->kids[1] = aot_cond(a, l, s, cdr(clauses));
+        return x;
+    }
+    return aot_if(a, t, aot_sequence(a, l, s, body),
+                  aot_cond(a, l, s, cdr(clauses)));
+}
+
+static aot_node_t *aot_define(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                              ptr x) {
+    ptr name = aot_define_name(a, x);
+    aot_node_t *y;
+    if (!s) {
+        aot_global_t *g = aot_global(a, name, 1);
+        y = aot_node(a, A_DEFINE, 1);
+        y->value = name;
+        y->kids[0] = aot_define_value(a, l, s, x);
+        g->defines++;
+        g->known = y->kids[0]->kind == A_LAMBDA ? y->kids[0]->lambda : NULL;
+        return y;
+    }
+    // past the start of a body, a definition of a variable of the same
+    // procedure assigns it, as in the vm
+    aot_var_t *v = aot_lookup(s, name);
+    if (!v || v->owner != l)
+        aot_error(a, "define not at the start of a body", x);
+    y = aot_node(a, A_SET, 1);
+    y->var = v;
+    y->kids[0] = aot_define_value(a, l, s, x);
+    v->assigned = 1;
+    return y;
+}
+
+static aot_node_t *aot_set(aot_t *a, aot_lambda_t *l, aot_scope_t *s, ptr x) {
+    if (list_length(x) != 3 || !symbol_p(car(cdr(x))))
+        aot_error(a, "bad set!", x);
+    ptr name = car(cdr(x));
+    aot_var_t *v = aot_lookup(s, name);
+    aot_node_t *y = aot_node(a, v ? A_SET : A_SET_GLOBAL, 1);
+    y->kids[0] = aot_expr(a, l, s, car(cdr(cdr(x))));
+    if (v) {
+        y->var = v;
+        v->assigned = 1;
+    } else {
+        y->value = name;
+        aot_global(a, name, 1)->assigned = 1;
+    }
+    return y;
+}
+
+// the expressions of a list as the kids of a node
+static aot_node_t *aot_list(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                            enum aot_kind_t kind, ptr list) {
+    long n = list_length(list);
+    aot_node_t *x = aot_node(a, kind, n);
+    for (long i = 0; i < n; i++, list = cdr(list))
+        x->kids[i] = aot_expr(a, l, s, car(list));
+    return x;
+}
+
+static aot_node_t *aot_expr(aot_t *a, aot_lambda_t *l, aot_scope_t *s,
+                            ptr x) {
+    if (symbol_p(x)) {
+        aot_var_t *v = aot_lookup(s, x);
+        aot_node_t *y = aot_node(a, v ? A_REF : A_GLOBAL, 0);
+        y->var = v;
+        y->value = x;
+        return y;
+    }
+    if (!pair_p(x)) {
+        if (eq_p(x, make_nil())) aot_error(a, "empty combination", x);
+        return aot_const(a, x);
+    }
+    ptr head = car(x);
+    long n = list_length(x);
+    if (n < 0) aot_error(a, "improper combination", x);
+    if (aot_keyword_p(a, s, head, SYNTAX_QUOTE)) {
+        if (n != 2) aot_error(a, "bad quote", x);
+        return aot_const(a, car(cdr(x)));
+    } else if (aot_keyword_p(a, s, head, SYNTAX_IF)) {
+        if (n != 3 && n != 4) aot_error(a, "bad if", x);
+        return aot_if(a, aot_expr(a, l, s, car(cdr(x))),
+                      aot_expr(a, l, s, car(cdr(cdr(x)))),
+                      n == 4 ? aot_expr(a, l, s, car(cdr(cdr(cdr(x)))))
+                             : aot_const(a, make_void()));
+    } else if (aot_keyword_p(a, s, head, SYNTAX_DEFINE)) {
+        return aot_define(a, l, s, x);
+    } else if (aot_keyword_p(a, s, head, SYNTAX_SET)) {
+        return aot_set(a, l, s, x);
+    } else if (aot_keyword_p(a, s, head, SYNTAX_LAMBDA)) {
+        if (n < 3) aot_error(a, "bad lambda", x);
+        return aot_lambda_expr(a, l, s, car(cdr(x)), 0, cdr(cdr(x)),
+                               make_bool(0));
+    } else if (aot_keyword_p(a, s, head, SYNTAX_BEGIN)) {
+        return aot_sequence(a, l, s, cdr(x));
+    } else if (aot_keyword_p(a, s, head, SYNTAX_LET)) {
+        if (n < 3) aot_error(a, "bad let", x);
+        if (symbol_p(car(cdr(x)))) {
+            if (n < 4) aot_error(a, "bad let", x);
+            return aot_named_let(a, l, s, x);
+        }
+        return aot_let(a, l, s, x);
+    } else if (aot_keyword_p(a, s, head, SYNTAX_LET_STAR)) {
+        if (n < 3) aot_error(a, "bad let*", x);
+        aot_check_bindings(a, car(cdr(x)), x);
+        return aot_let_star(a, l, s, car(cdr(x)), cdr(cdr(x)));
+    } else if (aot_keyword_p(a, s, head, SYNTAX_LETREC) ||
+               aot_keyword_p(a, s, head, SYNTAX_LETREC_STAR)) {
+        if (n < 3) aot_error(a, "bad letrec", x);
+        return aot_letrec(a, l, s, x);
+    } else if (aot_keyword_p(a, s, head, SYNTAX_COND)) {
+        return aot_cond(a, l, s, cdr(x));
+    } else if (aot_keyword_p(a, s, head, SYNTAX_AND)) {
+        if (n == 1) return aot_const(a, make_bool(1));
+        return aot_list(a, l, s, A_AND, cdr(x));
+    } else if (aot_keyword_p(a, s, head, SYNTAX_OR)) {
+        if (n == 1) return aot_const(a, make_bool(0));
+        return aot_list(a, l, s, A_OR, cdr(x));
+    } else if (aot_keyword_p(a, s, head, SYNTAX_WHEN) ||
+               aot_keyword_p(a, s, head, SYNTAX_UNLESS)) {
+        if (n < 3) aot_error(a, "bad when", x);
+        aot_node_t *test = aot_expr(a, l, s, car(cdr(x)));
+        aot_node_t *body = aot_sequence(a, l, s, cdr(cdr(x)));
+        aot_node_t *none = aot_const(a, make_void());
+        return aot_keyword_p(a, s, head, SYNTAX_WHEN)
+                   ? aot_if(a, test, body, none)
+                   : aot_if(a, test, none, body);
+    }
+    return aot_list(a, l, s, A_CALL, x);
+}
+
+// the variable a reference from l stands for: within the procedure a letrec
+// binds a variable to, that procedure's closure
+static aot_var_t *aot_resolve(aot_var_t *v, aot_lambda_t *l) {
+    if (v->known && !v->assigned)
+        for (; l && l != v->owner; l = l->parent)
+            if (l == v->known) return l->self;
+    return v;
+}
+
+static void aot_capture(aot_lambda_t *l, aot_var_t *v) {
+    if (v->owner == l) return;
+    v->captured = 1;
+    for (long i = 0; i < l->free_count; i++)
+        if (l->free[i] == v) return;
+    if (l->free_count == l->free_size) {
+        l->free_size = l->free_size ? 2 * l->free_size : 8;
+        l->free = realloc(l->free, l->free_size * sizeof(aot_var_t *));
+    }
+    l->free[l->free_count++] = v;
+}
+
+static int aot_boxed(aot_var_t *v) {
+    return v->captured && (v->assigned || v->letrec);
+}
+
+// finds the free variables of the procedures in x, which is in l
+static void aot_analyze(aot_lambda_t *l, aot_node_t *x) {
+    if (x->kind == A_REF) {
+        x->var = aot_resolve(x->var, l);
+        aot_capture(l, x->var);
+    } else if (x->kind == A_SET) {
+        aot_capture(l, x->var);
+    } else if (x->kind == A_LAMBDA) {
+        aot_lambda_t *m = x->lambda;
+        aot_analyze(m, m->body);
+        for (long i = 0; i < m->free_count; i++) aot_capture(l, m->free[i]);
+    }
+    long n = x->count + (x->kind == A_LET || x->kind == A_LETREC);
+    for (long i = 0; i < n; i++) aot_analyze(l, x->kids[i]);
+}
+
+// code generation. values are computed into a destination, a C lvalue, or
+// for effect if it is NULL; in tail position, into v before leaving. the
+// operands of an expression are atoms, C expressions that read a slot, a
+// closure's copy, a box or a global, or are constant.
+
+// formats a C expression into buf, which holds AOT_EXPR_SIZE bytes
+static void aot_format(char *buf, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int n = vsnprintf(buf, AOT_EXPR_SIZE, format, ap);
+    va_end(ap);
+    if (n >= AOT_EXPR_SIZE) FATAL("aot: expression too long: %s", buf);
+}
+
+static void aot_line(aot_lambda_t *l, const char *format, ...) {
+    va_list ap;
+    fprintf(l->code, "%*s", (int)(4 * l->indent), "");
+    va_start(ap, format);
+    vfprintf(l->code, format, ap);
+    va_end(ap);
+    fputc('\n', l->code);
+}
+
+static long aot_temp(aot_lambda_t *l) {
+    if (++l->depth > l->max_depth) l->max_depth = l->depth;
+    return l->depth - 1;
+}
+
+// the index of a static object, adding it and the objects it refers to
+static long aot_static(aot_t *a, obj *o) {
+    for (long i = 0; i < a->consts_count; i++)
+        if (a->consts[i] == o) return i;
+    if (a->consts_count == a->consts_size) {
+        a->consts_size = a->consts_size ? 2 * a->consts_size : 64;
+        a->consts = realloc(a->consts, a->consts_size * sizeof(obj *));
+    }
+    long k = a->consts_count++;
+    a->consts[k] = o;
+#define STATIC_MEMBER(member) \
+    if (pointer_p(o->member)) aot_static(a, ptr_pointer(o->member))
+    MAKE_WALKER(STATIC_MEMBER, o);
+#undef STATIC_MEMBER
+    return k;
+}
+
+static void aot_constant(aot_t *a, ptr x, char *buf) {
+    switch (PTR_TAG(x)) {
+        case TAG_FIXNUM:
+            aot_format(buf, "make_fixnum(%lld)", (long long)ptr_fixnum(x));
+            break;
+        case TAG_POINTER:
+            aot_format(buf, "AOT_CONSTANT(k%ld)",
+                       aot_static(a, ptr_pointer(x)));
+            break;
+        case TAG_SYMBOL:
+            aot_format(buf, "make_symbol(%ld)", ptr_symbol(x));
+            break;
+        case TAG_CHARACTER:
+            aot_format(buf, "make_char(%ld)", (long)ptr_char(x));
+            break;
+        case TAG_BOOLEAN:
+            aot_format(buf, "make_bool(%d)", ptr_bool(x));
+            break;
+        default:
+            aot_format(buf, "((ptr){%#lx})", (unsigned long)x.bits);
+            break;
+    }
+}
+
+// the value of a global the program leaves alone
+static ptr aot_env(aot_t *a, ptr sym) {
+    obj *env = ptr_pointer(a->ctx->env);
+    long i = ptr_symbol(sym);
+    return i < env->env_size ? env->entry[i] : make_unbound();
+}
+
+// where v is from l: its slot, or the copy in l's closure
+static void aot_location(aot_lambda_t *l, aot_var_t *v, char *buf) {
+    if (v->owner == l) {
+        aot_format(buf, "r[%ld]", v->slot);
+        return;
+    }
+    for (long i = 0; i < l->free_count; i++)
+        if (l->free[i] == v) {
+            aot_format(buf, "aot_free(r[0], %ld)", i);
+            return;
+        }
+    FATAL("aot: variable not captured");
+}
+
+static int aot_atom(aot_t *a, aot_lambda_t *l, aot_node_t *x, char *buf) {
+    char loc[AOT_EXPR_SIZE];
+    switch (x->kind) {
+        case A_CONST:
+            aot_constant(a, x->value, buf);
+            return 1;
+        case A_REF:
+            aot_location(l, x->var, loc);
+            aot_format(buf, aot_boxed(x->var) ? "aot_unbox(%s)" : "%s",
+                       loc);
+            return 1;
+        case A_GLOBAL: {
+            long index = a->globals[ptr_symbol(x->value)].index;
+            ptr v = aot_env(a, x->value);
+            if (index >= 0)
+                aot_format(buf, "aot_bound(ctx, g[%ld], make_symbol(%ld))",
+                           index, ptr_symbol(x->value));
+            else if (primitive_p(v))
+                aot_format(buf, "make_primitive(%d)", ptr_primitive(v));
+            else
+                aot_format(buf,
+                           "aot_bound(ctx, make_unbound(), make_symbol(%ld))",
+                           ptr_symbol(x->value));
+            return 1;
+        }
+        case A_LAMBDA:
+            if (x->lambda->free_count) return 0;
+            aot_format(buf, "AOT_CONSTANT(p%ld)", x->lambda->id);
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void aot_gen(aot_t *a, aot_lambda_t *l, aot_node_t *x,
+                    const char *dest, int tail);
+
+// an atom for x, computing it into a temporary if it is not one
+static void aot_operand(aot_t *a, aot_lambda_t *l, aot_node_t *x, char *buf) {
+    if (aot_atom(a, l, x, buf)) return;
+    aot_format(buf, "r[%ld]", aot_temp(l));
+    aot_gen(a, l, x, buf, 0);
+}
+
+// computes the arguments of a call into consecutive temporaries, returning
+// the first
+static long aot_arguments(aot_t *a, aot_lambda_t *l, aot_node_t *x) {
+    long first = l->depth;
+    char slot[AOT_EXPR_SIZE];
+    for (long i = 1; i < x->count; i++) aot_temp(l);
+    for (long i = 1; i < x->count; i++) {
+        aot_format(slot, "r[%ld]", first + i - 1);
+        aot_gen(a, l, x->kids[i], slot, 0);
+    }
+    return first;
+}
+
+static void aot_result(aot_lambda_t *l, const char *dest, int tail,
+                       const char *expr, int pure) {
+    if (dest)
+        aot_line(l, "%s = %s;", dest, expr);
+    else if (!pure)
+        aot_line(l, "%s;", expr);
+    if (tail) aot_line(l, "goto out;");
+}
+
+// primitives expanded inline, with the number of arguments they take there.
+// the expansions of tests are C conditions.
+static const struct {
+    const char *name;
+    int args, test;
+    const char *expansion;
+} aot_inlines[] = {
+    {"car", 1, 0, "aot_car(%s)"},
+    {"cdr", 1, 0, "aot_cdr(%s)"},
+    {"cons", 2, 0, "make_pair(&ctx->memory, %s, %s)"},
+    {"eq?", 2, 1, "eq_p(%s, %s)"},
+    {"null?", 1, 1, "eq_p(%s, make_nil())"},
+    {"pair?", 1, 1, "aot_pair_p(%s)"},
+    {"not", 1, 1, "false_p(%s)"},
+    {"+", 2, 0, "num_add(&ctx->memory, %s, %s)"},
+    {"-", 2, 0, "num_sub(&ctx->memory, %s, %s)"},
+    {"-", 1, 0, "num_negate(&ctx->memory, %s)"},
+    {"*", 2, 0, "num_mul(&ctx->memory, %s, %s)"},
+    {"=", 2, 1, "num_eq(%s, %s)"},
+    {"<", 2, 1, "num_lt(%s, %s)"},
+    {">", 2, 1, "num_gt(%s, %s)"},
+    {"<=", 2, 1, "num_le(%s, %s)"},
+    {">=", 2, 1, "num_ge(%s, %s)"},
+    {"vector-length", 1, 0, "aot_vector_length(%s)"},
+    {"vector-ref", 2, 0, "aot_vector_ref(%s, %s)"},
+    {"vector-set!", 3, 0, "aot_vector_set(ctx, %s, %s, %s)"},
+};
+
+// the primitive a call goes to, -1 if it is not known to be one
+static int aot_primitive(aot_t *a, aot_node_t *x) {
+    if (x->kind != A_CALL || x->kids[0]->kind != A_GLOBAL) return -1;
+    ptr sym = x->kids[0]->value, v = aot_env(a, sym);
+    if (a->globals[ptr_symbol(sym)].index >= 0 || !primitive_p(v)) return -1;
+    return ptr_primitive(v);
+}
+
+// the inline expansion of a call to primitive k, -1 if there is none
+static int aot_inline(aot_node_t *x, int k) {
+    long n = sizeof(aot_inlines) / sizeof(aot_inlines[0]);
+    for (long i = 0; k >= 0 && i < n; i++)
+        if (strcmp(aot_inlines[i].name, primitives[k].name) == 0 &&
+            aot_inlines[i].args == x->count - 1)
+            return i;
+    return -1;
+}
+
+static void aot_expand(aot_t *a, aot_lambda_t *l, aot_node_t *x, int i,
+                       char *buf) {
+    char args[3][AOT_EXPR_SIZE];
+    for (long j = 1; j < x->count; j++)
+        aot_operand(a, l, x->kids[j], args[j - 1]);
+    aot_format(buf, aot_inlines[i].expansion, args[0], args[1], args[2]);
+}
+
+// a C condition for whether x is true
+static void aot_test(aot_t *a, aot_lambda_t *l, aot_node_t *x, char *cond) {
+    char buf[AOT_EXPR_SIZE];
+    int k = aot_primitive(a, x), i = aot_inline(x, k);
+    if (i >= 0 && strcmp(aot_inlines[i].name, "not") == 0) {
+        aot_test(a, l, x->kids[1], buf);
+        aot_format(cond, "!(%s)", buf);
+    } else if (i >= 0 && aot_inlines[i].test) {
+        aot_expand(a, l, x, i, cond);
+    } else if (x->kind == A_CONST) {
+        strcpy(cond, false_p(x->value) ? "0" : "1");
+    } else {
+        aot_operand(a, l, x, buf);
+        aot_format(cond, "!false_p(%s)", buf);
+    }
+}
+
+// the procedure a call goes to, if it is known
+static aot_lambda_t *aot_known(aot_t *a, aot_node_t *f) {
+    if (f->kind == A_REF && !f->var->assigned) return f->var->known;
+    if (f->kind != A_GLOBAL) return NULL;
+    aot_global_t *g = &a->globals[ptr_symbol(f->value)];
+    return g->defines == 1 && !g->assigned ? g->known : NULL;
+}
+
+static void aot_call_gen(aot_t *a, aot_lambda_t *l, aot_node_t *x,
+                         const char *dest, int tail) {
+    char buf[AOT_EXPR_SIZE], f[AOT_EXPR_SIZE];
+    long argc = x->count - 1;
+    int k = aot_primitive(a, x), i = aot_inline(x, k);
+    aot_lambda_t *m = aot_known(a, x->kids[0]);
+    if (k >= 0 && (argc < primitives[k].min_args ||
+                   (primitives[k].max_args >= 0 &&
+                    argc > primitives[k].max_args))) {
+        aot_format(buf,
+                   "aot_fatal(ctx, \"wrong number of arguments to\", "
+                   "make_primitive(%d))",
+                   k);
+    } else if (i >= 0) {
+        aot_expand(a, l, x, i, f);
+        if (aot_inlines[i].test)
+            aot_format(buf, "make_bool(%s)", f);
+        else
+            strcpy(buf, f);
+    } else if (k >= 0) {
+        long args = aot_arguments(a, l, x);
+        aot_format(buf, "primitives[%d].fn(ctx, r + %ld, %ld)", k, args,
+                   argc);
+    } else if (m == l && tail && l->parent && !l->rest &&
+               argc == l->required) {
+        long args = aot_arguments(a, l, x);
+        for (long j = 0; j < argc; j++)
+            aot_line(l, "r[%ld] = r[%ld];", l->params[j]->slot, args + j);
+        aot_line(l, "goto top;");
+        l->top = 1;
+        return;
+    } else {
+        aot_operand(a, l, x->kids[0], f);
+        long args = aot_arguments(a, l, x);
+        if (m)
+            aot_format(buf, "%s(ctx, %s, r + %ld, %ld)", m->cname, f, args,
+                       argc);
+        else
+            aot_format(buf, "aot_call(ctx, %s, r + %ld, %ld)", f, args,
+                       argc);
+    }
+    aot_result(l, dest, tail, buf, 0);
+}
+
+// and and or: each value but the last is tested, and kept as the result if
+// it decides it
+static void aot_junction(aot_t *a, aot_lambda_t *l, aot_node_t *x, long i,
+                         const char *dest, int tail) {
+    if (i == x->count - 1) {
+        aot_gen(a, l, x->kids[i], dest, tail);
+        return;
+    }
+    char temp[AOT_EXPR_SIZE];
+    const char *d = dest;
+    if (!d) {
+        aot_format(temp, "r[%ld]", aot_temp(l));
+        d = temp;
+    }
+    aot_gen(a, l, x->kids[i], d, 0);
+    aot_line(l, x->kind == A_AND ? "if (!false_p(%s)) {" : "if (false_p(%s)) {",
+             d);
+    l->indent++;
+    aot_junction(a, l, x, i + 1, dest, tail);
+    l->indent--;
+    if (tail) {
+        aot_line(l, "} else {");
+        aot_line(l, "    goto out;");
+    }
+    aot_line(l, "}");
+}
+
+static void aot_closure_gen(aot_t *a, aot_lambda_t *l, aot_lambda_t *m,
+                            char *buf) {
+    char loc[AOT_EXPR_SIZE];
+    long t = aot_temp(l);
+    aot_line(l, "r[%ld] = make_vector(&ctx->memory, %ld, make_fixnum(0));", t,
+             m->free_count);
+    for (long i = 0; i < m->free_count; i++) {
+        aot_location(l, m->free[i], loc);
+        aot_line(l, "ptr_pointer(r[%ld])->vector[%ld] = %s;", t, i, loc);
+    }
+    aot_format(buf, "aot_closure(ctx, %s, r[%ld])", m->cname, t);
+}
+
+static void aot_gen(aot_t *a, aot_lambda_t *l, aot_node_t *x,
+                    const char *dest, int tail) {
+    char buf[AOT_EXPR_SIZE], loc[AOT_EXPR_SIZE];
+    long depth = l->depth, n = x->count;
+    switch (x->kind) {
+        case A_CONST:
+        case A_REF:
+        case A_GLOBAL:
+            aot_atom(a, l, x, buf);
+            aot_result(l, dest, tail, buf, 1);
+            break;
+        case A_LAMBDA:
+            if (!aot_atom(a, l, x, buf)) aot_closure_gen(a, l, x->lambda, buf);
+            aot_result(l, dest, tail, buf, 1);
+            break;
+        case A_SET:
+            aot_operand(a, l, x->kids[0], buf);
+            aot_location(l, x->var, loc);
+            if (aot_boxed(x->var))
+                aot_line(l, "GC_STORE(&ctx->memory, ptr_pointer(%s), car, %s);",
+                         loc, buf);
+            else
+                aot_line(l, "%s = %s;", loc, buf);
+            aot_result(l, dest, tail, "make_void()", 1);
+            break;
+        case A_SET_GLOBAL: {
+            long index = a->globals[ptr_symbol(x->value)].index;
+            aot_operand(a, l, x->kids[0], buf);
+            aot_line(l, "aot_bound(ctx, g[%ld], make_symbol(%ld));", index,
+                     ptr_symbol(x->value));
+            aot_line(l, "g[%ld] = %s;", index, buf);
+            aot_result(l, dest, tail, "make_void()", 1);
+            break;
+        }
+        case A_DEFINE:
+            aot_format(loc, "g[%ld]",
+                       a->globals[ptr_symbol(x->value)].index);
+            aot_gen(a, l, x->kids[0], loc, 0);
+            aot_result(l, dest, tail, "make_void()", 1);
+            break;
+        case A_IF:
+            aot_test(a, l, x->kids[0], buf);
+            l->depth = depth;
+            aot_line(l, "if (%s) {", buf);
+            l->indent++;
+            aot_gen(a, l, x->kids[1], dest, tail);
+            l->indent--;
+            aot_line(l, "} else {");
+            l->indent++;
+            aot_gen(a, l, x->kids[2], dest, tail);
+            l->indent--;
+            aot_line(l, "}");
+            break;
+        case A_SEQ:
+            for (long i = 0; i < n - 1; i++) aot_gen(a, l, x->kids[i], NULL, 0);
+            aot_gen(a, l, x->kids[n - 1], dest, tail);
+            break;
+        case A_AND:
+        case A_OR:
+            aot_junction(a, l, x, 0, dest, tail);
+            break;
+        case A_CALL:
+            aot_call_gen(a, l, x, dest, tail);
+            break;
+        case A_LET:
+            for (long i = 0; i < n; i++) x->vars[i]->slot = aot_temp(l);
+            for (long i = 0; i < n; i++) {
+                aot_format(loc, "r[%ld]", x->vars[i]->slot);
+                aot_gen(a, l, x->kids[i], loc, 0);
+            }
+            for (long i = 0; i < n; i++)
+                if (aot_boxed(x->vars[i]))
+                    aot_line(l,
+                             "r[%ld] = make_pair(&ctx->memory, r[%ld], "
+                             "make_nil());",
+                             x->vars[i]->slot, x->vars[i]->slot);
+            aot_gen(a, l, x->kids[n], dest, tail);
+            break;
+        case A_LETREC:
+            for (long i = 0; i < n; i++) {
+                long s = x->vars[i]->slot = aot_temp(l);
+                if (aot_boxed(x->vars[i]))
+                    aot_line(l,
+                             "r[%ld] = make_pair(&ctx->memory, "
+                             "make_unbound(), make_nil());",
+                             s);
+                else
+                    aot_line(l, "r[%ld] = make_unbound();", s);
+            }
+            for (long i = 0; i < n; i++) {
+                long s = x->vars[i]->slot, top = l->depth;
+                if (aot_boxed(x->vars[i])) {
+                    aot_operand(a, l, x->kids[i], buf);
+                    aot_line(l,
+                             "GC_STORE(&ctx->memory, ptr_pointer(r[%ld]), "
+                             "car, %s);",
+                             s, buf);
+                    l->depth = top;
+                } else {
+                    aot_format(loc, "r[%ld]", s);
+                    aot_gen(a, l, x->kids[i], loc, 0);
+                }
+            }
+            aot_gen(a, l, x->kids[n], dest, tail);
+            break;
+    }
+    l->depth = depth;
+}
+
+static void aot_function(aot_t *a, aot_lambda_t *l) {
+    l->code = open_memstream(&l->text, &l->length);
+    l->depth = l->max_depth = 1;
+    l->indent = 1;
+    for (long i = 0; i < l->required + l->rest; i++)
+        l->params[i]->slot = aot_temp(l);
+    aot_gen(a, l, l->body, "v", 1);
+    fclose(l->code);
+}
+
+static void aot_signature(aot_lambda_t *l, FILE *out) {
+    fprintf(out, "static ptr %s(ctx_t *ctx, ptr self, ptr *args, long argc)",
+            l->cname);
+}
+
+static void aot_write_function(aot_lambda_t *l, FILE *out) {
+    aot_signature(l, out);
+    fprintf(out, " {\n    GC_LOCALS(r, %ld);\n    ptr v;\n", l->max_depth);
+    if (l->parent)
+        fprintf(out,
+                "    if (argc %s %ld)\n"
+                "        aot_fatal(ctx, \"wrong number of arguments to\", "
+                "self);\n",
+                l->rest ? "<" : "!=", l->required);
+    fprintf(out, "    r[0] = self;\n");
+    for (long i = 0; i < l->required; i++)
+        fprintf(out, "    r[%ld] = args[%ld];\n", l->params[i]->slot, i);
+    if (l->rest) {
+        long s = l->params[l->required]->slot;
+        fprintf(out,
+                "    r[%ld] = make_nil();\n"
+                "    for (long i = argc - 1; i >= %ld; i--)\n"
+                "        r[%ld] = make_pair(&ctx->memory, args[i], r[%ld]);\n",
+                s, l->required, s, s);
+    }
+    if (l->top) fprintf(out, "top:\n");
+    for (long i = 0; i < l->required + l->rest; i++)
+        if (aot_boxed(l->params[i]))
+            fprintf(out,
+                    "    r[%ld] = make_pair(&ctx->memory, r[%ld], "
+                    "make_nil());\n",
+                    l->params[i]->slot, l->params[i]->slot);
+    fwrite(l->text, 1, l->length, out);
+    fprintf(out, "out:\n    GC_UNLOCALS(r);\n    return v;\n}\n\n");
+}
+
+// a static object as words, with the pointers to other static objects
+// written as their addresses
+static void aot_write_static(aot_t *a, long k, FILE *out) {
+    obj *o = a->consts[k];
+    long n = obj_size(o) / sizeof(uintptr_t);
+    uintptr_t *words = (uintptr_t *)o;
+    long *refs = malloc(n * sizeof(long));
+    for (long i = 0; i < n; i++) refs[i] = -1;
+#define STATIC_MEMBER(member)                            \
+    if (pointer_p(o->member))                            \
+        refs[(uintptr_t *)&o->member - words] =          \
+            aot_static(a, ptr_pointer(o->member))
+    MAKE_WALKER(STATIC_MEMBER, o);
+#undef STATIC_MEMBER
+    fprintf(out, "static const uintptr_t k%ld[%ld] = {\n    %#lx", k, n,
+            (unsigned long)(o->header &
+                            ~(HDR_AGE_MASK | HDR_MARK | HDR_MOVED |
+                              HDR_LARGE)));
+    for (long i = 1; i < n; i++) {
+        fprintf(out, i % 4 ? ", " : ",\n    ");
+        if (refs[i] >= 0)
+            fprintf(out, "(uintptr_t)k%ld + TAG_POINTER", refs[i]);
+        else
+            fprintf(out, "%#lx", (unsigned long)words[i]);
+    }
+    fprintf(out, "};\n");
+    free(refs);
+}
+
+static void aot_write(aot_t *a, FILE *out) {
+    obarray_t *obarray = &a->ctx->obarray;
+    fprintf(out, "// compiled by s3-repl --aot\n#include \"s3.h\"\n\n");
+    for (long i = 0; i < a->lambdas_count; i++) {
+        aot_signature(a->lambdas[i], out);
+        fprintf(out, " __attribute__((aligned(8)));\n");
+    }
+
+    fprintf(out, "\nstatic const char_t symbol_names[] = {");
+    long count = 0;
+    for (long k = 1; k <= obarray->count; k++)
+        for (long i = 0; i < obarray->names[k]->length; i++)
+            fprintf(out, count++ % 12 ? " %ld," : "\n    %ld,",
+                    (long)obarray->names[k]->s[i]);
+    fprintf(out, "%s};\nstatic const long symbol_lengths[] = {",
+            count ? "\n" : "0");
+    for (long k = 1; k <= obarray->count; k++)
+        fprintf(out, (k - 1) % 12 ? " %ld," : "\n    %ld,",
+                obarray->names[k]->length);
+    fprintf(out, "\n};\n\nstatic ptr g[%ld];\n", a->globals_count + 1);
+    fprintf(out, "static const long global_symbols[] = {");
+    for (long i = 0; i < a->globals_count; i++)
+        fprintf(out, i % 12 ? " %ld," : "\n    %ld,", a->global_symbols[i]);
+    fprintf(out, "%s};\n\n", a->globals_count ? "\n" : "0");
+
+    // closures without free variables, then the quoted data
+    obj procedure;
+    fill_header(&procedure, H_PROCEDURE, 4 * sizeof(ptr));
+    for (long i = 0; i < a->lambdas_count; i++) {
+        aot_lambda_t *l = a->lambdas[i];
+        if (!l->parent || l->free_count) continue;
+        fprintf(out,
+                "static const uintptr_t p%ld[5] = {%#lx, %#lx, %#lx,\n"
+                "                                 (uintptr_t)%s, %#lx};\n",
+                l->id, (unsigned long)procedure.header,
+                (unsigned long)make_nil().bits,
+                (unsigned long)make_bool(0).bits, l->cname,
+                (unsigned long)make_bool(0).bits);
+    }
+    for (long k = 0; k < a->consts_count; k++)
+        fprintf(out, "static const uintptr_t k%ld[%ld];\n", k,
+                (long)(obj_size(a->consts[k]) / sizeof(uintptr_t)));
+    for (long k = 0; k < a->consts_count; k++) aot_write_static(a, k, out);
+    fprintf(out, "\n");
+
+    for (long i = 0; i < a->lambdas_count; i++)
+        aot_write_function(a->lambdas[i], out);
+
+    fprintf(out,
+            "static void program(ctx_t *ctx) {\n"
+            "    gc_frame_t frame;\n"
+            "    ctx_init(ctx);\n"
+            "    aot_symbols(ctx, symbol_names, symbol_lengths, %ld);\n"
+            "    aot_globals(ctx, g, global_symbols, %ld);\n"
+            "    gc_push_frame(&frame, g, %ld);\n",
+            obarray->count, a->globals_count, a->globals_count);
+    for (long i = 0; i < a->lambdas_count; i++)
+        if (!a->lambdas[i]->parent)
+            fprintf(out, "    %s(ctx, make_bool(0), NULL, 0);\n",
+                    a->lambdas[i]->cname);
+    fprintf(out,
+            "    gc_pop_frame(&frame);\n"
+            "    port_flush(&ctx->out);\n"
+            "    gc_stats_report(&ctx->memory, stderr);\n"
+            "    alloc_profile_report(ctx, stderr);\n"
+            "}\n\n"
+            "int main(void) {\n"
+            "    static ctx_t ctx;\n"
+            "    aot_run(&ctx, program);\n"
+            "    return 0;\n"
+            "}\n");
+}
+
+void aot_compile(ctx_t *ctx, ptr forms, FILE *out) {
+    aot_t a = {ctx};
+    long symbols = ctx->obarray.count;
+    a.globals = calloc(symbols + 1, sizeof(aot_global_t));
+    for (long i = 0; i <= symbols; i++) a.globals[i].index = -1;
+    for (ptr f = forms; pair_p(f); f = cdr(f)) {
+        aot_lambda_t *l = aot_lambda(&a, NULL, make_bool(1));
+        l->body = aot_expr(&a, l, NULL, car(f));
+    }
+    for (long i = 0; i < a.lambdas_count; i++)
+        if (!a.lambdas[i]->parent)
+            aot_analyze(a.lambdas[i], a.lambdas[i]->body);
+    for (long i = 0; i < a.lambdas_count; i++) aot_function(&a, a.lambdas[i]);
+    aot_write(&a, out);
+    for (long i = 0; i < a.lambdas_count; i++) {
+        free(a.lambdas[i]->free);
+        free(a.lambdas[i]->text);
+    }
+    for (long i = 0; i < a.blocks_count; i++) free(a.blocks[i]);
+    free(a.blocks);
+    free(a.globals);
+    free(a.global_symbols);
+    free(a.lambdas);
+    free(a.consts);
+}
+
+void aot_symbols(ctx_t *ctx, const char_t *names, const long *lengths,
+                 long n) {
+    for (long k = 1; k <= n; names += lengths[k - 1], k++)
+        if (ptr_symbol(obarray_intern_n(&ctx->obarray, names,
+                                        lengths[k - 1])) != k)
+            FATAL("aot: the program's symbols conflict with the runtime's");
+}
+
+void aot_globals(ctx_t *ctx, ptr *globals, const long *symbols, long n) {
+    obj *env = ptr_pointer(ctx->env);
+    for (long i = 0; i < n; i++)
+        globals[i] = symbols[i] < env->env_size ? env->entry[symbols[i]]
+                                                : make_unbound();
+}
+
+typedef struct aot_start_t {
+    ctx_t *ctx;
+    void (*program)(ctx_t *ctx);
+} aot_start_t;
+
+static void *aot_thread(void *arg) {
+    aot_start_t *s = arg;
+    s->program(s->ctx);
+    return NULL;
+}
+
+void aot_run(ctx_t *ctx, void (*program)(ctx_t *ctx)) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    aot_start_t s = {ctx, program};
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, AOT_STACK_SIZE);
+    if (pthread_create(&thread, &attr, aot_thread, &s))
+        FATAL("aot: can't start the program's thread");
+    pthread_join(thread, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+ptr aot_closure(ctx_t *ctx, aot_fn_t fn, ptr env) {
+    GC_LOCALS(l, 1);
+    l[0] = env;
+    ptr p = gc_alloc(&ctx->memory, H_PROCEDURE, 4 * sizeof(ptr));
+    obj *o = ptr_pointer(p);
+    o->formals = make_nil();
+    o->p_env = l[0];
+    o->body = (ptr){(uintptr_t)fn};
+    o->code = make_bool(0);
+    GC_UNLOCALS(l);
+    return p;
+}
+
+ptr aot_call(ctx_t *ctx, ptr f, ptr *args, long n) {
+    if (primitive_p(f)) return vm_primitive(ctx, f, n)->fn(ctx, args, n);
+    if (!heap_p(f, H_PROCEDURE) || !false_p(ptr_pointer(f)->code))
+        fatal_datum(ctx, "aot", "not a procedure", f);
+    return ((aot_fn_t)ptr_pointer(f)->body.bits)(ctx, f, args, n);
+}
+
+ptr aot_fatal(ctx_t *ctx, const char *message, ptr x) {
+    fatal_datum(ctx, "aot", message, x);
+    return x;
 }
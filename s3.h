@@ -2,13 +2,12 @@
 #define S3_H
 
 #include <limits.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-// we need to know about overflows, hence the smaller base
-#define BASE 100000000
+#include <string.h>
 
 #define FATAL(...)                    \
     do {                              \
@@ -17,8 +16,6 @@
         abort();                      \
     } while (0)
 
-#define BATCH_FATHER_SIZE 60
-
 struct obj;
 typedef int32_t char_t;
 
@@ -27,6 +24,43 @@ long lstrlen(const char_t *s);
 char_t utf8_getc(FILE *f);
 void utf8_putc(FILE *f, char_t c);
 
+// ports buffer PORT_BUFFER_SIZE bytes of utf-8 between their stream and the
+// code points they read or write, and take the ascii fast path 16 bytes at a
+// time where possible
+#define PORT_BUFFER_SIZE (64 << 10)
+
+typedef struct port_t {
+    FILE *f;
+    unsigned char *buf;
+    long pos, end;
+    int output;
+} port_t;
+
+void port_open(port_t *port, FILE *f, int output);
+void port_flush(port_t *port);
+// flushes an output port and frees the buffer; the stream is left open
+void port_close(port_t *port);
+char_t port_getc_slow(port_t *port);
+char_t port_peekc(port_t *port);
+void port_putc_slow(port_t *port, char_t c);
+// reads up to n code points into s, returning how many were read (less than n
+// only at the end of the stream)
+long port_read_string(port_t *port, char_t *s, long n);
+void port_write_string(port_t *port, const char_t *s, long n);
+
+static inline char_t port_getc(port_t *port) {
+    if (port->pos < port->end && port->buf[port->pos] < 0x80)
+        return port->buf[port->pos++];
+    return port_getc_slow(port);
+}
+
+static inline void port_putc(port_t *port, char_t c) {
+    if (c >= 0 && c < 0x80 && port->pos < PORT_BUFFER_SIZE)
+        port->buf[port->pos++] = c;
+    else
+        port_putc_slow(port, c);
+}
+
 enum stackvar_type_t {
     T_FIXNUM = 1,
     T_FLONUM,
@@ -37,42 +71,127 @@ enum stackvar_type_t {
     T_EOF,
     T_NIL,
     T_UNBOUND,
+    T_VOID,
     T_PTR,
 };
 
 struct obj;  // heap-allocated objects
+struct gc_t;
 
+// a ptr is a single tagged machine word. the low PTR_TAG_BITS bits select the
+// kind of value, the rest hold the payload:
+//   fixnum     value << 3                  (61-bit two's complement)
+//   pointer    address | 1                 (objects are GC_ALIGNMENT-aligned)
+//   symbol     index << 3 | 2
+//   character  code point << 3 | 3
+//   primitive  index << 3 | 4
+//   boolean    0/1 << 3 | 5
+//   special    eof/nil/unbound/void << 3 | 6
+// flonums are IEEE doubles boxed in H_FLONUM objects.
 typedef struct ptr {
-    enum stackvar_type_t type;
-    union {
-        int64_t fixnum;
-        long double flonum;
-        long symbol;
-        char_t character;
-        int boolean;
-        int primitive;
-        // common to all pointer types
-        struct obj *pointer;
-    };
+    uintptr_t bits;
 } ptr;
 
-ptr make_fixnum(int64_t x);
-ptr make_flonum(long double x);
-ptr make_char(char_t x);
-ptr make_bool(int x);
-ptr make_primitive(int x);
-ptr make_pointer(struct obj *p);
-ptr make_eof();
-ptr make_nil();
-ptr make_unbound();
+#define PTR_TAG_BITS 3
+#define PTR_TAG_MASK ((uintptr_t)((1 << PTR_TAG_BITS) - 1))
+
+enum ptr_tag_t {
+    TAG_FIXNUM = 0,
+    TAG_POINTER,
+    TAG_SYMBOL,
+    TAG_CHARACTER,
+    TAG_PRIMITIVE,
+    TAG_BOOLEAN,
+    TAG_SPECIAL,
+};
+
+enum special_t {
+    S_EOF,
+    S_NIL,
+    S_UNBOUND,
+    S_VOID,  // the value of definitions, assignments and the like
+};
+
+#define FIXNUM_MAX (INT64_MAX >> PTR_TAG_BITS)
+#define FIXNUM_MIN (INT64_MIN >> PTR_TAG_BITS)
+
+#define PTR_TAG(p) ((p).bits & PTR_TAG_MASK)
+#define MAKE_IMMEDIATE(tag, x) \
+    ((ptr){((uintptr_t)(x) << PTR_TAG_BITS) | (tag)})
+
+// the fixnum is truncated to 61 bits
+static inline ptr make_fixnum(int64_t x) {
+    return MAKE_IMMEDIATE(TAG_FIXNUM, x);
+}
+static inline ptr make_symbol(long x) { return MAKE_IMMEDIATE(TAG_SYMBOL, x); }
+static inline ptr make_char(char_t x) {
+    return MAKE_IMMEDIATE(TAG_CHARACTER, (uint32_t)x);
+}
+static inline ptr make_bool(int x) { return MAKE_IMMEDIATE(TAG_BOOLEAN, !!x); }
+static inline ptr make_primitive(int x) {
+    return MAKE_IMMEDIATE(TAG_PRIMITIVE, x);
+}
+static inline ptr make_pointer(struct obj *p) {
+    return (ptr){(uintptr_t)p | TAG_POINTER};
+}
+static inline ptr make_eof() { return MAKE_IMMEDIATE(TAG_SPECIAL, S_EOF); }
+static inline ptr make_nil() { return MAKE_IMMEDIATE(TAG_SPECIAL, S_NIL); }
+static inline ptr make_unbound() {
+    return MAKE_IMMEDIATE(TAG_SPECIAL, S_UNBOUND);
+}
+static inline ptr make_void() { return MAKE_IMMEDIATE(TAG_SPECIAL, S_VOID); }
+ptr make_flonum(struct gc_t *gc, double x);
+ptr make_pair(struct gc_t *gc, ptr car, ptr cdr);
+ptr make_vector(struct gc_t *gc, long n, ptr fill);
+// strings are narrow when all their characters are at most 0xff. s must not
+// point into the heap.
+ptr make_string(struct gc_t *gc, const char_t *s, long n);
+ptr make_string_fill(struct gc_t *gc, long n, char_t c);
+void string_set(struct gc_t *gc, ptr s, long i, char_t c);
+int string_compare(ptr a, ptr b);
+int string_equal_p(ptr a, ptr b);
+// bigints are normalized, and zero has sign 1. bigint_div truncates, storing
+// the remainder in *r unless r is NULL. bigint_to_string returns a malloc'd
+// string, bigint_from_string returns #f for malformed input.
+ptr make_bigint(struct gc_t *gc, int64_t x);
+ptr bigint_add(struct gc_t *gc, ptr a, ptr b);
+ptr bigint_sub(struct gc_t *gc, ptr a, ptr b);
+ptr bigint_mul(struct gc_t *gc, ptr a, ptr b);
+ptr bigint_div(struct gc_t *gc, ptr a, ptr b, ptr *r);
+ptr bigint_negate(struct gc_t *gc, ptr a);
+int bigint_compare(ptr a, ptr b);
+char *bigint_to_string(ptr a, int radix);
+ptr bigint_from_string(struct gc_t *gc, const char *s, long n, int radix);
+
+static inline int pointer_p(ptr p) { return PTR_TAG(p) == TAG_POINTER; }
+static inline int fixnum_p(ptr p) { return PTR_TAG(p) == TAG_FIXNUM; }
+static inline int eq_p(ptr p, ptr q) { return p.bits == q.bits; }
+static inline int symbol_p(ptr p) { return PTR_TAG(p) == TAG_SYMBOL; }
+static inline int char_p(ptr p) { return PTR_TAG(p) == TAG_CHARACTER; }
+static inline int bool_p(ptr p) { return PTR_TAG(p) == TAG_BOOLEAN; }
+static inline int primitive_p(ptr p) { return PTR_TAG(p) == TAG_PRIMITIVE; }
+static inline int false_p(ptr p) { return p.bits == make_bool(0).bits; }
+
+static inline int64_t ptr_fixnum(ptr p) {
+    return (int64_t)p.bits >> PTR_TAG_BITS;
+}
+static inline long ptr_symbol(ptr p) { return p.bits >> PTR_TAG_BITS; }
+static inline char_t ptr_char(ptr p) { return p.bits >> PTR_TAG_BITS; }
+static inline int ptr_bool(ptr p) { return p.bits >> PTR_TAG_BITS; }
+static inline int ptr_primitive(ptr p) { return p.bits >> PTR_TAG_BITS; }
+static inline struct obj *ptr_pointer(ptr p) {
+    return (struct obj *)(p.bits - TAG_POINTER);
+}
 
 enum heapvar_type_t {
     H_BIGINT = 1,
+    H_FLONUM,
     H_RATIONAL,
     H_COMPLEX,
     H_PAIR,
     H_VECTOR,
     H_BYTEVECTOR,
+    H_F64VECTOR,
     H_STRING,
     H_ENVIRONMENT,
     H_ACTIVATION_RECORD,
@@ -81,31 +200,96 @@ enum heapvar_type_t {
     H_TRANSFORMER,
     H_STRUCT,
     H_CODE,
+    H_FREE,
 };
+#define H_TYPES (H_FREE + 1)
 
+// the vm is a stack machine. operands are fixnums unless noted; jump targets
+// are instruction indices, and locals are addressed by (depth, index): slot
+// index of the activation record depth levels up the display. primitive
+// calls cache the primitive they resolve to, which is valid while their epoch
+// operand equals ctx_t's globals_epoch.
 enum opcode_t {
-    O_JUMP,
-    O_LOAD,
-    O_CREATE_ACTIVATION_RECORD,
+    O_JUMP,                      // target
+    O_LOAD,                      // depth, index; push the local
+    O_CREATE_ACTIVATION_RECORD,  // required, rest?, slots; procedure entry
+    O_STORE,                     // depth, index; top -> local, leaves void
+    O_CONST,                     // value; push it
+    O_GLOBAL,                    // symbol; push its value
+    O_DEFINE,                    // symbol; top -> global, leaves void
+    O_SET_GLOBAL,                // symbol; as O_DEFINE, if already bound
+    O_JUMP_IF_FALSE,             // target; pops the test
+    O_JUMP_IF_FALSE_OR_POP,      // target; and
+    O_JUMP_IF_TRUE_OR_POP,       // target; or
+    O_POP,
+    O_CLOSURE,                   // code, formals; push a procedure
+    O_FRAME,                     // return target; push a return frame
+    O_CALL,                      // argument count
+    O_PRIMCALL,                  // symbol, argument count, cached, epoch
+    O_RETURN,
+    // superinstructions, made by the fusion pass. one stands for the
+    // instructions it starts, which are left in place after it for jumps
+    // into them.
+    O_LOAD_LOAD,
+    O_LOAD_CONST,
+    O_LOAD_LOAD_PRIMCALL,
+    O_LOAD_CONST_PRIMCALL,
+    O_PRIMCALL_JUMP_IF_FALSE,  // compare and branch
+    O_LOAD_RETURN,
+    O_OPCODE_COUNT,
 };
 
+// label is the address of the instruction's handler in vm_run (direct
+// threading). it is filled in from the opcode when the code first runs.
 typedef struct instruction {
+    const void *label;
     enum opcode_t opcode;
     ptr operand[4];
-    void (*func)(ptr, struct instruction *);
 } instruction;
 
+#define GC_THRESHOLD_AGE 8
+#define GC_INITIAL_SIZE (1 << 20)
+#define GC_OLD_TO_YOUNG_RATIO 2
+#define GC_GROW_RATIO 2
+// address space reserved for each young semispace and for the old generation
+#define GC_YOUNG_RESERVE ((long)1 << 32)
+#define GC_OLD_RESERVE ((long)1 << 36)
+#define GC_ALIGNMENT (sizeof(intmax_t))
+_Static_assert(GC_ALIGNMENT > PTR_TAG_MASK,
+               "pointer tags need aligned objects");
+
+// every heap object starts with a one-word header:
+//   bits 0-4    heapvar_type_t
+//   bits 5-8    age (minor collections survived, saturating)
+//   bit 9       mark (objects in the large-object space)
+//   bit 10      moved; the forwarding pointer then overlays the payload
+//   bits 11-14  type-specific flags
+//   bit 15      large: the object is in the large-object space
+//   bits 16-63  size of the whole object in GC_ALIGNMENT units
+#define HDR_TYPE_MASK ((uintptr_t)31)
+#define HDR_AGE_SHIFT 5
+#define HDR_AGE_MASK ((uintptr_t)15 << HDR_AGE_SHIFT)
+#define HDR_MARK ((uintptr_t)1 << 9)
+#define HDR_MOVED ((uintptr_t)1 << 10)
+#define HDR_STRING_WIDE ((uintptr_t)1 << 11)
+#define HDR_STRING_INDIRECT ((uintptr_t)1 << 12)
+#define HDR_LARGE ((uintptr_t)1 << 15)
+#define HDR_SIZE_SHIFT 16
+
 typedef struct obj {
-    enum heapvar_type_t type;
-    size_t size;
-    char age, mark, moved;
-    struct obj *forward;
+    uintptr_t header;
     union {
+        // moved objects
+        struct obj *forward;
+        // free chunk in the old generation
+        struct obj *next_free;
         // bigint
         struct {
             long bigint_size, sign;
             uint64_t digits[1];
         };
+        // flonum
+        double flonum;
         // rational
         struct {
             ptr numerator, denominator;
@@ -128,22 +312,34 @@ typedef struct obj {
             long bytevector_size;
             uint8_t bytes[1];
         };
-        // string
+        // f64vector; unboxed doubles
+        struct {
+            long f64vector_size;
+            double f64[1];
+        };
+        // string; code units are latin-1 bytes unless HDR_STRING_WIDE is
+        // set. storing a character above 0xff into a narrow string moves its
+        // contents to a wide copy, which string_target then refers to
+        // (HDR_STRING_INDIRECT).
         struct {
             long string_size;
-            char_t string[1];
+            union {
+                uint8_t string_narrow[1];
+                char_t string[1];
+                ptr string_target;
+            };
         };
         // environment
         struct {
-            ptr batch_env_father[BATCH_FATHER_SIZE];
             long env_size;
             ptr entry[1];
         };
-        // activation record
+        // activation record. slot[] starts with a display of the records of
+        // the enclosing scopes, innermost first, as many as the scope is
+        // nested in, followed by the variables.
         struct {
-            ptr batch_ar_father[BATCH_FATHER_SIZE];
-            long ar_size;
-            ptr value[1];
+            long ar_size, ar_fathers;
+            ptr slot[1];
         };
         // procedure
         struct {
@@ -163,31 +359,218 @@ typedef struct obj {
             long id, struct_size;
             ptr field[1];
         };
-        // code
+        // code; code_stack is the most stack slots it uses at once, and
+        // code_name the symbol the procedure was defined as, #f if it is
+        // anonymous and #t for toplevel code
         struct {
-            long code_size;
+            long code_size, code_stack;
+            ptr code_name;
             instruction instructions[1];
         };
     };
 } obj;
 
-// we use a hash table from string to index for our obarray
-#define OBARRAY_HASH_P 10007
-#define OBARRAY_HASH_E 307
+#define OBJ_HEADER_SIZE offsetof(obj, forward)
+_Static_assert(OBJ_HEADER_SIZE == sizeof(uintptr_t), "one-word header");
+
+static inline enum heapvar_type_t obj_type(obj *o) {
+    return o->header & HDR_TYPE_MASK;
+}
+static inline size_t obj_size(obj *o) {
+    return (o->header >> HDR_SIZE_SHIFT) * GC_ALIGNMENT;
+}
+static inline int obj_age(obj *o) {
+    return (o->header & HDR_AGE_MASK) >> HDR_AGE_SHIFT;
+}
+static inline void obj_grow_older(obj *o) {
+    if ((o->header & HDR_AGE_MASK) != HDR_AGE_MASK)
+        o->header += (uintptr_t)1 << HDR_AGE_SHIFT;
+}
+static inline int obj_marked(obj *o) { return (o->header & HDR_MARK) != 0; }
+static inline void obj_set_mark(obj *o, int mark) {
+    o->header = mark ? o->header | HDR_MARK : o->header & ~HDR_MARK;
+}
+static inline int obj_moved(obj *o) { return (o->header & HDR_MOVED) != 0; }
+static inline void obj_set_forward(obj *o, obj *to) {
+    o->header |= HDR_MOVED;
+    o->forward = to;
+}
+
+static inline enum stackvar_type_t ptr_type(ptr p) {
+    switch (PTR_TAG(p)) {
+        case TAG_FIXNUM:
+            return T_FIXNUM;
+        case TAG_POINTER:
+            return obj_type(ptr_pointer(p)) == H_FLONUM ? T_FLONUM : T_PTR;
+        case TAG_SYMBOL:
+            return T_SYMBOL;
+        case TAG_CHARACTER:
+            return T_CHARACTER;
+        case TAG_PRIMITIVE:
+            return T_PRIMITIVE;
+        case TAG_BOOLEAN:
+            return T_BOOLEAN;
+        default:
+            switch (p.bits >> PTR_TAG_BITS) {
+                case S_EOF:
+                    return T_EOF;
+                case S_NIL:
+                    return T_NIL;
+                case S_VOID:
+                    return T_VOID;
+                default:
+                    return T_UNBOUND;
+            }
+    }
+}
+
+static inline double ptr_flonum(ptr p) { return ptr_pointer(p)->flonum; }
+
+// the object holding the characters of string s
+static inline obj *string_chars(ptr s) {
+    obj *o = ptr_pointer(s);
+    return o->header & HDR_STRING_INDIRECT ? ptr_pointer(o->string_target) : o;
+}
+static inline long string_length(ptr s) { return ptr_pointer(s)->string_size; }
+static inline char_t string_ref(ptr s, long i) {
+    obj *o = string_chars(s);
+    return o->header & HDR_STRING_WIDE ? o->string[i] : o->string_narrow[i];
+}
+
+// generic arithmetic over the numeric tower fixnum -> bigint -> rational ->
+// flonum -> complex. integers in fixnum range are always fixnums, rationals
+// are in lowest terms with a denominator above 1, and complexes have an
+// imaginary part other than exact 0. since fixnums have tag 0, the tagged
+// words of two fixnums add, subtract and compare as they are; the inline
+// paths only leave for s3.c on overflow or other operand types.
+_Static_assert(TAG_FIXNUM == 0, "fixnum arithmetic works on tagged words");
+
+ptr num_add_slow(struct gc_t *gc, ptr a, ptr b);
+ptr num_sub_slow(struct gc_t *gc, ptr a, ptr b);
+ptr num_mul_slow(struct gc_t *gc, ptr a, ptr b);
+// -1, 0 or 1 for real a and b, or NUM_UNORDERED if either is a nan
+#define NUM_UNORDERED 2
+int num_compare_slow(ptr a, ptr b);
+int num_equal_slow(ptr a, ptr b);
+// exact division by zero is fatal
+ptr num_div(struct gc_t *gc, ptr a, ptr b);
+ptr num_negate(struct gc_t *gc, ptr a);
+// truncating division of integers
+ptr num_quotient(struct gc_t *gc, ptr a, ptr b);
+ptr num_remainder(struct gc_t *gc, ptr a, ptr b);
+ptr make_rectangular(struct gc_t *gc, ptr re, ptr im);
+int number_p(ptr a);
+int integer_p(ptr a);
+
+static inline int fixnums_p(ptr a, ptr b) {
+    return !((a.bits | b.bits) & PTR_TAG_MASK);
+}
+
+static inline ptr num_add(struct gc_t *gc, ptr a, ptr b) {
+    int64_t r;
+    if (fixnums_p(a, b) &&
+        !__builtin_add_overflow((int64_t)a.bits, (int64_t)b.bits, &r))
+        return (ptr){(uintptr_t)r};
+    return num_add_slow(gc, a, b);
+}
+
+static inline ptr num_sub(struct gc_t *gc, ptr a, ptr b) {
+    int64_t r;
+    if (fixnums_p(a, b) &&
+        !__builtin_sub_overflow((int64_t)a.bits, (int64_t)b.bits, &r))
+        return (ptr){(uintptr_t)r};
+    return num_sub_slow(gc, a, b);
+}
+
+// (x << 3) * y is the tagged word of x * y
+static inline ptr num_mul(struct gc_t *gc, ptr a, ptr b) {
+    int64_t r;
+    if (fixnums_p(a, b) &&
+        !__builtin_mul_overflow((int64_t)a.bits, ptr_fixnum(b), &r))
+        return (ptr){(uintptr_t)r};
+    return num_mul_slow(gc, a, b);
+}
+
+static inline int num_compare(ptr a, ptr b) {
+    if (fixnums_p(a, b))
+        return ((int64_t)a.bits > (int64_t)b.bits) -
+               ((int64_t)a.bits < (int64_t)b.bits);
+    return num_compare_slow(a, b);
+}
+
+static inline int num_lt(ptr a, ptr b) {
+    if (fixnums_p(a, b)) return (int64_t)a.bits < (int64_t)b.bits;
+    return num_compare_slow(a, b) == -1;
+}
+static inline int num_le(ptr a, ptr b) {
+    if (fixnums_p(a, b)) return (int64_t)a.bits <= (int64_t)b.bits;
+    return (unsigned)(num_compare_slow(a, b) + 1) <= 1;
+}
+static inline int num_gt(ptr a, ptr b) { return num_lt(b, a); }
+static inline int num_ge(ptr a, ptr b) { return num_le(b, a); }
+// also defined for complex numbers
+static inline int num_eq(ptr a, ptr b) {
+    if (fixnums_p(a, b)) return a.bits == b.bits;
+    return num_equal_slow(a, b);
+}
+
+// f64vectors hold unboxed doubles, and the bulk operations below run over
+// them two lanes at a time with sse2. folds and dot products keep several
+// partial results, so their rounding may differ from a left-to-right loop.
+enum f64_op_t {
+    F64_ADD,
+    F64_SUB,
+    F64_MUL,
+    F64_DIV,
+    F64_MIN,
+    F64_MAX,
+};
+
+ptr make_f64vector(struct gc_t *gc, long n, double fill);
+static inline long f64vector_length(ptr v) {
+    return ptr_pointer(v)->f64vector_size;
+}
+static inline double f64vector_ref(ptr v, long i) {
+    return ptr_pointer(v)->f64[i];
+}
+static inline void f64vector_set(ptr v, long i, double x) {
+    ptr_pointer(v)->f64[i] = x;
+}
+// a new vector of a[i] op b[i]; the lengths must agree
+ptr f64vector_map(struct gc_t *gc, enum f64_op_t op, ptr a, ptr b);
+// a new vector of a[i] op x
+ptr f64vector_map_scalar(struct gc_t *gc, enum f64_op_t op, ptr a, double x);
+// x op a[0] op a[1] ..., for F64_ADD, F64_MUL, F64_MIN and F64_MAX
+double f64vector_fold(enum f64_op_t op, ptr a, double x);
+double f64vector_dot(ptr a, ptr b);
+
+// we use a hash table from string to index for our obarray. nodes keep their
+// hash and length, so that collisions are mostly rejected without comparing
+// strings and resizing does not rehash; the table doubles once it holds
+// OBARRAY_LOAD nodes per bucket. names maps a symbol index back to its node.
+#define OBARRAY_INITIAL_SIZE 1024
+#define OBARRAY_LOAD 1
 
 typedef struct obarray_node_t {
-    char_t *s;
-    long index;
     struct obarray_node_t *next;
+    uint64_t hash;
+    long index, length;
+    char_t s[];
 } obarray_node_t;
 
 typedef struct obarray_t {
-    obarray_node_t *heads[OBARRAY_HASH_P];
+    obarray_node_t **heads;
+    long size;  // buckets, a power of two
     long count;
+    obarray_node_t **names;
+    long names_size;
 } obarray_t;
 
 void obarray_init(obarray_t *obarray);
 ptr obarray_intern(obarray_t *obarray, const char_t *s);
+ptr obarray_intern_n(obarray_t *obarray, const char_t *s, long n);
+// the null-terminated name of a symbol, and its length if length is not NULL
+const char_t *obarray_name(obarray_t *obarray, ptr sym, long *length);
 
 typedef struct ptr_move_transform_t {
     uint8_t *from, *to;
@@ -198,81 +581,477 @@ ptr_move_transform_t make_transform(uint8_t *from, uint8_t *to, size_t size);
 uint8_t *apply_transform(ptr_move_transform_t t, uint8_t *p);
 obj *apply_transform_obj(ptr_move_transform_t t, obj *p);
 
-#define GC_THRESHOLD_AGE 8
-#define GC_INITIAL_SIZE (1 << 20)
-#define GC_OLD_TO_YOUNG_RATIO 2
-#define GC_GROW_RATIO 2
-#define GC_ALIGNMENT (sizeof(intmax_t))
-#define HASH_SIZE 10007
-
-#define GEN_HASHTABLE(valtype, name)                                      \
-    typedef struct name##_hashtable_node {                                \
-        obj *k;                                                           \
-        valtype v;                                                        \
-        struct name##_hashtable_node *next;                               \
-    } name##_hashtable_node;                                              \
-                                                                          \
-    typedef struct name##_hashtable_t {                                   \
-        name##_hashtable_node *heads[HASH_SIZE];                          \
-    } name##_hashtable_t;                                                 \
-                                                                          \
-    void name##_init(name##_hashtable_t *t) {                             \
-        for (int i = 0; i < HASH_SIZE; i++) t->heads[i] = NULL;           \
-    }                                                                     \
-                                                                          \
-    void name##_insert(name##_hashtable_t *t, obj *k, valtype v) {        \
-        int h = ((intptr_t)k) % HASH_SIZE;                                \
-        for (name##_hashtable_node *u = t->heads[h]; u; u = u->next)      \
-            if (u->k == k) return;                                        \
-        name##_hashtable_node *u = malloc(sizeof(name##_hashtable_node)); \
-        u->next = t->heads[h];                                            \
-        u->k = k;                                                         \
-        u->v = v;                                                         \
-        t->heads[h] = u;                                                  \
-    }
-
-GEN_HASHTABLE(char, remset)
-GEN_HASHTABLE(obj *, forward)
-
 // when allocating:
 // if the young generation size limit is not reached after allocation,
 // allocate from the young generation. otherwise, reclaim space from the
-// young generation through a copying GC. if needed, grow the young
-// generation. then tenure objects old enough, growing the old generation
-// when needed. if the old generation is grown, trigger a mark-and-compact
-// GC with the stack as the root.
+// young generation through a copying GC, tenuring objects old enough into the
+// old generation as they are copied. if the old generation fills up, trigger a
+// mark-and-compact GC with the stack as the root, and grow the heap if that
+// does not free enough space.
+
+// old-to-young references are tracked with a card table over the old
+// generation. stores into heap objects must go through GC_STORE (or call
+// gc_write_barrier with the stored value after the store), which dirties the
+// card holding the object's header. a minor collection scans the objects
+// starting in dirty cards only.
+#define GC_CARD_SIZE 512
+#define GC_CARD_NONE 0
+
+// the old generation is swept into size-segregated free lists after a major
+// collection, and compacted only when the bytes left on the free lists exceed
+// GC_FRAGMENTATION_PERCENT of it
+#define GC_FREE_CLASSES 32
+#define GC_FRAGMENTATION_PERCENT 25
+
+// objects of GC_LARGE_SIZE bytes or more are allocated in the large-object
+// space instead, each in a page-aligned mapping of its own after a
+// gc_large_t. they never move: a major collection marks them in their header
+// and unmaps the dead ones. in place of cards, a dirty flag remembers the
+// ones that may refer to young objects. a major collection runs when the
+// space grows past large_limit.
+#define GC_LARGE_SIZE (64 << 10)
 
-// hand-emit write barriers for the remset
+typedef struct gc_large_t {
+    struct gc_large_t *next;
+    size_t size;  // of the mapping
+    int dirty;
+    int fresh;  // allocated during incremental marking
+} gc_large_t;
+
+#define GC_LARGE_HEADER \
+    ((sizeof(gc_large_t) + GC_ALIGNMENT - 1) / GC_ALIGNMENT * GC_ALIGNMENT)
+
+static inline obj *gc_large_obj(gc_large_t *l) {
+    return (obj *)((uint8_t *)l + GC_LARGE_HEADER);
+}
+static inline gc_large_t *gc_large_of(obj *o) {
+    return (gc_large_t *)((uint8_t *)o - GC_LARGE_HEADER);
+}
+
+// with a step budget set (S3_GC_STEP_KB bytes scanned and/or S3_GC_STEP_US
+// microseconds, or gc_set_incremental), the old generation is marked
+// incrementally once it is GC_INCREMENTAL_START_PERCENT full, one step every
+// GC_STEP_INTERVAL bytes of young allocation, and swept when marking is done.
+// the write barrier then also shades the stored value.
+#define GC_INCREMENTAL_START_PERCENT 40
+#define GC_STEP_INTERVAL (64 << 10)
+
+// each mutator thread attached with gc_attach (gc_init attaches the calling
+// thread) bump-allocates from its own GC_TLAB_SIZE buffer and has its own
+// roots: slots registered one at a time with gc_preserve, and frames of local
+// slots pushed with GC_LOCALS. threads must reach a safepoint regularly for
+// collections to proceed: allocating does, otherwise call gc_safepoint, or
+// detach around blocking calls.
+#define GC_TLAB_SIZE (32 << 10)
+#define GC_ROOTS_INITIAL_SIZE 1024
+
+// major collections run on up to GC_MAX_THREADS threads; the default is one
+// per online cpu, overridden by the S3_GC_THREADS environment variable or
+// gc_set_threads
+#define GC_MAX_THREADS 64
+#define GC_MARK_STACK_SIZE 4096  // initial deque size, a power of two
+#define GC_PREFETCH_DISTANCE 8
+
+typedef struct gc_deque_buf_t {
+    long size;
+    struct gc_deque_buf_t *prev;  // outgrown buffers
+    obj *slot[];
+} gc_deque_buf_t;
+
+// work-stealing deque of objects to scan
+typedef struct gc_deque_t {
+    long top, bottom;
+    gc_deque_buf_t *buf;
+} gc_deque_t;
+
+typedef struct gc_worker_t {
+    struct gc_t *gc;
+    int id;
+    pthread_t thread;
+    gc_deque_t deque;
+    size_t census_count[H_TYPES], census_bytes[H_TYPES];
+} gc_worker_t;
+
+typedef void (*gc_job_t)(struct gc_t *gc, gc_worker_t *w);
+
+// collection telemetry, totals since gc_init. pauses are the times the world
+// stays stopped, binned by the log2 of their length: bucket k counts those of
+// [2^(k-1), 2^k) microseconds, bucket 0 those under a microsecond. with
+// S3_GC_TRACE set, every collection is also logged to stderr, and
+// gc_stats_report prints the totals.
+#define GC_PAUSE_BUCKETS 32
+
+typedef struct gc_stats_t {
+    long minor_count, major_count, cycle_count, grow_count;
+    long minor_ns, major_ns, cycle_ns;  // wall time spent in each
+    long pause_count, pause_ns, pause_max_ns;
+    long pauses[GC_PAUSE_BUCKETS];
+    size_t allocated;  // as of the last collection
+    size_t copied;     // survivors copied within the young generation
+    size_t promoted;   // tenured
+    long remembered;   // dirty cards and large objects scanned
+    size_t scanned;    // bytes of old objects scanned for them
+    size_t live;       // after the last major collection or cycle
+    size_t freed;      // by major collections and cycles
+    size_t compacted;  // slid by major collections
+} gc_stats_t;
+
+// allocation sampling, set up with gc_set_sampling: at random intervals of
+// sample_bytes on average, gc_alloc calls the sample hook before allocating,
+// with the bytes the sample stands for. the hook must not allocate in the
+// heap. major collections then also count the live objects and bytes of each
+// type while marking, into census_count and census_bytes.
+typedef void (*gc_sample_t)(struct gc_t *gc, enum heapvar_type_t type,
+                            long size, size_t weight);
+
+// side tables for sliding one space during a major collection. the space is
+// compacted in regions of GC_REGION_BLOCKS blocks of GC_BLOCK_WORDS words.
+#define GC_BLOCK_WORDS 64
+#define GC_BLOCK_SIZE (GC_BLOCK_WORDS * GC_ALIGNMENT)
+#define GC_REGION_BLOCKS 512
+#define GC_REGION_SIZE (GC_REGION_BLOCKS * GC_BLOCK_SIZE)
+
+typedef struct gc_compact_t {
+    uint8_t *start, *end, *free;
+    // live object starts, one bit per word
+    uint64_t *live;
+    // live bytes, then destination of the first live object, per block
+    uintptr_t *block_dest;
+    long blocks, max_blocks;
+
+    size_t *region_live;
+    uint8_t **region_dest, **region_src_end;
+    long *region_wait;  // first earlier region overlapping the destination
+    int *region_done;
+    long regions, max_regions;
+
+    int sweep;  // mark-sweep in place instead of sliding
+} gc_compact_t;
+
+// a frame covers count consecutive root slots, usually a local array
+typedef struct gc_frame_t {
+    struct gc_frame_t *prev;
+    ptr *slots;
+    long count;
+} gc_frame_t;
+
+typedef struct gc_thread_t {
+    struct gc_t *gc;
+    uint8_t *tlab_alloc, *tlab_end;
+
+    ptr **stack;
+    long stack_size, sp;
+    gc_frame_t *frames;
+
+    // objects shaded by the write barrier during incremental marking
+    obj **gray;
+    long gray_size, gray_sp;
+
+    long sample_left;  // bytes to allocate before the next sample
+    uint64_t sample_seed;  // of the intervals between samples
+
+    struct gc_thread_t *next;
+} gc_thread_t;
 
 typedef struct gc_t {
     uint8_t *young_from, *young_to, *young_alloc, *young_scan, *old, *old_alloc;
     long young_size, old_size;
+    uint8_t *young_limit;  // soft end of the young generation for new buffers
 
-    ptr **stack;
-    long stack_size, sp;
+    // one byte per card: dirty flag, and one plus the offset in words of the
+    // first object starting in the card (GC_CARD_NONE if there is none)
+    uint8_t *cards, *card_first;
+    int tenure_failed;
+
+    // free chunks of the old generation: free_lists[k] holds chunks of
+    // exactly k words, free_lists[0] the ones of GC_FREE_CLASSES words or more
+    obj *free_lists[GC_FREE_CLASSES];
+    size_t old_free;
+    // objects tenured during a minor collection, still to be scanned
+    obj **promoted;
+    long promoted_size, promoted_sp;
+
+    gc_compact_t compact[2];
 
-    remset_hashtable_t remset;
+    // major collection thread pool
+    int threads;
+    gc_worker_t *workers;
+    pthread_mutex_t pool_lock;
+    pthread_cond_t pool_start, pool_done;
+    gc_job_t pool_job;
+    long pool_epoch;
+    int pool_finished;
+    int mark_idle;
+    long region_next;
+
+    // incremental marking
+    int marking;
+    long step_bytes, step_ns;
+
+    // mutator threads; stop is set while a collection waits for the others to
+    // park, running counts the threads that have not
+    gc_thread_t *mutators;
+    pthread_mutex_t lock;
+    pthread_cond_t stopped, resumed;
+    int stop;
+    long running;
+
+    // the root slots of all threads, gathered at the start of a collection
+    ptr **roots;
+    long roots_size, roots_count;
+
+    gc_large_t *large;
+    size_t large_bytes, large_limit;
+
+    gc_stats_t stats;
+    int trace;
+    long pause_start;
+    size_t young_survived;  // young bytes left by the last collection
+
+    long sample_bytes;
+    gc_sample_t sample;
+    int census;  // while marking for a major collection with sampling on
+    size_t census_count[H_TYPES], census_bytes[H_TYPES];
 } gc_t;
 
+// the mutator thread of the calling thread
+extern _Thread_local gc_thread_t *gc_current;
+
+static inline void gc_push_frame(gc_frame_t *f, ptr *slots, long count) {
+    f->prev = gc_current->frames;
+    f->slots = slots;
+    f->count = count;
+    gc_current->frames = f;
+}
+
+static inline void gc_pop_frame(gc_frame_t *f) { gc_current->frames = f->prev; }
+
+// declares n local roots, initialized to fixnum 0, with one frame push; pop
+// them with GC_UNLOCALS(name) before leaving the scope
+#define GC_LOCALS(name, n)   \
+    ptr name[n] = {{0}};     \
+    gc_frame_t name##_frame; \
+    gc_push_frame(&name##_frame, name, n)
+#define GC_UNLOCALS(name) gc_pop_frame(&name##_frame)
+
+void gc_shade(gc_t *gc, ptr v);
+void gc_park(gc_t *gc);
+
+static inline void gc_safepoint(gc_t *gc) {
+    if (__atomic_load_n(&gc->stop, __ATOMIC_ACQUIRE)) gc_park(gc);
+}
+
+static inline void gc_card_mark(gc_t *gc, obj *o) {
+    uintptr_t offset = (uint8_t *)o - gc->old;
+    if (offset < (uintptr_t)gc->old_size)
+        gc->cards[offset / GC_CARD_SIZE] = 1;
+    else if (o->header & HDR_LARGE)
+        gc_large_of(o)->dirty = 1;
+}
+
+static inline void gc_write_barrier(gc_t *gc, obj *o, ptr v) {
+    gc_card_mark(gc, o);
+    if (gc->marking) gc_shade(gc, v);
+}
+
+#define GC_STORE(gc, o, member, v)      \
+    do {                                \
+        obj *o_ = (o);                  \
+        ptr v_ = (v);                   \
+        o_->member = v_;                \
+        gc_write_barrier((gc), o_, v_); \
+    } while (0)
+
+void gc_init(gc_t *gc);
+void gc_set_threads(gc_t *gc, int threads);
+void gc_set_incremental(gc_t *gc, long step_kb, long step_us);
+void gc_set_sampling(gc_t *gc, long sample_bytes, gc_sample_t sample);
+gc_thread_t *gc_attach(gc_t *gc);
+void gc_detach(gc_t *gc);
 int young_pointer_p(gc_t *gc, ptr p);
 int check_young_refs(gc_t *gc, obj *p);
 void copy_refs(gc_t *gc, obj *p);
-void resolve_pointers(gc_t *gc, obj *p);
 void fill_header(obj *o, enum heapvar_type_t type, long size);
 ptr gc_alloc(gc_t *gc, enum heapvar_type_t type, long size);
-// returns whether the old generation has ever been filled up during tenuring
-// (whether a major collection is needed)
+// returns whether the old generation has filled up during tenuring (whether a
+// major collection is needed)
 int gc_minor(gc_t *gc);
 ptr gc_copy(gc_t *gc, ptr p);
-void gc_mark(obj *p);
+void gc_mark(gc_t *gc, obj *p);
 void gc_major(gc_t *gc);
 void gc_grow(gc_t *gc);
+void gc_update_limit(gc_t *gc);
 void gc_preserve(gc_t *gc, ptr *p);
 void gc_release(gc_t *gc, long count);
+void gc_stats_report(gc_t *gc, FILE *f);
+
+// the keywords the compiler recognizes, interned by ctx_init
+enum syntax_t {
+    SYNTAX_QUOTE,
+    SYNTAX_IF,
+    SYNTAX_DEFINE,
+    SYNTAX_SET,
+    SYNTAX_LAMBDA,
+    SYNTAX_BEGIN,
+    SYNTAX_LET,
+    SYNTAX_LET_STAR,
+    SYNTAX_LETREC,
+    SYNTAX_LETREC_STAR,
+    SYNTAX_COND,
+    SYNTAX_ELSE,
+    SYNTAX_AND,
+    SYNTAX_OR,
+    SYNTAX_WHEN,
+    SYNTAX_UNLESS,
+    SYNTAX_COUNT,
+};
 
+// where sampled allocations happened: the name of the code running (its
+// code_name) and the instruction index in it, -1 outside the vm, with the
+// primitive called there if any (#f otherwise), and the type allocated
+typedef struct alloc_site_t {
+    ptr name, primitive;
+    long pc;
+    enum heapvar_type_t type;
+    size_t samples, bytes;
+} alloc_site_t;
+
+// env is the global environment, whose entry[i] holds the value of the
+// symbol with index i, or unbound. when the S3_VM_PROFILE environment
+// variable is set, the vm counts the pairs of consecutively dispatched
+// opcodes in opcode_pairs[first * O_OPCODE_COUNT + second]. setting
+// S3_VM_FUSE=0 turns off superinstructions. globals_epoch is a fixnum bumped
+// whenever a global changes from or to a primitive, invalidating every
+// primitive call's cache.
+//
+// when S3_ALLOC_PROFILE names a file, allocations are sampled about every
+// S3_ALLOC_SAMPLE bytes into the alloc_sites hash table, and
+// alloc_profile_report writes them there. any attached thread may take a
+// sample, so the table is guarded by alloc_sites_lock. vm_code and vm_pc point
+// to the running vm's code and saved instruction index.
 typedef struct ctx_t {
     gc_t memory;
     ptr env;
+    obarray_t obarray;
+    ptr syntax[SYNTAX_COUNT];
+    port_t in, out;
+    ptr globals_epoch;
+    uint64_t *opcode_pairs;
+    int fuse;
+    ptr *vm_code;
+    long *vm_pc;
+    const char *alloc_profile;
+    alloc_site_t *alloc_sites;
+    long alloc_sites_count, alloc_sites_size;
+    pthread_mutex_t alloc_sites_lock;
 } ctx_t;
 
+// primitives are called with their arguments in place on the vm stack, which
+// the collector updates; max_args is -1 for any number
+typedef ptr (*primitive_fn_t)(ctx_t *ctx, ptr *args, long n);
+typedef struct primitive_t {
+    const char *name;
+    int min_args, max_args;
+    primitive_fn_t fn;
+} primitive_t;
+extern const primitive_t primitives[];
+
+// sets up the heap, the obarray, stdin and stdout ports, and the global
+// environment with the primitives bound
+void ctx_init(ctx_t *ctx);
+// sets up the same from a heap image written by ctx_dump_image, with the
+// symbols and global environment of the dumping context
+void ctx_init_image(ctx_t *ctx, const char *path);
+void ctx_dump_image(ctx_t *ctx, const char *path);
+void define_global(ctx_t *ctx, ptr sym, ptr value);
+// reads one datum, or returns eof at the end of the port
+ptr ctx_read(ctx_t *ctx, port_t *port);
+// display leaves strings and characters unquoted
+void ctx_write(ctx_t *ctx, port_t *port, ptr x, int display);
+// compiles an expression into an H_CODE object for vm_run
+ptr compile(ctx_t *ctx, ptr x);
+ptr vm_run(ctx_t *ctx, ptr code);
+// writes the most frequent opcode pairs, if profiling
+void vm_profile_report(ctx_t *ctx, FILE *f);
+// writes the allocation sites to the S3_ALLOC_PROFILE file in the folded
+// stack format of flamegraph.pl, weighted by bytes, and the live heap by type
+// at the last major collection to f
+void alloc_profile_report(ctx_t *ctx, FILE *f);
+ptr eval(ctx_t *ctx, ptr x);
+
+// ahead-of-time compilation. aot_compile translates a program, the list of
+// its expressions, into C source for an executable that runs it on this
+// runtime. the procedures of such a program are native: their code is #f,
+// their body the address of their C function, aligned so that it reads as a
+// fixnum, and their p_env the vector of the values they close over, or #f.
+// the program's constants are static objects, outside the heap, so mutating
+// a quoted datum faults.
+typedef ptr (*aot_fn_t)(ctx_t *ctx, ptr self, ptr *args, long n);
+void aot_compile(ctx_t *ctx, ptr forms, FILE *out);
+
+// the runtime side of compiled programs. aot_run runs program, which sets up
+// ctx, on a thread with a stack deep enough for the recursion the vm's
+// heap-allocated stack allows. aot_symbols interns the n symbol names of the
+// compiling context, given by their lengths and concatenated characters,
+// checking that they get the same indices. aot_globals fills the program's
+// globals with their values in the global environment.
+#define AOT_CONSTANT(words) ((ptr){(uintptr_t)(words) + TAG_POINTER})
+void aot_run(ctx_t *ctx, void (*program)(ctx_t *ctx));
+void aot_symbols(ctx_t *ctx, const char_t *names, const long *lengths,
+                 long n);
+void aot_globals(ctx_t *ctx, ptr *globals, const long *symbols, long n);
+ptr aot_closure(ctx_t *ctx, aot_fn_t fn, ptr env);
+ptr aot_call(ctx_t *ctx, ptr f, ptr *args, long n);
+// prints "aot: message: x" to stderr and aborts
+ptr aot_fatal(ctx_t *ctx, const char *message, ptr x);
+
+static inline ptr aot_bound(ctx_t *ctx, ptr value, ptr sym) {
+    if (eq_p(value, make_unbound())) aot_fatal(ctx, "unbound variable", sym);
+    return value;
+}
+
+// the ith value a closure closes over
+static inline ptr aot_free(ptr self, long i) {
+    return ptr_pointer(ptr_pointer(self)->p_env)->vector[i];
+}
+
+// captured variables that may change live in the car of a pair
+static inline ptr aot_unbox(ptr box) { return ptr_pointer(box)->car; }
+
+// the primitives compiled code expands inline
+static inline int aot_pair_p(ptr x) {
+    return pointer_p(x) && obj_type(ptr_pointer(x)) == H_PAIR;
+}
+static inline ptr aot_car(ptr x) {
+    if (!aot_pair_p(x)) FATAL("car: not a pair");
+    return ptr_pointer(x)->car;
+}
+static inline ptr aot_cdr(ptr x) {
+    if (!aot_pair_p(x)) FATAL("cdr: not a pair");
+    return ptr_pointer(x)->cdr;
+}
+static inline obj *aot_vector(ptr v, const char *who) {
+    if (!pointer_p(v) || obj_type(ptr_pointer(v)) != H_VECTOR)
+        FATAL("%s: not a vector", who);
+    return ptr_pointer(v);
+}
+static inline long aot_index(ptr i, long size, const char *who) {
+    if (!fixnum_p(i) || ptr_fixnum(i) < 0 || ptr_fixnum(i) >= size)
+        FATAL("%s: bad index", who);
+    return ptr_fixnum(i);
+}
+static inline ptr aot_vector_length(ptr v) {
+    return make_fixnum(aot_vector(v, "vector-length")->vector_size);
+}
+static inline ptr aot_vector_ref(ptr v, ptr i) {
+    obj *o = aot_vector(v, "vector-ref");
+    return o->vector[aot_index(i, o->vector_size, "vector-ref")];
+}
+static inline ptr aot_vector_set(ctx_t *ctx, ptr v, ptr i, ptr x) {
+    obj *o = aot_vector(v, "vector-set!");
+    long k = aot_index(i, o->vector_size, "vector-set!");
+    GC_STORE(&ctx->memory, o, vector[k], x);
+    return make_void();
+}
+
 #endif
@@ -1,3 +1,851 @@
 #include "s3.h"
 
-int main() {}
+#include <math.h>
+#include <unistd.h>
+
+// each test starts from a fresh heap. a failed check is reported and counted,
+// and the tests carry on.
+static int failures;
+
+#define CHECK(c)                                                         \
+    do {                                                                 \
+        if (!(c)) {                                                      \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #c); \
+            failures++;                                                  \
+        }                                                                \
+    } while (0)
+
+static gc_t *new_heap(void) {
+    gc_t *gc = calloc(1, sizeof(gc_t));
+    gc_init(gc);
+    return gc;
+}
+
+static ptr new_pair(gc_t *gc, ptr car, ptr cdr) {
+    ptr p = gc_alloc(gc, H_PAIR, 2 * sizeof(ptr));
+    ptr_pointer(p)->car = car;
+    ptr_pointer(p)->cdr = cdr;
+    return p;
+}
+
+static ptr new_vector(gc_t *gc, long n) {
+    ptr v = gc_alloc(gc, H_VECTOR,
+                     offsetof(obj, vector) - OBJ_HEADER_SIZE + n * sizeof(ptr));
+    ptr_pointer(v)->vector_size = n;
+    for (long i = 0; i < n; i++) ptr_pointer(v)->vector[i] = make_bool(0);
+    return v;
+}
+
+static void collect(gc_t *gc, int major) {
+    if (gc_minor(gc) || major) gc_major(gc);
+}
+
+static ctx_t *new_ctx(void) {
+    ctx_t *ctx = calloc(1, sizeof(ctx_t));
+    ctx_init(ctx);
+    return ctx;
+}
+
+// evaluates the expressions in source, returning the value of the last
+static ptr eval_source(ctx_t *ctx, const char *source) {
+    FILE *f = tmpfile();
+    fputs(source, f);
+    rewind(f);
+    port_t in;
+    port_open(&in, f, 0);
+    GC_LOCALS(l, 2);  // the expression read and the last value
+    while (!eq_p(l[0] = ctx_read(ctx, &in), make_eof()))
+        l[1] = eval(ctx, l[0]);
+    port_close(&in);
+    fclose(f);
+    ptr v = l[1];
+    GC_UNLOCALS(l);
+    return v;
+}
+
+// x as write prints it, in a malloc'd string
+static char *written(ctx_t *ctx, ptr x) {
+    FILE *f = tmpfile();
+    port_t out;
+    port_open(&out, f, 1);
+    ctx_write(ctx, &out, x, 0);
+    port_close(&out);
+    long n = ftell(f);
+    char *s = malloc(n + 1);
+    rewind(f);
+    s[fread(s, 1, n, f)] = 0;
+    fclose(f);
+    return s;
+}
+
+static void expect(ctx_t *ctx, const char *source, const char *want) {
+    char *got = written(ctx, eval_source(ctx, source));
+    if (strcmp(got, want) != 0) {
+        fprintf(stderr, "failed: %s\n  got  %s\n  want %s\n", source, got,
+                want);
+        failures++;
+    }
+    free(got);
+}
+
+// whether v[i] is a pair whose car is the fixnum i + k, for each i
+static int pairs_p(ptr v, long k) {
+    obj *o = ptr_pointer(v);
+    for (long i = 0; i < o->vector_size; i++) {
+        ptr p = o->vector[i];
+        if (!pointer_p(p) || obj_type(ptr_pointer(p)) != H_PAIR ||
+            !eq_p(ptr_pointer(p)->car, make_fixnum(i + k)))
+            return 0;
+    }
+    return 1;
+}
+
+// old-to-young references must be found through the card table, across minor
+// and major collections
+static void test_cards(void) {
+    gc_t *gc = new_heap();
+    ptr v = new_vector(gc, 1000);
+    gc_preserve(gc, &v);
+    for (int i = 0; i < GC_THRESHOLD_AGE; i++) collect(gc, 0);
+    CHECK(!young_pointer_p(gc, v));
+    for (int round = 0; round < 3; round++) {
+        for (long i = 0; i < 1000; i++) {
+            ptr p = new_pair(gc, make_fixnum(i + round), make_nil());
+            GC_STORE(gc, ptr_pointer(v), vector[i], p);
+        }
+        collect(gc, round == 2);
+        collect(gc, 0);
+        CHECK(pairs_p(v, round));
+    }
+    gc_release(gc, 1);
+}
+
+// whether x is the list slot i of test_churn holds: i % 8 + 1 pairs counting
+// down to 0, ending in i
+static int churn_list_p(ptr x, long i) {
+    for (long k = i % 8; k >= 0; k--) {
+        if (!pointer_p(x) || obj_type(ptr_pointer(x)) != H_PAIR ||
+            !eq_p(ptr_pointer(x)->car, make_fixnum(k)))
+            return 0;
+        x = ptr_pointer(x)->cdr;
+    }
+    return eq_p(x, make_fixnum(i));
+}
+
+// old objects rewritten with young lists over and over, for many minor and
+// major collections, and incremental cycles when there is a step budget
+static void test_churn(void) {
+    gc_t *gc = new_heap();
+    long n = 65536;
+    ptr v = new_vector(gc, n), l = make_nil();
+    gc_preserve(gc, &v);
+    gc_preserve(gc, &l);
+    uint64_t seed = 1;
+    for (long step = 0; step < 1000000; step++) {
+        seed = seed * 6364136223846793005u + 1442695040888963407u;
+        long i = seed >> 33 & (n - 1);
+        l = make_fixnum(i);
+        for (long k = 0; k <= i % 8; k++) {
+            ptr p = new_pair(gc, make_fixnum(k), make_nil());
+            ptr_pointer(p)->cdr = l;
+            l = p;
+        }
+        GC_STORE(gc, ptr_pointer(v), vector[i], l);
+    }
+    int ok = 1;
+    for (long i = 0; i < n; i++) {
+        ptr x = ptr_pointer(v)->vector[i];
+        ok &= eq_p(x, make_bool(0)) || churn_list_p(x, i);
+    }
+    CHECK(ok);
+    gc_release(gc, 2);
+}
+
+// widens an ascii string into w, terminator included
+static void widen(const char *s, char_t *w) {
+    while ((*w++ = (unsigned char)*s++))
+        ;
+}
+
+// interning many distinct symbols grows the table, and interning them again,
+// also from a longer buffer, finds the same ones
+static void test_obarray(void) {
+    obarray_t o;
+    obarray_init(&o);
+    long n = 100000;
+    ptr *syms = malloc(n * sizeof(ptr));
+    char name[32];
+    char_t w[32];
+    int distinct = 1;
+    for (long i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "sym%ld", i);
+        widen(name, w);
+        syms[i] = obarray_intern(&o, w);
+        distinct &= i == 0 || ptr_symbol(syms[i]) > ptr_symbol(syms[i - 1]);
+    }
+    CHECK(distinct);
+    CHECK(o.count >= n && o.size > OBARRAY_INITIAL_SIZE);
+    int same = 1;
+    for (long i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "sym%ld!", i);
+        widen(name, w);
+        long length, k = strlen(name) - 1;
+        same &= eq_p(obarray_intern_n(&o, w, k), syms[i]);
+        const char_t *s = obarray_name(&o, syms[i], &length);
+        same &= length == k && memcmp(s, w, k * sizeof(char_t)) == 0 &&
+                s[k] == 0;
+    }
+    CHECK(same);
+    free(syms);
+}
+
+// text with ascii runs for the fast paths and two-, three- and four-byte
+// sequences, starting shift bytes into the buffer so that a sequence is split
+// across each refill, is read back as written
+static void test_port_utf8(void) {
+    static const char_t cycle[] = {0xe9, 0x20ac, 0x1f600, 'a', 0x7f, 0x80};
+    long n = 3 * PORT_BUFFER_SIZE;
+    char_t *text = malloc(n * sizeof(char_t));
+    char_t *back = malloc(n * sizeof(char_t));
+    for (int shift = 0; shift < 4; shift++) {
+        long bytes = 0;
+        for (long i = 0; i < n; i++) {
+            if (i < PORT_BUFFER_SIZE - 4 + shift || i / 64 % 2)
+                text[i] = 'a' + i % 26;
+            else
+                text[i] = cycle[i % 6];
+            bytes += text[i] < 0x80 ? 1 : text[i] < 0x800 ? 2
+                   : text[i] < 0x10000 ? 3 : 4;
+        }
+        FILE *f = tmpfile();
+        port_t port;
+        port_open(&port, f, 1);
+        port_write_string(&port, text, n / 2);
+        for (long i = n / 2; i < n; i++) port_putc(&port, text[i]);
+        port_close(&port);
+        CHECK(ftell(f) == bytes);
+        rewind(f);
+        port_open(&port, f, 0);
+        for (long i = 0; i < n / 2; i++) back[i] = port_getc(&port);
+        for (long i = n / 2, k; i < n; i += k)
+            if (!(k = port_read_string(&port, back + i, 777))) break;
+        CHECK(memcmp(text, back, n * sizeof(char_t)) == 0);
+        CHECK(port_getc(&port) == EOF);
+        port_close(&port);
+        fclose(f);
+    }
+    free(text);
+    free(back);
+}
+
+// a port on a pipe returns what has been written so far, rather than waiting
+// for a full buffer. a port that waited would block until the alarm.
+static void test_port_pipe(void) {
+    int fd[2];
+    CHECK(pipe(fd) == 0);
+    FILE *f = fdopen(fd[0], "r");
+    port_t port;
+    port_open(&port, f, 0);
+    alarm(10);
+    static const char *writes[] = {"h\xc3\xa9", "llo\n", "\xe2\x82\xac!"};
+    static const char_t want[][4] = {{'h', 0xe9}, {'l', 'l', 'o', '\n'},
+                                     {0x20ac, '!'}};
+    for (int i = 0; i < 3; i++) {
+        CHECK(write(fd[1], writes[i], strlen(writes[i])) > 0);
+        for (int k = 0; k < 4 && want[i][k]; k++)
+            CHECK(port_getc(&port) == want[i][k]);
+    }
+    close(fd[1]);
+    CHECK(port_getc(&port) == EOF);
+    alarm(0);
+    port_close(&port);
+    fclose(f);
+}
+
+static int string_wide_p(ptr s) {
+    return (string_chars(s)->header & HDR_STRING_WIDE) != 0;
+}
+
+// whether s is n x's except for c at index i
+static int string_x_p(ptr s, long n, long i, char_t c) {
+    if (string_length(s) != n) return 0;
+    for (long k = 0; k < n; k++)
+        if (string_ref(s, k) != (k == i ? c : 'x')) return 0;
+    return 1;
+}
+
+// storing a wide character widens a narrow string in place, which survives
+// collections, and strings compare by their characters whatever their width
+static void test_strings(void) {
+    gc_t *gc = new_heap();
+    long n = 1000;
+    char_t *w = malloc(n * sizeof(char_t));
+    for (long i = 0; i < n; i++) w[i] = i == 500 ? 0x3bb : 'x';
+    ptr a = make_string_fill(gc, n, 'x'), b = make_string(gc, w, n);
+    gc_preserve(gc, &a);
+    gc_preserve(gc, &b);
+    CHECK(!string_wide_p(a) && string_wide_p(b));
+    CHECK(!string_equal_p(a, b) && string_compare(a, b) < 0);
+    string_set(gc, a, 500, 0x3bb);
+    CHECK(string_wide_p(a) && string_x_p(a, n, 500, 0x3bb));
+    CHECK(string_equal_p(a, b) && string_compare(a, b) == 0);
+    for (int i = 0; i < GC_THRESHOLD_AGE; i++) collect(gc, i == 1);
+    CHECK(string_wide_p(a) && string_x_p(a, n, 500, 0x3bb));
+    CHECK(string_equal_p(a, b));
+    ptr c = make_string_fill(gc, n, 'x');
+    string_set(gc, b, 500, 'x');
+    CHECK(string_wide_p(b) && !string_wide_p(c));
+    CHECK(string_equal_p(b, c) && string_compare(b, c) == 0);
+    CHECK(string_compare(c, a) < 0 && string_compare(a, c) > 0);
+    gc_release(gc, 2);
+    free(w);
+}
+
+// bigint_to_string(x, radix) is want
+static int bigint_is(ptr x, int radix, const char *want) {
+    char *s = bigint_to_string(x, radix);
+    int r = strcmp(s, want) == 0;
+    if (!r) fprintf(stderr, "  got %.60s\n  want %.60s\n", s, want);
+    free(s);
+    return r;
+}
+
+static ptr bigint_decimal(gc_t *gc, const char *s) {
+    return bigint_from_string(gc, s, strlen(s), 10);
+}
+
+// products, quotients, remainders and moduli, of operands around the fixnum
+// and limb boundaries
+static const char *bigint_cases[][6] = {
+    {"1152921504606846975", "1152921504606846975",
+     "1329227995784915870597964051066650625", "1", "0", "0"},
+    {"1152921504606846976", "-1152921504606846976",
+     "-1329227995784915872903807060280344576", "-1", "0", "0"},
+    {"-9223372036854775808", "9223372036854775807",
+     "-85070591730234615856620279821087277056", "-1", "-1",
+     "9223372036854775806"},
+    {"18446744073709551615", "18446744073709551617",
+     "340282366920938463463374607431768211455", "0", "18446744073709551615",
+     "18446744073709551615"},
+    {"170141183460469231731687303715884105727", "-18446744073709551616",
+     "-3138550867693340381917894711603833208032730978158307704832",
+     "-9223372036854775807", "18446744073709551615", "-1"},
+    {"10000000000000000000000000000000000000007", "100000000000000000039",
+     "1000000000000000000390000000000000000000700000000000000000273",
+     "99999999999999999961", "1528", "1528"},
+    {"-340282366920938463463374607431768211457", "2305843009213693952",
+     "-784637716923335095479473677900958302015100273567218008064",
+     "-147573952589676412928", "-1", "2305843009213693951"},
+    {"55340232221128654853", "18446744073709551616",
+     "1020847100762815390482357542663852392448", "3", "5", "5"},
+};
+
+// operands of n and m limbs from a 64-bit lcg, most significant limb first,
+// and the residues of their product from an independent implementation. the
+// sizes straddle the karatsuba and toom-3 thresholds.
+static const struct {
+    int n, m;
+    const char *mod1, *mod2;  // modulo 1000000007 and 998244353
+} bigint_sizes[] = {
+    {1, 1, "175614683", "879178485"},
+    {2, 1, "400960946", "50610566"},
+    {31, 31, "287725449", "750047875"},
+    {32, 32, "148308524", "564503697"},
+    {33, 40, "652164076", "109265340"},
+    {100, 20, "581261961", "520439451"},
+    {159, 159, "54608707", "143646228"},
+    {160, 160, "149976675", "469859115"},
+    {161, 170, "746727606", "501400171"},
+    {400, 400, "767879023", "416248789"},
+    {700, 300, "648114518", "478966637"},
+};
+
+static ptr bigint_random(gc_t *gc, uint64_t *seed, long n) {
+    char *s = malloc(16 * n + 1);
+    for (long i = 0; i < n; i++) {
+        *seed = *seed * 6364136223846793005u + 1442695040888963407u;
+        snprintf(s + 16 * i, 17, "%016llx", (unsigned long long)*seed);
+    }
+    ptr x = bigint_from_string(gc, s, 16 * n, 16);
+    free(s);
+    return x;
+}
+
+static void test_bigint(void) {
+    gc_t *gc = new_heap();
+    GC_LOCALS(l, 6);
+    for (size_t i = 0; i < sizeof(bigint_cases) / sizeof(*bigint_cases);
+         i++) {
+        const char **c = bigint_cases[i];
+        l[0] = bigint_decimal(gc, c[0]);
+        l[1] = bigint_decimal(gc, c[1]);
+        l[2] = bigint_mul(gc, l[0], l[1]);
+        CHECK(bigint_is(l[2], 10, c[2]));
+        l[3] = bigint_div(gc, l[0], l[1], &l[4]);
+        CHECK(bigint_is(l[3], 10, c[3]) && bigint_is(l[4], 10, c[4]));
+    }
+    uint64_t seed = 1;
+    for (size_t i = 0; i < sizeof(bigint_sizes) / sizeof(*bigint_sizes);
+         i++) {
+        l[0] = bigint_random(gc, &seed, bigint_sizes[i].n);
+        l[1] = bigint_random(gc, &seed, bigint_sizes[i].m);
+        l[2] = bigint_mul(gc, l[0], l[1]);
+        l[3] = bigint_mul(gc, l[1], l[0]);
+        CHECK(bigint_compare(l[2], l[3]) == 0);
+        bigint_div(gc, l[2], make_bigint(gc, 1000000007), &l[3]);
+        CHECK(bigint_is(l[3], 10, bigint_sizes[i].mod1));
+        bigint_div(gc, l[2], make_bigint(gc, 998244353), &l[3]);
+        CHECK(bigint_is(l[3], 10, bigint_sizes[i].mod2));
+        // (ab + r) / b is a, remainder r, for r = b / 3
+        l[4] = bigint_div(gc, l[1], make_bigint(gc, 3), NULL);
+        l[3] = bigint_add(gc, l[2], l[4]);
+        l[5] = bigint_div(gc, l[3], l[1], &l[3]);
+        CHECK(bigint_compare(l[5], l[0]) == 0);
+        CHECK(bigint_compare(l[3], l[4]) == 0);
+        // -ab / a is -b
+        l[3] = bigint_div(gc, bigint_negate(gc, l[2]), l[0], NULL);
+        CHECK(bigint_compare(l[3], bigint_negate(gc, l[1])) == 0);
+    }
+    // (2^k - 1)^2 is 2^2k - 2^(k+1) + 1: k/4 - 1 f's, e, k/4 - 1 0's and 1
+    static const long bits[] = {1984, 2052, 10176, 10240, 10304, 32000};
+    for (size_t i = 0; i < sizeof(bits) / sizeof(*bits); i++) {
+        long d = bits[i] / 4;
+        char *s = malloc(2 * d + 1);
+        memset(s, 'f', d);
+        l[0] = bigint_from_string(gc, s, d, 16);
+        memset(s + d - 1, 'e', 1);
+        memset(s + d, '0', d - 1);
+        strcpy(s + 2 * d - 1, "1");
+        CHECK(bigint_is(bigint_mul(gc, l[0], l[0]), 16, s));
+        free(s);
+    }
+    GC_UNLOCALS(l);
+}
+
+static double f64_apply(enum f64_op_t op, double x, double y) {
+    switch (op) {
+    case F64_ADD: return x + y;
+    case F64_SUB: return x - y;
+    case F64_MUL: return x * y;
+    case F64_DIV: return x / y;
+    case F64_MIN: return x < y ? x : y;
+    case F64_MAX: return x > y ? x : y;
+    }
+    return 0;
+}
+
+// lengths around the two-lane split. elements are small integers, so folds
+// are exact in any order.
+static void test_f64vector(void) {
+    static const long lengths[] = {0, 1, 2, 3, 7, 1000, 1001};
+    gc_t *gc = new_heap();
+    GC_LOCALS(l, 3);
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(*lengths); i++) {
+        long n = lengths[i];
+        l[0] = make_f64vector(gc, n, 0);
+        l[1] = make_f64vector(gc, n, 0);
+        double sum = 0, prod = 1, min = 1e9, max = -1e9, dot = 0;
+        for (long k = 0; k < n; k++) {
+            double a = k % 13 - 6, b = k % 5 + 1;
+            f64vector_set(l[0], k, a);
+            f64vector_set(l[1], k, b);
+            sum += a;
+            prod *= k % 3 == 0 ? a : 1;
+            min = a < min ? a : min;
+            max = a > max ? a : max;
+            dot += a * b;
+        }
+        CHECK(f64vector_fold(F64_ADD, l[0], 0) == sum);
+        CHECK(f64vector_fold(F64_MIN, l[0], 1e9) == min);
+        CHECK(f64vector_fold(F64_MAX, l[0], -1e9) == max);
+        CHECK(f64vector_dot(l[0], l[1]) == dot);
+        for (enum f64_op_t op = F64_ADD; op <= F64_MAX; op++) {
+            l[2] = f64vector_map(gc, op, l[0], l[1]);
+            int same = f64vector_length(l[2]) == n;
+            for (long k = 0; same && k < n; k++)
+                same = f64vector_ref(l[2], k) ==
+                       f64_apply(op, f64vector_ref(l[0], k),
+                                 f64vector_ref(l[1], k));
+            CHECK(same);
+            l[2] = f64vector_map_scalar(gc, op, l[1], 2.5);
+            same = f64vector_length(l[2]) == n;
+            for (long k = 0; same && k < n; k++)
+                same = f64vector_ref(l[2], k) ==
+                       f64_apply(op, f64vector_ref(l[1], k), 2.5);
+            CHECK(same);
+        }
+        // the product of a's multiples-of-3 elements
+        for (long k = 0; k < n; k++)
+            if (k % 3) f64vector_set(l[0], k, 1);
+        CHECK(f64vector_fold(F64_MUL, l[0], 1) == prod);
+    }
+    GC_UNLOCALS(l);
+}
+
+// the bigint cases through the reader, the arithmetic primitives and the
+// printer
+static void test_arithmetic(void) {
+    ctx_t *ctx = new_ctx();
+    char source[512];
+    for (size_t i = 0; i < sizeof(bigint_cases) / sizeof(*bigint_cases);
+         i++) {
+        const char **c = bigint_cases[i];
+        static const char *ops[] = {"*", "quotient", "remainder", "modulo"};
+        for (int k = 0; k < 4; k++) {
+            snprintf(source, sizeof(source), "(%s %s %s)", ops[k], c[0],
+                     c[1]);
+            expect(ctx, source, c[2 + k]);
+        }
+    }
+    expect(ctx, "(list (+ 4611686018427387903 1) (- -4611686018427387904 1)"
+                " (* 3037000500 3037000500) (/ 7 2) (/ 1.0 3))",
+           "(4611686018427387904 -4611686018427387905 9223372037000250000"
+           " 7/2 0.3333333333333333)");
+}
+
+// string->symbol interns enough new symbols to resize the context's obarray,
+// finds them again, and symbol->string gives back their names
+static void test_string_symbols(void) {
+    ctx_t *ctx = new_ctx();
+    long n = 20000, size = ctx->obarray.size;
+    size_t length = 320 * n, k = 0;
+    char *source = malloc(length);
+    k += snprintf(source + k, length - k,
+                  "(define syms (make-vector %ld #f))\n(define ok #t)\n", n);
+    for (long i = 0; i < n; i++)
+        k += snprintf(source + k, length - k,
+                      "(vector-set! syms %ld (string->symbol \"new%ld\"))\n",
+                      i, i);
+    for (long i = 0; i < n; i++)
+        k += snprintf(source + k, length - k,
+                      "(set! ok (and ok (eq? (vector-ref syms %ld)\n"
+                      "                      (string->symbol \"new%ld\"))\n"
+                      "              (equal? (symbol->string\n"
+                      "                       (vector-ref syms %ld))\n"
+                      "                      \"new%ld\")))\n",
+                      i, i, i, i);
+    snprintf(source + k, length - k,
+             "(list ok (eq? (vector-ref syms 12345) 'new12345)\n"
+             "      (eq? (vector-ref syms 0) (vector-ref syms 1)))");
+    expect(ctx, source, "(#t #t #f)");
+    free(source);
+    CHECK(ctx->obarray.size > size);
+}
+
+// number literals longer than the reader's token buffer: decimals,
+// rationals and integers, and a symbol that only starts like one
+static void test_reader_numbers(void) {
+    ctx_t *ctx = new_ctx();
+    expect(ctx,
+           "(list 1234567890123456789012345678901234567890123456789012345678"
+           "901234567890.5\n"
+           "      0.00000000000000000000000000000000000000000000000000000000"
+           "000000000001\n"
+           "      -1234567890123456789012345678901234567890123456789012345678"
+           "9012345678e-20)",
+           "(1.2345678901234567e+69 1e-68 -1.2345678901234568e+47)");
+    expect(ctx,
+           "(list 1/300000000000000000000000000000000000000000000000000000000"
+           "00000000000000\n"
+           "      -2000000000000000000000000000000000000000000000000000000000"
+           "000000000000/6\n"
+           "      -1234567890123456789012345678901234567890123456789012345678"
+           "901234567890)",
+           "(1/300000000000000000000000000000000000000000000000000000000000000"
+           "00000000 -10000000000000000000000000000000000000000000000000000000"
+           "00000000000000/3 -123456789012345678901234567890123456789012345678"
+           "9012345678901234567890)");
+    expect(ctx,
+           "(symbol? '123456789012345678901234567890123456789012345678901234"
+           "5678901234567890x)",
+           "#t");
+}
+
+// long lists, a large vector of pairs and deep recursion, with enough garbage
+// in between for many collections
+static void test_gc_stress(void) {
+    ctx_t *ctx = new_ctx();
+    eval_source(ctx,
+                "(define (build n l)\n"
+                "  (if (= n 0) l (build (- n 1) (cons n l))))\n"
+                "(define (sum l s)\n"
+                "  (if (null? l) s (sum (cdr l) (+ s (car l)))))\n"
+                "(define (churn n) (if (> n 0) (begin (make-vector 10 n)\n"
+                "                                     (churn (- n 1)))))\n"
+                "(define (deep n) (if (= n 0) 0 (+ 1 (deep (- n 1)))))\n"
+                "(define pairs (make-vector 100000 #f))\n"
+                "(define (fill i)\n"
+                "  (if (< i 100000)\n"
+                "      (begin (vector-set! pairs i (cons i (list i (* i i))))\n"
+                "             (churn 3)\n"
+                "             (fill (+ i 1)))))\n"
+                "(define (pairs-ok? i)\n"
+                "  (or (= i 100000)\n"
+                "      (let ((p (vector-ref pairs i)))\n"
+                "        (and (= (car p) i) (equal? (cdr p) (list i (* i i)))\n"
+                "             (pairs-ok? (+ i 1))))))\n");
+    expect(ctx, "(sum (build 1000000 '()) 0)", "500000500000");
+    expect(ctx, "(define big (build 300000 '())) (churn 200000) (sum big 0)",
+           "45000150000");
+    expect(ctx, "(fill 0) (churn 200000) (pairs-ok? 0)", "#t");
+    expect(ctx, "(deep 200000)", "200000");
+    CHECK(ctx->memory.stats.minor_count > 0);
+}
+
+// a large vector is allocated in place and never moves. its old-to-young
+// references are found through its dirty flag, and it is freed once
+// unreachable.
+static void test_large(void) {
+    gc_t *gc = new_heap();
+    long n = GC_LARGE_SIZE / sizeof(ptr);
+    ptr v = new_vector(gc, n);
+    gc_preserve(gc, &v);
+    obj *o = ptr_pointer(v);
+    CHECK(o->header & HDR_LARGE);
+    CHECK(!young_pointer_p(gc, v));
+    for (int round = 0; round < 3; round++) {
+        for (long i = 0; i < n; i++) {
+            ptr p = new_pair(gc, make_fixnum(i + round), make_nil());
+            GC_STORE(gc, o, vector[i], p);
+        }
+        collect(gc, round == 2);
+        collect(gc, 0);
+        CHECK(ptr_pointer(v) == o);
+        CHECK(pairs_p(v, round));
+    }
+    size_t bytes = gc->large_bytes;
+    v = make_bool(0);
+    collect(gc, 1);
+    CHECK(gc->large_bytes < bytes);
+    gc_release(gc, 1);
+}
+
+// (gc-stats) has every key, and its counts move with the collections run
+// and agree with the collector's own
+static void test_gc_stats(void) {
+    ctx_t *ctx = new_ctx();
+    gc_t *gc = &ctx->memory;
+    eval_source(ctx,
+                "(define (keys l)\n"
+                "  (if (null? l) '() (cons (car (car l)) (keys (cdr l)))))\n"
+                "(define (stat k)\n"
+                "  (let loop ((l (gc-stats)))\n"
+                "    (if (eq? (car (car l)) k)\n"
+                "        (cdr (car l))\n"
+                "        (loop (cdr l)))))\n"
+                "(define (sum v i s)\n"
+                "  (if (= i (vector-length v)) s\n"
+                "      (sum v (+ i 1) (+ s (vector-ref v i)))))\n"
+                "(define (churn n) (if (> n 0) (begin (make-vector 10 n)\n"
+                "                                     (churn (- n 1)))))\n");
+    expect(ctx, "(keys (gc-stats))",
+           "(minor-collections major-collections incremental-cycles"
+           " heap-grows minor-ns major-ns cycle-ns pauses pause-ns"
+           " max-pause-ns allocated-bytes copied-bytes promoted-bytes"
+           " remembered remembered-bytes live-bytes freed-bytes"
+           " compacted-bytes young-size old-size large-bytes"
+           " pause-histogram)");
+    gc_major(gc);
+    expect(ctx,
+           "(define minors (stat 'minor-collections))\n"
+           "(define majors (stat 'major-collections))\n"
+           "(churn 200000)\n"
+           "(list (> (stat 'minor-collections) minors)\n"
+           "      (>= (stat 'major-collections) majors 1)\n"
+           "      (= (stat 'pauses) (sum (stat 'pause-histogram) 0 0))\n"
+           "      (> (stat 'pause-ns) 0)\n"
+           "      (> (stat 'allocated-bytes) 0))",
+           "(#t #t #t #t #t)");
+    gc_major(gc);
+    char want[64];
+    snprintf(want, sizeof(want), "(%ld %ld)", gc->stats.minor_count,
+             gc->stats.major_count);
+    expect(ctx, "(list (stat 'minor-collections) (stat 'major-collections))",
+           want);
+}
+
+static size_t sampled_bytes[H_TYPES];
+static long sampled_size[H_TYPES];
+
+static void sample(gc_t *gc, enum heapvar_type_t type, long size,
+                   size_t weight) {
+    sampled_bytes[type] += weight;
+    sampled_size[type] = size;
+}
+
+// the samples stand for the bytes allocated and split them between types in
+// proportion, even when each turn of a loop allocates a divisor of the mean
+// interval. a major collection with sampling on counts the live objects of
+// each type.
+static void test_sampling(void) {
+    gc_t *gc = new_heap();
+    memset(sampled_bytes, 0, sizeof(sampled_bytes));
+    gc_set_sampling(gc, 4096, sample);
+    long n = 4000, steps = 400000;
+    ptr v = new_vector(gc, n);
+    gc_preserve(gc, &v);
+    for (long i = 0; i < steps; i++) {
+        ptr p = new_pair(gc, make_fixnum(i), make_nil());
+        GC_STORE(gc, ptr_pointer(v), vector[i % n], p);
+        new_vector(gc, 5);
+    }
+    double pair = sampled_size[H_PAIR], vector = sampled_size[H_VECTOR];
+    double total = (pair + vector) * steps;
+    double sampled = sampled_bytes[H_PAIR] + sampled_bytes[H_VECTOR];
+    CHECK(sampled > 0.95 * total && sampled < 1.05 * total);
+    CHECK(fabs(sampled_bytes[H_PAIR] / sampled - pair / (pair + vector)) <
+          0.05);
+    gc_major(gc);
+    CHECK(gc->census_count[H_PAIR] == (size_t)n);
+    CHECK(gc->census_bytes[H_PAIR] == (size_t)(n * pair));
+    CHECK(gc->census_count[H_VECTOR] >= 1);
+    gc_release(gc, 1);
+}
+
+// each call of build allocates an activation record and a pair, and the
+// samples split the bytes between them in proportion to their sizes
+static void test_sampling_vm(void) {
+    ctx_t *ctx = new_ctx();
+    eval_source(ctx, "(define (build n l)\n"
+                     "  (if (= n 0) l (build (- n 1) (cons n l))))\n");
+    memset(sampled_bytes, 0, sizeof(sampled_bytes));
+    gc_set_sampling(&ctx->memory, 4096, sample);
+    eval_source(ctx, "(build 200000 '()) (build 200000 '())");
+    gc_set_sampling(&ctx->memory, 0, NULL);
+    double pair = sampled_size[H_PAIR];
+    double record = sampled_size[H_ACTIVATION_RECORD];
+    CHECK(pair > 0 && record > 0);
+    double sampled = 0;
+    for (int k = 0; k < H_TYPES; k++) sampled += sampled_bytes[k];
+    CHECK(fabs(sampled_bytes[H_PAIR] / sampled - pair / (pair + record)) <
+          0.05);
+    CHECK(fabs(sampled_bytes[H_ACTIVATION_RECORD] / sampled -
+               record / (pair + record)) < 0.05);
+}
+
+#define SITES_THREADS 4
+#define SITES_PAIRS 200000
+
+static void *sites_thread(void *arg) {
+    gc_t *gc = arg;
+    gc_attach(gc);
+    for (long i = 0; i < SITES_PAIRS; i++)
+        make_pair(gc, make_fixnum(i), make_nil());
+    gc_detach(gc);
+    return NULL;
+}
+
+// with S3_ALLOC_PROFILE set, threads sampling at once into the table of sites
+// account for all the bytes they allocate
+static void test_sampling_sites(void) {
+    setenv("S3_ALLOC_PROFILE", "/dev/null", 1);
+    setenv("S3_ALLOC_SAMPLE", "256", 1);
+    ctx_t *ctx = new_ctx();
+    unsetenv("S3_ALLOC_PROFILE");
+    unsetenv("S3_ALLOC_SAMPLE");
+    gc_t *gc = &ctx->memory;
+    // the threads may stop the world, which this one would hold up
+    gc_detach(gc);
+    pthread_t threads[SITES_THREADS];
+    for (int i = 0; i < SITES_THREADS; i++)
+        pthread_create(&threads[i], NULL, sites_thread, gc);
+    for (int i = 0; i < SITES_THREADS; i++) pthread_join(threads[i], NULL);
+    gc_attach(gc);
+    double bytes = 0, pair = 0;
+    for (long i = 0; i < ctx->alloc_sites_size; i++) {
+        alloc_site_t *a = ctx->alloc_sites + i;
+        bytes += a->bytes;
+        if (a->type == H_PAIR) pair += a->bytes;
+    }
+    long size = OBJ_HEADER_SIZE +
+                ((2 * sizeof(ptr) - 1) / GC_ALIGNMENT + 1) * GC_ALIGNMENT;
+    double total = (double)SITES_THREADS * SITES_PAIRS * size;
+    CHECK(pair > 0.95 * total && pair < 1.05 * total);
+    CHECK(bytes - pair < 0.05 * total);
+}
+
+// a dumped image, loaded into a fresh context, has the globals, closures and
+// large objects defined before the dump. the path is per process, since
+// ctest may run the variants at once.
+static void test_image(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "tests-%d.image", (int)getpid());
+    ctx_t *ctx = new_ctx();
+    eval_source(ctx,
+                "(define xs (list 1 \"two\" 'three 4.5\n"
+                "                 123456789012345678901234567890))\n"
+                "(define big (make-vector 10000 'x))\n"
+                "(define (scale n) (* n (car xs)))\n"
+                "(define counter\n"
+                "  (let ((n 0)) (lambda () (set! n (+ n 1)) n)))\n"
+                "(counter)\n"
+                "(define (build n l)\n"
+                "  (if (= n 0) l (build (- n 1) (cons n l))))\n");
+    ctx_dump_image(ctx, path);
+    ctx = calloc(1, sizeof(ctx_t));
+    ctx_init_image(ctx, path);
+    expect(ctx, "xs", "(1 \"two\" three 4.5 123456789012345678901234567890)");
+    expect(ctx, "(scale 10)", "10");
+    expect(ctx, "(counter)", "2");
+    expect(ctx, "(list (vector-length big) (vector-ref big 9999))",
+           "(10000 x)");
+    expect(ctx, "(length (build 300000 '()))", "300000");
+    collect(&ctx->memory, 1);
+    expect(ctx, "(list (car xs) (vector-ref big 0) (counter))", "(1 x 3)");
+    unlink(path);
+}
+
+// a loaded image maps its file, so dumping it back to the same path must not
+// pull the file from under it
+static void test_image_redump(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "tests-%d.image", (int)getpid());
+    ctx_t *ctx = new_ctx();
+    eval_source(ctx,
+                "(define big (make-vector 10000 'x))\n"
+                "(define xs (list 1 2 3))\n");
+    ctx_dump_image(ctx, path);
+    ctx = calloc(1, sizeof(ctx_t));
+    ctx_init_image(ctx, path);
+    eval_source(ctx, "(define ys (cons 0 xs))");
+    ctx_dump_image(ctx, path);
+    expect(ctx, "(list ys (vector-ref big 9999))", "((0 1 2 3) x)");
+    ctx = calloc(1, sizeof(ctx_t));
+    ctx_init_image(ctx, path);
+    expect(ctx, "(list ys (vector-ref big 9999))", "((0 1 2 3) x)");
+    unlink(path);
+}
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} tests[] = {
+    {"cards", test_cards},
+    {"churn", test_churn},
+    {"obarray", test_obarray},
+    {"port-utf8", test_port_utf8},
+    {"port-pipe", test_port_pipe},
+    {"strings", test_strings},
+    {"bigint", test_bigint},
+    {"f64vector", test_f64vector},
+    {"arithmetic", test_arithmetic},
+    {"string-symbols", test_string_symbols},
+    {"reader-numbers", test_reader_numbers},
+    {"gc-stress", test_gc_stress},
+    {"large", test_large},
+    {"gc-stats", test_gc_stats},
+    {"sampling", test_sampling},
+    {"sampling-vm", test_sampling_vm},
+    {"sampling-sites", test_sampling_sites},
+    {"image", test_image},
+    {"image-redump", test_image_redump},
+};
+
+int main() {
+    for (size_t i = 0; i < sizeof(tests) / sizeof(*tests); i++) {
+        int before = failures;
+        tests[i].run();
+        printf("%s: %s\n", tests[i].name, failures > before ? "FAIL" : "ok");
+    }
+    return failures != 0;
+}
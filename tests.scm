@@ -0,0 +1,111 @@
+; run both by the vm (s3-repl library.scm tests.scm) and compiled ahead of
+; time (the aot-tests target). a failed check calls a list, which aborts with
+; the list in the message.
+
+(define (check name got want)
+  (if (not (equal? got want))
+      ((list 'failed name 'got got 'want want))))
+
+(define (make-counter)
+  (let ((n 0))
+    (lambda () (set! n (+ n 1)) n)))
+(define c (make-counter))
+(c)
+(check "closure" (list (c) (c)) '(2 3))
+
+(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(check "fib" (fib 20) 6765)
+
+(define (count-to n)
+  (let loop ((i 0) (acc '()))
+    (if (= i n) (length acc) (loop (+ i 1) (cons i acc)))))
+(check "named let" (count-to 100000) 100000)
+
+(define (deep n) (if (= n 0) 0 (+ 1 (deep (- n 1)))))
+(check "deep recursion" (deep 100000) 100000)
+
+(define (even-odd n)
+  (define (ev? n) (if (= n 0) #t (od? (- n 1))))
+  (define (od? n) (if (= n 0) #f (ev? (- n 1))))
+  (list (ev? n) (od? n)))
+(check "internal defines" (even-odd 1001) '(#f #t))
+
+(define (rest a . more) (list a more))
+(check "rest arguments" (rest 1 2 3) '(1 (2 3)))
+
+(define v (make-vector 1000 #f))
+(let fill ((i 0))
+  (when (< i 1000)
+    (vector-set! v i (cons i (* i i)))
+    (fill (+ i 1))))
+(check "vector of pairs" (vector-ref v 999) '(999 . 998001))
+
+(check "bignums"
+       (list (* 1152921504606846975 1152921504606846975)
+             (quotient -340282366920938463463374607431768211457
+                       2305843009213693952)
+             (modulo -340282366920938463463374607431768211457
+                     2305843009213693952))
+       '(1329227995784915870597964051066650625
+         -147573952589676412928
+         2305843009213693951))
+
+(check "quoted data" '(1 "two" #\3 4.5 #(five)) (list 1 "two" #\3 4.5 #(five)))
+(check "cond"
+       (let ((x 5)) (cond ((< x 0) 'negative) ((= x 0) 'zero) (else 'positive)))
+       'positive)
+
+(define (plus a b) (+ a b))
+(set! plus *)
+(check "redefined global" (plus 3 4) 12)
+
+(check "symbols and strings"
+       (list (string->symbol "abc") (symbol->string 'hello)
+             (eq? (string->symbol "car") 'car)
+             (eq? (string->symbol (symbol->string 'λx)) 'λx))
+       '(abc "hello" #t #t))
+
+(define (f64-iota n)
+  (let ((v (make-f64vector n 0.0)))
+    (let loop ((i 0))
+      (when (< i n)
+        (f64vector-set! v i (* 1.0 i))
+        (loop (+ i 1))))
+    v))
+(define (f64->list v)
+  (let loop ((i (- (f64vector-length v) 1)) (l '()))
+    (if (< i 0) l (loop (- i 1) (cons (f64vector-ref v i) l)))))
+(define iota5 (f64-iota 5))
+(check "f64vector-map"
+       (list (f64->list (f64vector-map '* iota5 iota5))
+             (f64->list (f64vector-map '- iota5 1.0))
+             (f64->list (f64vector-map 'max iota5 2.0))
+             (f64->list (f64vector-map + iota5 iota5))
+             (f64->list (f64vector-map / iota5 2.0)))
+       '((0.0 1.0 4.0 9.0 16.0) (-1.0 0.0 1.0 2.0 3.0) (2.0 2.0 2.0 3.0 4.0)
+         (0.0 2.0 4.0 6.0 8.0) (0.0 0.5 1.0 1.5 2.0)))
+(check "f64vector-fold"
+       (list (f64vector-fold '+ 0.0 iota5) (f64vector-fold 'min 1.0 iota5)
+             (f64vector-fold * 1.0 (f64vector-map + iota5 1.0))
+             (f64vector-dot iota5 iota5) (f64vector-sum (f64-iota 1001)))
+       '(10.0 0.0 120.0 30.0 500500.0))
+
+;; compiled primcall sites, the fused test-and-branch one included, follow a
+;; later definition or assignment of the primitive's global
+(define (head x) (car x))
+(define (head-if x) (if (pair? x) (car x) 'none))
+(define before (list (head '(1 2)) (head-if '(1 2))))
+(define prim-car car)
+(define prim-pair? pair?)
+(define car cdr)
+(define redefined (list (head '(1 2)) (head-if '(1 2))))
+(set! car prim-car)
+(set! pair? (lambda (x) #f))
+(define assigned (list (head '(1 2)) (head-if '(1 2))))
+(set! pair? prim-pair?)
+(check "redefined primitive"
+       (list before redefined assigned (head-if '(1 2)))
+       '((1 1) ((2) (2)) (1 none) 1))
+
+(display "ok")
+(newline)